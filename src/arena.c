@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+static cd_arena_block* cd_arena_block_create(size_t size) {
+    cd_arena_block* block = (cd_arena_block*)malloc(sizeof(cd_arena_block) + size);
+    block->size = size;
+    block->used = 0;
+    block->next = NULL;
+    return block;
+}
+
+cd_arena* cd_arena_create(size_t block) {
+    cd_arena* arena = (cd_arena*)malloc(sizeof(cd_arena));
+    arena->block = (block) ? block : CD_ARENA_BLOCK;
+    arena->first = cd_arena_block_create(arena->block);
+    arena->current = arena->first;
+    return arena;
+}
+
+void* cd_arena_alloc(cd_arena* arena, size_t size) {
+    cd_arena_block* block = arena->current;
+    size = (size + CD_ARENA_ALIGN - 1) & ~(size_t)(CD_ARENA_ALIGN - 1);
+    if (block->used + size > block->size) {
+        // Blocks left from a release are reused if big enough
+        if (!block->next || (block->next->size < size)) {
+            cd_arena_block* fresh = cd_arena_block_create((size > arena->block) ? size : arena->block);
+            fresh->next = block->next;
+            block->next = fresh;
+        }
+        block = block->next;
+        block->used = 0;
+        arena->current = block;
+    }
+    void* data = block->data + block->used;
+    block->used += size;
+    return data;
+}
+
+char* cd_arena_strdup(cd_arena* arena, const char* string) {
+    size_t length = strlen(string) + 1;
+    return (char*)memcpy(cd_arena_alloc(arena, length), string, length);
+}
+
+char* cd_arena_path(cd_arena* arena, const char* path, const char* name) {
+    size_t length = strlen(path);
+    size_t size = strlen(name) + 1;
+    char* file = (char*)cd_arena_alloc(arena, length + size + 1);
+    memcpy(file, path, length);
+    if (!length || (path[length-1] != '/')) file[length++] = '/';
+    memcpy(&file[length], name, size);
+    return file;
+}
+
+void cd_arena_mark_get(cd_arena* arena, cd_arena_mark* mark) {
+    mark->block = arena->current;
+    mark->used = arena->current->used;
+}
+
+void cd_arena_release(cd_arena* arena, cd_arena_mark* mark) {
+    arena->current = mark->block;
+    arena->current->used = mark->used;
+}
+
+void cd_arena_free(cd_arena* arena) {
+    cd_arena_block* next;
+    for (; arena->first; arena->first = next) {
+        next = arena->first->next;
+        free(arena->first);
+    }
+    free(arena);
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_ARENA_H_
+#define _CD_ARENA_H_
+
+#include <stddef.h>
+
+#define CD_ARENA_BLOCK      65536   // Default size of arena blocks
+#define CD_ARENA_ALIGN      8
+
+typedef struct __cd_arena_block cd_arena_block;
+struct __cd_arena_block {
+    size_t size;
+    size_t used;
+    cd_arena_block* next;   // Kept after release, to be used again
+    char data[];
+};
+
+typedef struct {
+    cd_arena_block* first;
+    cd_arena_block* current;
+    size_t block;
+} cd_arena;
+
+// Position to release the arena back to
+typedef struct {
+    cd_arena_block* block;
+    size_t used;
+} cd_arena_mark;
+
+cd_arena* cd_arena_create(size_t block);
+
+void* cd_arena_alloc(cd_arena* arena, size_t size);
+
+char* cd_arena_strdup(cd_arena* arena, const char* string);
+
+// Joins directory path and name with a slash, unless path ends with one
+char* cd_arena_path(cd_arena* arena, const char* path, const char* name);
+
+void cd_arena_mark_get(cd_arena* arena, cd_arena_mark* mark);
+
+// Frees everything allocated after the mark at once
+void cd_arena_release(cd_arena* arena, cd_arena_mark* mark);
+
+void cd_arena_free(cd_arena* arena);
+
+#endif /* _CD_ARENA_H_ */
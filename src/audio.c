@@ -10,6 +10,7 @@
 #include <fcntl.h>
 #include <arpa/inet.h>
 #include <wchar.h>
+#include <pthread.h>
 
 #include "audio.h"
 #include "cdindex.h"
@@ -44,6 +45,9 @@
 typedef struct {
     const char* path;
     int fd;
+    int prev_fd;            // Previous database or -1
+    cd_base* base;
+    pthread_mutex_t lock;   // Guards fd
 } cd_audio_base;
 
 typedef struct {
@@ -53,12 +57,12 @@ typedef struct {
         cd_byte minor;
     } version;
     cd_byte flags;
-    cd_offset size;
+    cd_dword size;
 } packed(cd_id3v2_header);
 
 typedef struct {
     char id[4];
-    cd_offset size;
+    cd_dword size;
     cd_word flags;
     cd_byte charset;
 } packed(cd_frame_header);
@@ -168,7 +172,7 @@ static const cd_unicode_item cd_utf16_map[] = {
     { 0x0000, 0x00 }
 };
 
-static inline cd_offset cd_ntoh(cd_offset n) {
+static inline cd_dword cd_ntoh(cd_dword n) {
     unsigned char* bytes = (unsigned char*)&n;
     return (bytes[0] << 21) | (bytes[1] << 14) | (bytes[2] << 7) | bytes[3];
 }
@@ -202,10 +206,10 @@ void cd_strcpy(char* dst, int dstlen, const char* src, int srclen, cd_byte chars
                 } else dst[i] = '\0';
             }
         } else {
-            printf("[fixme] big-endian UTF-16 encoding is not supported\n");
+            CD_LOG(CD_LOG_WARNING, "[fixme] big-endian UTF-16 encoding is not supported\n");
         }
     } else {
-        printf("[fixme] unsupported character set 0x%02X\n", charset);
+        CD_LOG(CD_LOG_WARNING, "[fixme] unsupported character set 0x%02X\n", charset);
     }
 }
 
@@ -234,11 +238,11 @@ const char* cd_getstr(const char* name, cd_byte charset) {
             cd_wcstrncpy(s, &((cd_word*)name)[1], cd_wcslen(&((cd_word*)name)[1]));
             return s;
         } else {
-            printf("[fixme] big-endian UTF-16 encoding is not supported\n");
+            CD_LOG(CD_LOG_WARNING, "[fixme] big-endian UTF-16 encoding is not supported\n");
             return NULL;
         }
     } else {
-        printf("[fixme] unsupported character set 0x%02X\n", charset);
+        CD_LOG(CD_LOG_WARNING, "[fixme] unsupported character set 0x%02X\n", charset);
         return NULL;
     }
 }
@@ -268,7 +272,7 @@ cd_byte cd_genre(const char* name, cd_byte charset) {
                 }
             }
             if (gcode == 0xFF) {
-                printf("[warning] unrecognized category \"%s\"\n", str);
+                CD_LOG(CD_LOG_WARNING, "[warning] unrecognized category \"%s\"\n", str);
             }
         }
         if (str != name) free((void*)str);
@@ -289,7 +293,7 @@ cd_byte cd_lang(const char* name, cd_byte charset) {
             }
         }
         if (lcode == 0x00) {
-            printf("[warning] unrecognized language \"%s\"\n", str);
+            CD_LOG(CD_LOG_WARNING, "[warning] unrecognized language \"%s\"\n", str);
         }
         if (str != name) free((void*)str);
         return lcode;
@@ -321,18 +325,33 @@ void* cd_audio_init(cd_base* base) {
     ((char*)mbase->path)[strlen(base->base_name)-4] = '\0';
     strcat((char*)mbase->path, CD_MUSIC_EXT);
     mbase->fd = -1;
+    mbase->prev_fd = (base->update) ? cd_open_previous(mbase->path) : -1;
+    mbase->base = base;
+    pthread_mutex_init(&mbase->lock, NULL);
     return mbase;
 }
 
-cd_offset cd_audio_getdata(const char* file, cd_file_entry* cdentry, void* udata) {
-    if (((cd_audio_base*)udata)->fd == -1) {
-        ((cd_audio_base*)udata)->fd = open(((cd_audio_base*)udata)->path, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-        if (((cd_audio_base*)udata)->fd == -1) return 0;
-        cd_audio_mark mark;
-        memcpy(&mark.mark, CD_MUSIC_MARK, CD_MUSIC_MARK_LEN);
-        mark.version = CD_MUSIC_VERSION;
-        write(((cd_audio_base*)udata)->fd, &mark, sizeof(cd_audio_mark));
+off_t cd_audio_add(cd_audio_base* mbase, cd_audio_entry* entry) {
+    off_t offset = 0;
+    pthread_mutex_lock(&mbase->lock);
+    if (mbase->fd == -1) {
+        mbase->fd = cd_sidecar_open(mbase->base, mbase->path);
+        if ((mbase->fd != -1) && (lseek(mbase->fd, 0, SEEK_END) == 0)) {
+            cd_audio_mark mark;
+            memcpy(&mark.mark, CD_MUSIC_MARK, CD_MUSIC_MARK_LEN);
+            mark.version = CD_MUSIC_VERSION;
+            write(mbase->fd, &mark, sizeof(cd_audio_mark));
+        }
+    }
+    if (mbase->fd != -1) {
+        offset = lseek(mbase->fd, 0, SEEK_END);
+        write(mbase->fd, entry, sizeof(cd_audio_entry));
     }
+    pthread_mutex_unlock(&mbase->lock);
+    return offset;
+}
+
+cd_offset cd_audio_getdata(const char* file, cd_file_entry* cdentry, void* udata) {
     int fd = open(file, O_RDONLY);
     if (fd != -1) {
         cd_audio_entry entry;
@@ -344,11 +363,11 @@ cd_offset cd_audio_getdata(const char* file, cd_file_entry* cdentry, void* udata
         if (!strncmp(id3v2.id, "ID3", 3)) {
             cd_offset offset = sizeof(cd_id3v2_header);
             cd_frame_header frame;
-            printf("[audio] using id3 v.2.%d.%d...\n", id3v2.version.major, id3v2.version.minor);
+            CD_LOG(CD_LOG_FILE, "[audio] using id3 v.2.%d.%d...\n", id3v2.version.major, id3v2.version.minor);
             if (CD_HAS_EXTENDED(id3v2.flags)) {
-                cd_offset extsize;
-                read(fd, &extsize, sizeof(cd_offset));
-                offset = lseek(fd,  cd_ntoh(extsize) - sizeof(cd_offset), SEEK_CUR);
+                cd_dword extsize;
+                read(fd, &extsize, sizeof(cd_dword));
+                offset = lseek(fd,  cd_ntoh(extsize) - sizeof(cd_dword), SEEK_CUR);
             }
             while (offset < cd_ntoh(id3v2.size)) {
                 read(fd, &frame, sizeof(cd_frame_header));
@@ -406,7 +425,7 @@ cd_offset cd_audio_getdata(const char* file, cd_file_entry* cdentry, void* udata
                 lseek(fd, -143, SEEK_END);
                 read(fd, &lyrmark, sizeof(cd_lyrics_footer));
                 if (!strncmp(lyrmark.id, "LYRICS200", 9)) {
-                    printf("[audio] using lyrics3...\n");
+                    CD_LOG(CD_LOG_FILE, "[audio] using lyrics3...\n");
                     char size[7];
                     strncpy(size, lyrmark.size, 6);
                     size[6] = '\0';
@@ -442,10 +461,10 @@ cd_offset cd_audio_getdata(const char* file, cd_file_entry* cdentry, void* udata
                             }
                         }
                     } else {
-                        printf("[warning] lyrics tag is broken\n");
+                        CD_LOG(CD_LOG_WARNING, "[warning] lyrics tag is broken\n");
                     }
                 } else {
-                    printf("[audio] using id3 v.1.%d...\n", ((!id3v1.zero) && (id3v1.track)) ? 1 : 0);
+                    CD_LOG(CD_LOG_FILE, "[audio] using id3 v.1.%d...\n", ((!id3v1.zero) && (id3v1.track)) ? 1 : 0);
                 }
             }
             lseek(fd, 0, SEEK_SET);
@@ -464,21 +483,42 @@ cd_offset cd_audio_getdata(const char* file, cd_file_entry* cdentry, void* udata
             entry.seconds = cdentry->size * 8 / (entry.bitrate * 1000);
 #endif
         } else {
-            printf("[warning] invalid mp3 header (%02X%02X)\n", mp3[0], (mp3[1] & 0xE0));
+            CD_LOG(CD_LOG_WARNING, "[warning] invalid mp3 header (%02X%02X)\n", mp3[0], (mp3[1] & 0xE0));
             close(fd);
             return 0;
         }
         close(fd);
-        off_t offset = lseek(((cd_audio_base*)udata)->fd, 0, SEEK_END);
-        write(((cd_audio_base*)udata)->fd, &entry, sizeof(cd_audio_entry));
-        return offset;
+        return cd_audio_add((cd_audio_base*)udata, &entry);
     }
     return 0;
 }
 
+cd_offset cd_audio_copy(cd_offset info, cd_offset previous, cd_file_entry* cdentry, void* udata) {
+    cd_audio_entry entry;
+    int fd = ((cd_audio_base*)udata)->prev_fd;
+    if ((fd == -1) || (pread(fd, &entry, sizeof(cd_audio_entry), info) != sizeof(cd_audio_entry))) return 0;
+    entry.offset = cdentry->id;
+    return cd_audio_add((cd_audio_base*)udata, &entry);
+}
+
+int cd_audio_save(cd_offset info, cd_file_entry* cdentry, int fd, const char* thumbnail, void* udata) {
+    cd_audio_entry entry;
+    if (pread(((cd_audio_base*)udata)->fd, &entry, sizeof(cd_audio_entry), info) != sizeof(cd_audio_entry)) return 0;
+    return (write(fd, &entry, sizeof(cd_audio_entry)) == sizeof(cd_audio_entry));
+}
+
+cd_offset cd_audio_load(int fd, const char* thumbnail, cd_file_entry* cdentry, void* udata) {
+    cd_audio_entry entry;
+    if (read(fd, &entry, sizeof(cd_audio_entry)) != sizeof(cd_audio_entry)) return 0;
+    entry.offset = cdentry->id;
+    return cd_audio_add((cd_audio_base*)udata, &entry);
+}
+
 void cd_audio_finish(void* udata) {
     if (((cd_audio_base*)udata)->fd != -1) close(((cd_audio_base*)udata)->fd);
+    if (((cd_audio_base*)udata)->prev_fd != -1) cd_close_previous(((cd_audio_base*)udata)->prev_fd, ((cd_audio_base*)udata)->path);
     free((void*)((cd_audio_base*)udata)->path);
+    pthread_mutex_destroy(&((cd_audio_base*)udata)->lock);
     free(udata);
 }
 
@@ -488,6 +528,9 @@ static cd_extractor_info cd_audio = {
     cd_audio_init,
     cd_audio_getdata,
     cd_audio_finish,
+    cd_audio_copy,
+    cd_audio_save,
+    cd_audio_load,
     NULL,
     NULL,
     NULL
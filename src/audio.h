@@ -13,7 +13,7 @@
 
 #define CD_MUSIC_MARK       "CDA"
 #define CD_MUSIC_MARK_LEN   3
-#define CD_MUSIC_VERSION    0x01
+#define CD_MUSIC_VERSION    0x02
 
 enum genres {
     BLUES            = 0x00, CLASSIC_ROCK     = 0x01, COUNTRY          = 0x02, DANCE             = 0x03,
@@ -310,7 +310,7 @@ static const cd_search_item cd_lang_map[] = {
 
 typedef struct {
     char mark[3];           // "CDA"
-    cd_byte version;        // 0x01
+    cd_byte version;        // 0x02
 } packed(cd_audio_mark);
 
 typedef struct {
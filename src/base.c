@@ -4,6 +4,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -12,58 +13,243 @@
 
 #include "cdindex.h"
 #include "base.h"
+#include "sorted.h"
+#include "columns.h"
+#include "block.h"
+#include "check.h"
 
 #define CD_BASE_EXT     ".cdi"
-#define CD_SLINKS_EXT   ".cdl"
 
 void cd_base_free(cd_base* base) {
-    free((void*)base->base_name);
+    if (base->base_name) free((void*)base->base_name);
     if (base->slinks_name) free((void*)base->slinks_name);
     if (base->images_name) free((void*)base->images_name);
+    if (base->heap_name) free((void*)base->heap_name);
+    if (base->names) cd_hash_free(base->names);
     free(base);
 }
 
-cd_base* cd_base_open(const char* path) {
-    cd_base* base = (cd_base*)malloc(sizeof(cd_base));
+static char* cd_base_sidecar(const char* base_name, const char* ext) {
+    char* name = (char*)malloc(strlen(base_name) + strlen(ext) - 3);
+    strncpy(name, base_name, strlen(base_name) - 4);
+    name[strlen(base_name)-4] = '\0';
+    strcat(name, ext);
+    return name;
+}
+
+static char* cd_base_name(const char* path) {
+    char* base_name;
     const char* name = strrchr(path, '/');
     if (!name) name = path;
     if ((strlen(name) < 4) || (strncmp(&name[strlen(name)-4], CD_BASE_EXT, 4))) {
-        base->base_name = (char*)malloc(strlen(path) + 5);
-        strcpy((char*)base->base_name, path);
-        strcat((char*)base->base_name, CD_BASE_EXT);
+        base_name = (char*)malloc(strlen(path) + 5);
+        strcpy(base_name, path);
+        strcat(base_name, CD_BASE_EXT);
     } else {
-        base->base_name = strdup(path);
+        base_name = strdup(path);
     }
+    return base_name;
+}
+
+cd_byte cd_base_version(const char* path) {
+    cd_index_mark mark;
+    cd_byte version = 0x00;
+    char* base_name = cd_base_name(path);
+    int fd = open(base_name, O_RDONLY);
+    if (fd != -1) {
+        cd_block_open(fd);
+        if ((cd_block_pread(fd, &mark, sizeof(cd_index_mark), 0) == sizeof(cd_index_mark)) &&
+            !memcmp(&mark.mark, CD_INDEX_MARK, CD_INDEX_MARK_LEN)) version = mark.version;
+        cd_block_close(fd);
+        close(fd);
+    }
+    free(base_name);
+    return version;
+}
+
+cd_base* cd_base_open(const char* path, int update, int journal) {
+    const char* name;
+    cd_base* base = (cd_base*)malloc(sizeof(cd_base));
+    base->base_name = cd_base_name(path);
     base->slinks_name = NULL;
     base->images_name = NULL;
-    base->base_fd = open(base->base_name, O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    base->heap_name = NULL;
+    base->names = NULL;
+    base->tree = NULL;
+    base->uring = NULL;
+    base->pool = NULL;
+    base->update = NULL;
+    base->cache = NULL;
+    base->schedule = NULL;
+    base->stream = NULL;
+    base->stats = NULL;
+    base->journal = NULL;
+    base->sorted = 0;
+    base->columns = 0;
+    base->compress = 0;
+    base->checksums = 0;
+    base->failed = 0;
+    if (update) {
+        // Previous files are moved aside before they get truncated
+        char* slinks_name = cd_base_sidecar(base->base_name, CD_SLINKS_EXT);
+        char* images_name = cd_base_sidecar(base->base_name, CD_PICTURE_EXT);
+        char* heap_name = cd_base_sidecar(base->base_name, CD_NAMES_EXT);
+        // Previous index is read by records, so it cannot stay compressed
+        if (!cd_block_expand(base->base_name) || !cd_block_expand(heap_name)) {
+            CD_LOG(CD_LOG_ERROR, "[error] failed to uncompress previous index: \"%s\"\n", base->base_name);
+            free(heap_name);
+            free(images_name);
+            free(slinks_name);
+            cd_base_free(base);
+            return NULL;
+        }
+        base->update = cd_update_open(base->base_name, slinks_name, images_name, heap_name);
+        free(heap_name);
+        free(images_name);
+        free(slinks_name);
+    }
+    if (journal) base->journal = cd_journal_open(base->base_name, (journal == CD_JOURNAL_RESUME));
+    if (base->journal && base->journal->resumed) {
+        // Records after the checkpoint could be written partially
+        base->base_fd = open(base->base_name, O_RDWR|O_CREAT, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+        if (base->base_fd != -1) ftruncate(base->base_fd, CD_RECORD_OFFSET(base->journal->resumed));
+    } else {
+        base->base_fd = open(base->base_name, O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    }
     if (base->base_fd != -1) {
         base->slinks_fd = -1;
         base->images_fd = -1;
+        base->arena = cd_arena_create(0);
+        pthread_mutex_init(&base->lock, NULL);
         // We can rewrite base_name only now - when file is opened
         if (*base->base_name != '/') {
             name = base->base_name;
             base->base_name = realpath(name, NULL);
             free((void*)name);
         }
-        base->slinks_name = (char*)malloc(strlen(base->base_name) + 1);
-        strncpy((char*)base->slinks_name, base->base_name, strlen(base->base_name) - 4);
-        ((char*)base->slinks_name)[strlen(base->base_name)-4] = '\0';
-        strcat((char*)base->slinks_name, CD_SLINKS_EXT);
-        base->images_name = (char*)malloc(strlen(base->base_name) + 1);
-        strncpy((char*)base->images_name, base->base_name, strlen(base->base_name) - 4);
-        ((char*)base->images_name)[strlen(base->base_name)-4] = '\0';
-        strcat((char*)base->images_name, CD_PICTURE_EXT);
+        base->slinks_name = cd_base_sidecar(base->base_name, CD_SLINKS_EXT);
+        base->images_name = cd_base_sidecar(base->base_name, CD_PICTURE_EXT);
+        base->heap_name = cd_base_sidecar(base->base_name, CD_NAMES_EXT);
+        // Sorted index, columns and checksums of the previous run would not match
+        char* sorted_name = cd_base_sidecar(base->base_name, CD_SORTED_EXT);
+        unlink(sorted_name);
+        free(sorted_name);
+        char* columns_name = cd_base_sidecar(base->base_name, CD_COLUMNS_EXT);
+        unlink(columns_name);
+        free(columns_name);
+        char* check_name = cd_base_sidecar(base->base_name, CD_CHECK_EXT);
+        unlink(check_name);
+        free(check_name);
+        base->heap_fd = cd_sidecar_open(base, base->heap_name);
+        base->heap_size = (base->heap_fd != -1) ? lseek(base->heap_fd, 0, SEEK_END) : 0;
+        if ((base->heap_fd != -1) && (base->heap_size == 0)) {
+            // Names are not terminated, offset 0 is never used for them
+            cd_index_mark mark;
+            memcpy(&mark.mark, CD_NAMES_MARK, CD_INDEX_MARK_LEN);
+            mark.version = CD_NAMES_VERSION;
+            if (write(base->heap_fd, &mark, sizeof(cd_index_mark)) == sizeof(cd_index_mark)) {
+                base->heap_size = sizeof(cd_index_mark);
+            }
+        }
+        if (base->heap_fd == -1) CD_LOG(CD_LOG_ERROR, "[error] failed to create names heap: \"%s\"\n", base->heap_name);
+        // Repeated names point to the first copy
+        else base->names = cd_hash_create(CD_NAMES_SIZE);
         return base;
     } else {
+        // Previous files stay renamed, so nothing is lost
+        if (base->journal) cd_journal_close(base->journal, 0);
         cd_base_free(base);
         return NULL;
     }
 }
 
-void cd_base_close(cd_base* base) {
+cd_base* cd_base_create() {
+    cd_base* base = (cd_base*)malloc(sizeof(cd_base));
+    base->base_name = NULL;
+    base->slinks_name = NULL;
+    base->images_name = NULL;
+    base->heap_name = NULL;
+    base->tree = cd_tree_create(1, NULL);
+    base->uring = NULL;
+    base->pool = NULL;
+    base->update = NULL;
+    base->cache = NULL;
+    base->schedule = NULL;
+    base->stream = NULL;
+    base->stats = NULL;
+    base->arena = cd_arena_create(0);
+    base->journal = NULL;
+    base->sorted = 0;
+    base->columns = 0;
+    base->compress = 0;
+    base->checksums = 0;
+    base->failed = 0;
+    base->base_fd = -1;
+    base->images_fd = -1;
+    // Names are written with records, which stay in the tree
+    base->heap_fd = -1;
+    base->heap_size = 0;
+    base->names = NULL;
+    pthread_mutex_init(&base->lock, NULL);
+    // Symlinks are kept in memory too, offsets stay valid while open
+    base->slinks_fd = memfd_create("cdindex", MFD_CLOEXEC);
+    if (base->slinks_fd != -1) {
+        cd_index_mark mark;
+        memcpy(&mark.mark, CD_LINKS_MARK, CD_INDEX_MARK_LEN);
+        mark.version = CD_LINKS_VERSION;
+        write(base->slinks_fd, &mark, sizeof(cd_index_mark));
+    }
+    return base;
+}
+
+int cd_sidecar_open(cd_base* base, const char* path) {
+    off_t size = (base->journal) ? cd_journal_size(base->journal, path) : 0;
+    int fd = open(path, (size) ? O_RDWR|O_CREAT : O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if ((fd != -1) && base->journal) cd_journal_track(base->journal, path, fd);
+    return fd;
+}
+
+static int cd_base_compress(const char* path) {
+    struct stat before, after;
+    if (stat(path, &before) || !cd_block_compress(path) || stat(path, &after)) {
+        CD_LOG(CD_LOG_ERROR, "[error] failed to compress: \"%s\"\n", path);
+        return 0;
+    }
+    CD_LOG(CD_LOG_INFO, "[block] compressed \"%s\": %llu => %llu bytes\n", path,
+           (unsigned long long)before.st_size, (unsigned long long)after.st_size);
+    return 1;
+}
+
+int cd_base_close(cd_base* base) {
+    // Records written directly report failures as they go
+    int result = !base->failed;
+    if (base->tree) {
+        if ((base->base_fd != -1) && (base->heap_fd != -1) &&
+            !cd_tree_flush(base->tree, base->base_fd, sizeof(cd_iso_header), base->heap_fd, base->names)) result = 0;
+        cd_tree_free(base->tree);
+    }
+    if (!result && base->base_name) CD_LOG(CD_LOG_ERROR, "[error] failed to write index: \"%s\"\n", base->base_name);
+    if (base->pool) cd_pool_free(base->pool);
+    if (base->uring) cd_uring_free(base->uring);
+    if (base->update) cd_update_close(base->update);
+    if (base->cache) cd_cache_close(base->cache);
+    if (base->schedule) cd_schedule_free(base->schedule);
+    if (base->stream) cd_stream_free(base->stream);
+    cd_arena_free(base->arena);
+    // Closed only after everything is written, so the index is complete
+    if (base->journal) cd_journal_close(base->journal, result);
+    if (base->heap_fd != -1) close(base->heap_fd);
     if (base->images_fd != -1) close(base->images_fd);
     if (base->slinks_fd != -1) close(base->slinks_fd);
-    close(base->base_fd);
+    if (base->base_fd != -1) close(base->base_fd);
+    // Sidecars of an incomplete index would not match it
+    if (result && base->sorted && base->base_name && !cd_sorted_build(base->base_name, base->heap_name)) result = 0;
+    if (result && base->columns && base->base_name && !cd_columns_build(base->base_name, base->heap_name)) result = 0;
+    if (result && base->compress && base->base_name &&
+        (!cd_base_compress(base->base_name) || !cd_base_compress(base->heap_name))) result = 0;
+    // Last, so that every file is complete and checksums stay valid after compression
+    if (result && base->checksums && base->base_name && !cd_check_build(base->base_name)) result = 0;
+    pthread_mutex_destroy(&base->lock);
     cd_base_free(base);
+    return result;
 }
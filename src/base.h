@@ -5,19 +5,61 @@
 #ifndef _CD_BASE_H_
 #define _CD_BASE_H_
 
+#include "hash.h"
+#include "tree.h"
+#include "uring.h"
+#include "pool.h"
+#include "update.h"
+#include "cache.h"
+#include "schedule.h"
+#include "stream.h"
+#include "stats.h"
+#include "arena.h"
+#include "journal.h"
+
 #define CD_PICTURE_EXT  ".cdp"
 
 typedef struct {
     const char* base_name;
     const char* slinks_name;
     const char* images_name;
+    const char* heap_name;
     int base_fd;
     int slinks_fd;
     int images_fd;
+    int heap_fd;            // Names heap
+    off_t heap_size;        // End of the names heap
+    cd_hash* names;         // Name -> its offset in the heap, or NULL to store every name
+    cd_tree* tree;          // In-memory records or NULL
+    cd_uring* uring;        // Ring for batched stat or NULL
+    cd_pool* pool;          // Extractor workers or NULL
+    cd_update* update;      // Previous index to reuse or NULL
+    cd_cache* cache;        // Cache of extracted data or NULL
+    cd_schedule* schedule;  // Jobs to run in block order or NULL
+    cd_stream* stream;      // Jobs fed from one read of the device or NULL
+    cd_stats* stats;        // Stage timers and counters or NULL, not owned
+    cd_arena* arena;        // Entries and paths of the walk, released per directory
+    cd_journal* journal;    // Completed directories, to resume from, or NULL
+    int sorted;             // Write the sorted name index on close
+    int columns;            // Write the attribute columns on close
+    int compress;           // Compress the index and its names on close
+    int checksums;          // Write checksums of all files of the catalog on close
+    int failed;             // Some record or name could not be written
+    pthread_mutex_t lock;   // Guards sidecars shared by extractors
 } cd_base;
 
-cd_base* cd_base_open(const char* path);
+// Version of the existing index, or 0 if there is none
+cd_byte cd_base_version(const char* path);
+
+// Journal is one of CD_JOURNAL_NONE, CD_JOURNAL_WRITE and CD_JOURNAL_RESUME
+cd_base* cd_base_open(const char* path, int update, int journal);
+
+cd_base* cd_base_create();
+
+// Opens a sidecar database for appending, keeping what a resumed run committed
+int cd_sidecar_open(cd_base* base, const char* path);
 
-void cd_base_close(cd_base* base);
+// Writes records kept in memory and sidecars, returns 0 if some write failed
+int cd_base_close(cd_base* base);
 
 #endif /* _CD_BASE_H_ */
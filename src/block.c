@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <zlib.h>
+
+#include "block.h"
+
+typedef struct {
+    cd_offset size;
+    cd_offset blocks;
+    cd_dword block;
+    cd_offset* offsets;     // Of the blocks and of the end
+    char* packed;           // Compressed block being read
+    char* cache[CD_BLOCK_CACHE];
+    cd_offset cached[CD_BLOCK_CACHE];   // Block numbers, plus one
+    uint64_t used[CD_BLOCK_CACHE];
+    uint64_t tick;
+} cd_block_file;
+
+// Readers keep passing descriptors, so compressed files are found by them
+static cd_block_file** cd_block_files = NULL;
+static int cd_block_files_size = 0;
+
+static cd_block_file* cd_block_find(int fd) {
+    return ((fd >= 0) && (fd < cd_block_files_size)) ? cd_block_files[fd] : NULL;
+}
+
+int cd_block_open(int fd) {
+    struct stat st;
+    cd_block_header header;
+    cd_block_footer footer;
+    cd_offset i;
+    if (cd_block_find(fd)) return 1;
+    if ((pread(fd, &header, sizeof(cd_block_header), 0) != sizeof(cd_block_header)) ||
+        memcmp(&header.mark.mark, CD_BLOCK_MARK, CD_INDEX_MARK_LEN)) return 0;
+    if ((header.mark.version != CD_BLOCK_VERSION) || !header.block || fstat(fd, &st) ||
+        (st.st_size < (off_t)(sizeof(cd_block_header) + sizeof(cd_block_footer))) ||
+        (pread(fd, &footer, sizeof(cd_block_footer), st.st_size - sizeof(cd_block_footer)) != sizeof(cd_block_footer)) ||
+        (footer.blocks != (footer.size + header.block - 1) / header.block) ||
+        ((footer.blocks + 1) * sizeof(cd_offset) > st.st_size - sizeof(cd_block_header) - sizeof(cd_block_footer))) return -1;
+    cd_block_file* file = (cd_block_file*)calloc(1, sizeof(cd_block_file));
+    file->size = footer.size;
+    file->blocks = footer.blocks;
+    file->block = header.block;
+    file->offsets = (cd_offset*)malloc((footer.blocks + 1) * sizeof(cd_offset));
+    off_t index = st.st_size - sizeof(cd_block_footer) - (footer.blocks + 1) * sizeof(cd_offset);
+    int valid = (pread(fd, file->offsets, (footer.blocks + 1) * sizeof(cd_offset), index) == (footer.blocks + 1) * sizeof(cd_offset)) &&
+                (file->offsets[0] == sizeof(cd_block_header)) && (file->offsets[footer.blocks] == (cd_offset)index);
+    for (i = 0; valid && (i < footer.blocks); i++) {
+        if ((file->offsets[i+1] < file->offsets[i]) || (file->offsets[i+1] - file->offsets[i] > compressBound(header.block))) valid = 0;
+    }
+    if (!valid) {
+        free(file->offsets);
+        free(file);
+        return -1;
+    }
+    file->packed = (char*)malloc(compressBound(header.block));
+    if (fd >= cd_block_files_size) {
+        int size = (fd < 16) ? 16 : fd * 2;
+        cd_block_files = (cd_block_file**)realloc(cd_block_files, size * sizeof(cd_block_file*));
+        memset(cd_block_files + cd_block_files_size, '\0', (size - cd_block_files_size) * sizeof(cd_block_file*));
+        cd_block_files_size = size;
+    }
+    cd_block_files[fd] = file;
+    return 1;
+}
+
+void cd_block_close(int fd) {
+    int i;
+    cd_block_file* file = cd_block_find(fd);
+    if (!file) return;
+    for (i = 0; i < CD_BLOCK_CACHE; i++) free(file->cache[i]);
+    free(file->packed);
+    free(file->offsets);
+    free(file);
+    cd_block_files[fd] = NULL;
+}
+
+// Uncompressed block from the cache, the least recently used one is replaced
+static const char* cd_block_get(int fd, cd_block_file* file, cd_offset number) {
+    int i, slot = 0;
+    for (i = 0; i < CD_BLOCK_CACHE; i++) {
+        if (file->cached[i] == number + 1) {
+            file->used[i] = ++file->tick;
+            return file->cache[i];
+        }
+        if (file->used[i] < file->used[slot]) slot = i;
+    }
+    uLongf expected = (number + 1 < file->blocks) ? file->block : file->size - number * file->block;
+    cd_offset length = file->offsets[number+1] - file->offsets[number];
+    if (!file->cache[slot]) file->cache[slot] = (char*)malloc(file->block);
+    file->cached[slot] = 0;
+    if (length == expected) {
+        if (pread(fd, file->cache[slot], length, file->offsets[number]) != length) return NULL;
+    } else {
+        uLongf size = expected;
+        if ((pread(fd, file->packed, length, file->offsets[number]) != length) ||
+            (uncompress((Bytef*)file->cache[slot], &size, (Bytef*)file->packed, length) != Z_OK) ||
+            (size != expected)) return NULL;
+    }
+    file->cached[slot] = number + 1;
+    file->used[slot] = ++file->tick;
+    return file->cache[slot];
+}
+
+ssize_t cd_block_pread(int fd, void* buf, size_t size, off_t offset) {
+    size_t done = 0;
+    cd_block_file* file = cd_block_find(fd);
+    if (!file) return pread(fd, buf, size, offset);
+    if (offset < 0) return -1;
+    if ((cd_offset)offset >= file->size) return 0;
+    if (size > file->size - offset) size = file->size - offset;
+    while (done < size) {
+        cd_offset number = (offset + done) / file->block;
+        size_t start = (offset + done) % file->block;
+        size_t length = file->block - start;
+        const char* block = cd_block_get(fd, file, number);
+        if (!block) return (done) ? (ssize_t)done : -1;
+        if (length > size - done) length = size - done;
+        memcpy((char*)buf + done, block + start, length);
+        done += length;
+    }
+    return done;
+}
+
+off_t cd_block_size(int fd) {
+    struct stat st;
+    cd_block_file* file = cd_block_find(fd);
+    if (file) return file->size;
+    return (fstat(fd, &st)) ? 0 : st.st_size;
+}
+
+// Writes the file anew next to it and puts the copy in its place
+static int cd_block_rewrite(const char* path, int fd, int compress) {
+    cd_block_header header;
+    cd_block_footer footer;
+    cd_offset count = 0, size = 16;
+    ssize_t bytes = 0;
+    off_t offset = 0;
+    char* temp = (char*)malloc(strlen(path) + 3);
+    sprintf(temp, "%s.z", path);
+    int tfd = open(temp, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if (tfd == -1) {
+        free(temp);
+        return 0;
+    }
+    char* buf = (char*)malloc(CD_BLOCK_SIZE);
+    char* packed = (char*)malloc(compressBound(CD_BLOCK_SIZE));
+    cd_offset* offsets = (cd_offset*)malloc(size * sizeof(cd_offset));
+    int result = 1;
+    if (compress) {
+        memcpy(&header.mark.mark, CD_BLOCK_MARK, CD_INDEX_MARK_LEN);
+        header.mark.version = CD_BLOCK_VERSION;
+        header.block = CD_BLOCK_SIZE;
+        result = (write(tfd, &header, sizeof(cd_block_header)) == sizeof(cd_block_header));
+        offsets[0] = sizeof(cd_block_header);
+    }
+    while (result && ((bytes = cd_block_pread(fd, buf, CD_BLOCK_SIZE, offset)) > 0)) {
+        offset += bytes;
+        if (!compress) {
+            result = (write(tfd, buf, bytes) == bytes);
+            continue;
+        }
+        uLongf length = compressBound(CD_BLOCK_SIZE);
+        const char* data = packed;
+        if ((compress2((Bytef*)packed, &length, (Bytef*)buf, bytes, CD_BLOCK_LEVEL) != Z_OK) || (length >= (uLongf)bytes)) {
+            data = buf;
+            length = bytes;
+        }
+        result = (write(tfd, data, length) == (ssize_t)length);
+        if (++count == size) {
+            size *= 2;
+            offsets = (cd_offset*)realloc(offsets, size * sizeof(cd_offset));
+        }
+        offsets[count] = offsets[count-1] + length;
+    }
+    if (bytes < 0) result = 0;
+    if (result && compress) {
+        footer.size = offset;
+        footer.blocks = count;
+        result = (write(tfd, offsets, (count + 1) * sizeof(cd_offset)) == (ssize_t)((count + 1) * sizeof(cd_offset))) &&
+                 (write(tfd, &footer, sizeof(cd_block_footer)) == sizeof(cd_block_footer));
+    }
+    free(offsets);
+    free(packed);
+    free(buf);
+    if (close(tfd)) result = 0;
+    if (result && rename(temp, path)) result = 0;
+    if (!result) unlink(temp);
+    free(temp);
+    return result;
+}
+
+int cd_block_compress(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return 0;
+    int result = cd_block_open(fd);
+    if (result == 0) result = cd_block_rewrite(path, fd, 1);
+    else cd_block_close(fd);
+    close(fd);
+    return (result == 1);
+}
+
+int cd_block_expand(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return 0;
+    int result = cd_block_open(fd);
+    if (result == 1) {
+        result = cd_block_rewrite(path, fd, 0);
+        cd_block_close(fd);
+    } else if (result == 0) {
+        result = 1;
+    }
+    close(fd);
+    return (result == 1);
+}
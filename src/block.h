@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_BLOCK_H_
+#define _CD_BLOCK_H_
+
+#include <sys/types.h>
+
+#include "data.h"
+
+#define CD_BLOCK_MARK       "CDZ"
+#define CD_BLOCK_VERSION    0x01
+#define CD_BLOCK_SIZE       65536   // Of uncompressed data
+#define CD_BLOCK_CACHE      8       // Blocks kept uncompressed per file
+#define CD_BLOCK_LEVEL      9
+
+// Followed by blocks compressed with zlib one by one, or stored as is if
+// that is not smaller, by offsets of the blocks and of the end, and by
+// cd_block_footer
+typedef struct {
+    cd_index_mark mark;
+    cd_dword block;         // Size of uncompressed blocks
+} packed(cd_block_header);
+
+typedef struct {
+    cd_offset size;         // Of uncompressed data
+    cd_offset blocks;
+} packed(cd_block_footer);
+
+// Reads through blocks of the file, if it is compressed, returns -1 if it is damaged
+int cd_block_open(int fd);
+
+void cd_block_close(int fd);
+
+// Same as pread(), but for uncompressed data of the file
+ssize_t cd_block_pread(int fd, void* buf, size_t size, off_t offset);
+
+// Size of uncompressed data
+off_t cd_block_size(int fd);
+
+// Replaces the file with its compressed copy, unless it is compressed already
+int cd_block_compress(const char* path);
+
+// Replaces the compressed file with its uncompressed copy
+int cd_block_expand(const char* path);
+
+#endif /* _CD_BLOCK_H_ */
@@ -21,85 +21,21 @@
 #include "audio.h"
 #include "image.h"
 #include "video.h"
+#include "record.h"
+#include "catalog.h"
+#include "sorted.h"
 
-typedef struct __cd_path_entry cd_path_entry;
-struct __cd_path_entry {
-    cd_offset id;
-    char* name;
-    cd_path_entry* prev;
-};
+// Set for catalogs to be checked against their checksums as they are read,
+// mc gives cdbrowse no options
+#define CD_VERIFY_ENV   "CDBROWSE_VERIFY"
 
-typedef int (*cd_entry_dump)(const char*, cd_file_entry*, const char*);
+typedef int (*cd_entry_dump)(cd_catalog*, cd_file_entry*, const char*);
 
 typedef struct {
     const char* regex;
     cd_entry_dump dump;
 } cd_dumper_info;
 
-cd_path_entry* cd_push_entry(cd_path_entry* parent, cd_file_entry* entry) {
-    cd_path_entry* path = (cd_path_entry*)malloc(sizeof(cd_path_entry));
-    path->id = entry->id;
-    path->name = strdup(entry->name);
-    path->prev = NULL;
-    if (parent) {
-        cd_path_entry* top;
-        for (top = parent; top->prev; top = top->prev);
-        top->prev = path;
-        return parent;
-    } else return path;
-}
-
-cd_path_entry* cd_free_entries(cd_path_entry* path, cd_offset id, int base) {
-    cd_path_entry* prev;
-    cd_path_entry* entry;
-    for (entry = path; entry;) {
-        if (entry->id == id) break;
-        prev = entry->prev;
-        free(entry->name);
-        free(entry);
-        entry = prev;
-    }
-    if ((!entry) && (id != 0)) { // Full clean done while not requested
-        cd_offset i;
-        cd_file_entry data;
-        for (i = id; i;) {
-            lseek(base, sizeof(cd_iso_header) + (i - 1) * (sizeof(cd_file_entry) - sizeof(cd_offset)), SEEK_SET);
-            read(base, (void*)&data + sizeof(cd_offset), sizeof(cd_file_entry) - sizeof(cd_offset));
-            data.id = i;
-            entry = cd_push_entry(entry, &data);
-            i = data.parent;
-        }
-    }
-    return entry;
-}
-
-cd_path_entry* cd_add_entry(cd_path_entry* parent, cd_file_entry* entry, cd_offset id, int base) {
-    parent = cd_free_entries(parent, entry->parent, base);
-    cd_path_entry* path = (cd_path_entry*)malloc(sizeof(cd_path_entry));
-    path->id = id;
-    path->name = strdup(entry->name);
-    path->prev = parent;
-    return path;
-}
-
-const char* cd_get_path(cd_path_entry* path, const char* file) {
-    cd_path_entry* entry;
-    size_t length = strlen(file) + 1;
-    for (entry = path; entry; entry = entry->prev) {
-        length += strlen(entry->name) + 1;
-    }
-    char* tmpstr = (char*)malloc(length);
-    tmpstr[--length] = '\0';
-    length -= strlen(file);
-    memcpy(&tmpstr[length], file, strlen(file));
-    for (entry = path; entry; entry = entry->prev) {
-        tmpstr[--length] = '/';
-        length -= strlen(entry->name);
-        memcpy(&tmpstr[length], entry->name, strlen(entry->name));
-    }
-    return tmpstr;
-}
-
 const char* cd_get_genre(cd_byte gcode) {
     const cd_search_item* genre;
     for (genre = cd_genre_map; genre->name; genre++) {
@@ -124,41 +60,48 @@ const char* cd_get_translation(cd_byte tcode) {
     return "?";
 }
 
-cd_byte cd_get_index_version(int fd) {
-    cd_index_mark mark;
-    lseek(fd, 0, SEEK_SET);
-    if ((read(fd, &mark, sizeof(cd_index_mark)) == sizeof(cd_index_mark)) &&
-        (memcmp(mark.mark, CD_INDEX_MARK, CD_INDEX_MARK_LEN) == 0)) {
-        return mark.version;
+cd_byte cd_get_index_version(cd_catalog* catalog) {
+    if (memcmp(catalog->header.mark.mark, CD_INDEX_MARK, CD_INDEX_MARK_LEN) == 0) {
+        return catalog->header.mark.version;
     }
     return 0x00;
 }
 
+// False if verification was asked for, but checksums are damaged or stale
+int cd_verify(cd_catalog* catalog) {
+    return !getenv(CD_VERIFY_ENV) || (cd_catalog_verify(catalog) != -1);
+}
+
 int cd_list(const char* file) {
     int ret = EXIT_SUCCESS;
-    int base = open(file, O_RDONLY);
-    if (base != -1) {
-        cd_byte cdiver = cd_get_index_version(base);
-        if (cdiver == CD_INDEX_VERSION) {
+    cd_catalog* catalog = cd_catalog_open(file);
+    if (catalog) {
+        cd_byte cdiver = cd_get_index_version(catalog);
+        if (catalog->damaged) {
+            printf("Block 0 of CD index is damaged -- use cdverify to check it!\n");
+            ret = EXIT_FAILURE;
+        } else if ((cdiver == CD_INDEX_VERSION) && !cd_verify(catalog)) {
+            printf("Checksums do not match CD index -- use cdverify to check it!\n");
+            ret = EXIT_FAILURE;
+        } else if (cdiver == CD_INDEX_VERSION) {
             cd_offset i;
             time_t mtime;
             struct tm* tm;
-            struct stat stat;
             char* fpath;
             struct group* grp;
             struct passwd* pwd;
-            fstat(base, &stat);
             cd_file_entry entry;
-            cd_path_entry* path = NULL;
-            fpath = strdup(file);
-            fpath[strlen(file)-1] = 'l';
+            fpath = cd_catalog_sidecar(catalog, CD_SLINKS_EXT);
             int slinks = open(fpath, O_RDONLY);
             free(fpath);
-            for (i = 0; i < (stat.st_size - sizeof(cd_iso_header)) / (sizeof(cd_file_entry) - sizeof(cd_offset)); i++) {
-                lseek(base, sizeof(cd_iso_header) + i * (sizeof(cd_file_entry) - sizeof(cd_offset)), SEEK_SET);
-                read(base, (void*)&entry + sizeof(cd_offset), sizeof(cd_file_entry) - sizeof(cd_offset));
-                if ((path && (entry.parent != path->id)) || (!path && entry.parent))
-                    path = cd_free_entries(path, entry.parent, base);
+            for (i = 1; i <= catalog->records; i++) {
+                // Paths are built from names of parents, which are mapped as well
+                fpath = (cd_catalog_entry(catalog, i, &entry)) ? cd_catalog_path(catalog, i) : NULL;
+                if (!fpath) {
+                    printf("Failed to read record #%llu%s!\n", (unsigned long long)i, (catalog->damaged) ? ", CD index is damaged" : "");
+                    ret = EXIT_FAILURE;
+                    break;
+                }
                 printf("%c%c%c%c%c%c%c%c%c%c 1",
                     ((entry.type == CD_DIR) || ((entry.type == CD_ARC) && (entry.child != 0))) ? 'd' : (entry.type == CD_LNK) ? 'l' : '-',
                     (entry.mode & S_IRUSR) ? 'r' : '-',
@@ -178,7 +121,6 @@ int cd_list(const char* file) {
                 else printf(" %d", entry.gid);
                 mtime = entry.mtime;
                 tm = localtime(&mtime);
-                fpath = (char*)cd_get_path(path, entry.name);
                 printf(" %lu %02d-%02d-%04d %02d:%02d %s",
                     (entry.type != CD_DIR) ? entry.size : 0,
                     tm->tm_mon + 1, tm->tm_mday, tm->tm_year + 1900,
@@ -187,9 +129,8 @@ int cd_list(const char* file) {
                 free(fpath);
                 if (entry.type == CD_LNK) {
                     if ((slinks != -1) && entry.size) {
-                        lseek(slinks, entry.info, SEEK_SET);
                         fpath = (char*)malloc(entry.size + 1);
-                        read(slinks, fpath, entry.size);
+                        if (pread(slinks, fpath, entry.size, entry.info) != entry.size) entry.size = 0;
                         fpath[entry.size] = '\0';
                         printf(" -> %s", fpath);
                         free(fpath);
@@ -198,12 +139,11 @@ int cd_list(const char* file) {
                     }
                 }
                 printf("\n");
-                DEBUG_OUTPUT(DEBUG_DEBUG, "%3u: p:%3u <- n:%3u -> c:%3u %s\n",
-                    i + 1, entry.parent, entry.next, entry.child, entry.name);
-                if ((entry.type <= CD_ARC) && (entry.child != 0))
-                    path = cd_add_entry(path, &entry, i + 1, base);
+                DEBUG_OUTPUT(DEBUG_DEBUG, "%3llu: p:%3llu <- n:%3llu -> c:%3llu %s\n",
+                    (unsigned long long)i, (unsigned long long)entry.parent, (unsigned long long)entry.next,
+                    (unsigned long long)entry.child, entry.name);
             }
-            cd_free_entries(path, 0, base);
+            if (slinks != -1) close(slinks);
         } else {
             if (cdiver == 0x00) {
                 printf("Invalid CD index!\n");
@@ -214,28 +154,22 @@ int cd_list(const char* file) {
             }
             ret = EXIT_FAILURE;
         }
-        close(base);
+        cd_catalog_close(catalog);
     } else {
         ret = EXIT_FAILURE;
     }
     return ret;
 }
 
-int cd_dump_audio(const char* arch, cd_file_entry* entry, const char* to) {
+int cd_dump_audio(cd_catalog* catalog, cd_file_entry* entry, const char* to) {
     int ret = EXIT_SUCCESS;
-    char* cda = (char*)malloc(strlen(arch) + 1);
-    strncpy(cda, arch, strlen(arch) - 4);
-    cda[strlen(arch)-4] = '\0';
-    strcat(cda, CD_MUSIC_EXT);
-    int fd = open(cda, O_RDONLY);
-    free(cda);
-    if (fd != -1) {
+    const void* data = cd_catalog_sidecar_entry(catalog, CD_MUSIC_EXT, entry->info, sizeof(cd_audio_entry));
+    if (data) {
         umask(066);
         FILE* f = fopen(to, "w");
         if (f) {
             cd_audio_entry audio;
-            lseek(fd, entry->info, SEEK_SET);
-            read(fd, &audio, sizeof(cd_audio_entry));
+            memcpy(&audio, data, sizeof(cd_audio_entry));
             fprintf(f, "File:          %.*s\n", CD_NAME_MAX, entry->name);
             fprintf(f, "Version:       MPEG %d.%d Layer %s\n",
                 (audio.mpeg == 0x11) ? 1 : 2, (audio.mpeg == 0x00) ? 5 : 0,
@@ -271,7 +205,6 @@ int cd_dump_audio(const char* arch, cd_file_entry* entry, const char* to) {
         } else {
             ret = EXIT_FAILURE;
         }
-        close(fd);
     } else {
         ret = EXIT_FAILURE;
     }
@@ -285,11 +218,11 @@ void cd_print_thumbnails(FILE* f, const char* arch, cd_file_entry* entry) {
     strncpy(dir, arch, baselen - 4);
     dir[baselen-4] = '\0';
     do {
-        char* path = (char*)malloc(strlen(dir) + 18);
+        char* path = (char*)malloc(strlen(dir) + 32);
         if (i > 0) {
-            sprintf(path, "%s/%u-%d.jpg", dir, entry->id, i);
+            sprintf(path, "%s/%llu-%d.jpg", dir, (unsigned long long)entry->id, i);
         } else {
-            sprintf(path, "%s/%u.jpg", dir, entry->id);
+            sprintf(path, "%s/%llu.jpg", dir, (unsigned long long)entry->id);
         }
         thumb_exists = !access(path, F_OK);
         if (thumb_exists) {
@@ -305,21 +238,15 @@ void cd_print_thumbnails(FILE* f, const char* arch, cd_file_entry* entry) {
     free(dir);
 }
 
-int cd_dump_image(const char* arch, cd_file_entry* entry, const char* to) {
+int cd_dump_image(cd_catalog* catalog, cd_file_entry* entry, const char* to) {
     int ret = EXIT_SUCCESS;
-    char* cdp = (char*)malloc(strlen(arch) + 1);
-    strncpy(cdp, arch, strlen(arch) - 4);
-    cdp[strlen(arch)-4] = '\0';
-    strcat(cdp, CD_PICTURE_EXT);
-    int fd = open(cdp, O_RDONLY);
-    free(cdp);
-    if (fd != -1) {
+    const void* data = cd_catalog_sidecar_entry(catalog, CD_PICTURE_EXT, entry->info, sizeof(cd_picture_entry));
+    if (data) {
         umask(066);
         FILE* f = fopen(to, "w");
         if (f) {
             cd_picture_entry image;
-            lseek(fd, entry->info, SEEK_SET);
-            read(fd, &image, sizeof(cd_picture_entry));
+            memcpy(&image, data, sizeof(cd_picture_entry));
             fprintf(f, "File:          %.*s\n", CD_NAME_MAX, entry->name);
             fprintf(f, "Dimensions:    %dx%d\n", image.width, image.height);
             fprintf(f, "Created:       ");
@@ -335,33 +262,26 @@ int cd_dump_image(const char* arch, cd_file_entry* entry, const char* to) {
                 fprintf(f, "%f %f", image.latitude, image.longitude);
             } else fprintf(f, "-");
             fprintf(f, "\n\n---\n\n");
-            cd_print_thumbnails(f, arch, entry);
+            cd_print_thumbnails(f, catalog->path, entry);
             fclose(f);
         } else {
             ret = EXIT_FAILURE;
         }
-        close(fd);
     } else {
          ret = EXIT_FAILURE;
     }
     return ret;
 }
 
-int cd_dump_video(const char* arch, cd_file_entry* entry, const char* to) {
+int cd_dump_video(cd_catalog* catalog, cd_file_entry* entry, const char* to) {
     int ret = EXIT_SUCCESS;
-    char* cdv = (char*)malloc(strlen(arch) + 1);
-    strncpy(cdv, arch, strlen(arch) - 4);
-    cdv[strlen(arch)-4] = '\0';
-    strcat(cdv, CD_VIDEO_EXT);
-    int fd = open(cdv, O_RDONLY);
-    free(cdv);
-    if (fd != -1) {
+    const void* data = cd_catalog_sidecar_entry(catalog, CD_VIDEO_EXT, entry->info, sizeof(cd_video_entry));
+    if (data) {
         umask(066);
         FILE* f = fopen(to, "w");
         if (f) {
             cd_video_entry ventry;
-            lseek(fd, entry->info, SEEK_SET);
-            read(fd, &ventry, sizeof(cd_video_entry));
+            memcpy(&ventry, data, sizeof(cd_video_entry));
             fprintf(f, "File:          %.*s\n", CD_NAME_MAX, entry->name);
             fprintf(f, "Title:         %.*s\n", 128, (*ventry.title) ? ventry.title : "-");
             fprintf(f, "Duration:      ");
@@ -396,18 +316,12 @@ int cd_dump_video(const char* arch, cd_file_entry* entry, const char* to) {
             if (ventry.astreams > 0) {
                 fprintf(f, "\n");
                 fprintf(f, "Audio:\n");
-                char* cdva = (char*)malloc(strlen(arch) + 2);
-                strncpy(cdva, arch, strlen(arch) - 4);
-                cdva[strlen(arch)-4] = '\0';
-                strcat(cdva, CD_ASTREAMS_EXT);
-                int afd = open(cdva, O_RDONLY);
-                free(cdva);
-                if (afd != -1) {
+                const char* streams = (const char*)cd_catalog_sidecar_entry(catalog, CD_ASTREAMS_EXT, ventry.audio, ventry.astreams * sizeof(cd_stream_entry));
+                if (streams) {
                     int i;
                     cd_stream_entry vaentry;
-                    lseek(afd, ventry.audio, SEEK_SET);
                     for (i = 0; i < ventry.astreams; i++) {
-                        read(afd, &vaentry, sizeof(cd_stream_entry));
+                        memcpy(&vaentry, streams + i * sizeof(cd_stream_entry), sizeof(cd_stream_entry));
                         fprintf(f, "  Stream #%d", i + 1);
                         if (vaentry.translation != TRANSLATION_UNKNOWN) fprintf(f, "(%s)", cd_get_translation(vaentry.translation));
                         fprintf(f, "\n");
@@ -419,18 +333,16 @@ int cd_dump_video(const char* arch, cd_file_entry* entry, const char* to) {
                         fprintf(f, "    Bitrate:   %u kbps\n", vaentry.bitrate);
                         fprintf(f, "    Samp.rate: %u Hz\n", vaentry.freq);
                     }
-                    close(afd);
                 } else {
                     ret = EXIT_FAILURE;
                 }
             }
             fprintf(f, "\n---\n\n");
-            cd_print_thumbnails(f, arch, entry);
+            cd_print_thumbnails(f, catalog->path, entry);
             fclose(f);
         } else {
             ret = EXIT_FAILURE;
         }
-        close(fd);
     } else {
          ret = EXIT_FAILURE;
     }
@@ -453,52 +365,39 @@ int cd_copyout(const char* arch, const char* file, const char* to) {
         regfree(regex);
         free(regex);
         if (result == 0) {
-            int base = open(arch, O_RDONLY);
-            if ((base != -1) && (cd_get_index_version(base) == CD_INDEX_VERSION)) {
+            cd_catalog* catalog = cd_catalog_open(arch);
+            if (!catalog) return EXIT_FAILURE;
+            if (!catalog->damaged && (catalog->names_fd != -1) && (cd_get_index_version(catalog) == CD_INDEX_VERSION) && cd_verify(catalog)) {
                 size_t length;
                 const char* next;
                 const char* element;
                 cd_file_entry entry;
-                cd_offset offset = sizeof(cd_iso_header);
+                cd_offset id = 1;
+                cd_offset dir = 0;
+                cd_offset count = 0;
+                cd_sorted* sorted = cd_sorted_open(catalog);
                 for (element = file; element;) {
                     next = strchr(element, '/');
                     length = (next) ? next - element : strlen(element);
-                    for (;;) {
-                        lseek(base, offset, SEEK_SET);
-                        read(base, (void*)&entry + sizeof(cd_offset), sizeof(cd_file_entry) - sizeof(cd_offset));
-                        if (!strncmp(element, entry.name, length) && !entry.name[length]) {
-                            if (next) {
-                                if (entry.type == CD_DIR) {
-                                    offset = sizeof(cd_iso_header) + (entry.child - 1) * (sizeof(cd_file_entry) - sizeof(cd_offset));
-                                } else {
-                                    close(base);
-                                    return EXIT_FAILURE;
-                                }
-                            } else {
-                                close(base);
-                                if ((entry.type == CD_REG) && entry.info) {
-                                    entry.id = (offset - sizeof(cd_iso_header)) / (sizeof(cd_file_entry) - sizeof(cd_offset)) + 1;
-                                    return dumper->dump(arch, &entry, to);
-                                } else {
-                                    return EXIT_FAILURE;
-                                }
-                            }
-                            break;
-                        } else if (entry.next) {
-                            offset = sizeof(cd_iso_header) + (entry.next - 1) * (sizeof(cd_file_entry) - sizeof(cd_offset));
-                        } else {
-                            close(base);
-                            return EXIT_FAILURE;
-                        }
+                    if (!cd_sorted_lookup(sorted, catalog, dir, id, count, element, length, &entry)) break;
+                    if (next) {
+                        if (entry.type != CD_DIR) break;
+                        id = entry.child;
+                        dir = entry.id;
+                        count = entry.count;
+                    } else {
+                        if (sorted) cd_sorted_close(sorted);
+                        // Sidecars are mapped through the catalog, so it is closed after
+                        int ret = ((entry.type == CD_REG) && entry.info) ? dumper->dump(catalog, &entry, to) : EXIT_FAILURE;
+                        cd_catalog_close(catalog);
+                        return ret;
                     }
-                    element = next;
-                    if (element) element++;
+                    element = next + 1;
                 }
-                close(base);
-            } else {
-                if (base != -1) close(base);
-                return EXIT_FAILURE;
+                if (sorted) cd_sorted_close(sorted);
             }
+            cd_catalog_close(catalog);
+            return EXIT_FAILURE;
         }
     }
     return EXIT_FAILURE;
@@ -506,21 +405,20 @@ int cd_copyout(const char* arch, const char* file, const char* to) {
 
 int cd_info(const char* file) {
     int ret = EXIT_SUCCESS;
-    int base = open(file, O_RDONLY);
-    if (base != -1) {
-        cd_byte cdiver = cd_get_index_version(base);
-        if (cdiver == CD_INDEX_VERSION) {
+    cd_catalog* catalog = cd_catalog_open(file);
+    if (catalog) {
+        cd_byte cdiver = cd_get_index_version(catalog);
+        if (catalog->damaged) {
+            fprintf(stderr, "Block 0 of CD index is damaged -- use cdverify to check it!\n");
+            ret = EXIT_FAILURE;
+        } else if (cdiver == CD_INDEX_VERSION) {
             time_t time;
-            struct stat stat;
-            cd_iso_header header;
-            fstat(base, &stat);
-            lseek(base, 0, SEEK_SET);
-            read(base, (void*)&header, sizeof(cd_iso_header));
+            cd_iso_header header = catalog->header;
             printf("File:          %s\n", file);
             printf("Volume ID:     %.*s\n", 32, (*header.volume_id) ? header.volume_id : "-");
             printf("Bootable:      %s\n", (header.bootable) ? "yes" : "no");
             printf("Size:          %lu\n", header.size);
-            printf("Files:         %lu\n", (stat.st_size - sizeof(cd_iso_header)) / (sizeof(cd_file_entry) - sizeof(cd_offset)));
+            printf("Files:         %lu\n", catalog->records);
             printf("Created:       ");
             if (header.ctime) {
                 time = header.ctime;
@@ -546,7 +444,7 @@ int cd_info(const char* file) {
             }
             ret = EXIT_FAILURE;
         }
-        close(base);
+        cd_catalog_close(catalog);
     } else {
         ret = EXIT_FAILURE;
     }
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cdindex.h"
+#include "cache.h"
+
+cd_cache* cd_cache_open(const char* dir) {
+    struct stat64 st;
+    if ((mkdir(dir, S_IRWXU|S_IRWXG|S_IROTH|S_IXOTH) == -1) &&
+        ((errno != EEXIST) || (stat64(dir, &st) == -1) || !S_ISDIR(st.st_mode))) {
+        CD_LOG(CD_LOG_WARNING, "[warning] failed to create cache directory %s\n", dir);
+        return NULL;
+    }
+    cd_cache* cache = (cd_cache*)malloc(sizeof(cd_cache));
+    cache->dir = strdup(dir);
+    return cache;
+}
+
+void cd_cache_close(cd_cache* cache) {
+    free((void*)cache->dir);
+    free(cache);
+}
+
+static inline uint64_t cd_cache_hash(uint64_t hash, const unsigned char* data, ssize_t length) {
+    ssize_t i;
+    for (i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+int cd_cache_key(const char* file, cd_size size, char* key) {
+    ssize_t bytes;
+    off_t offset;
+    unsigned char* buf;
+    uint64_t hash = 14695981039346656037ull;
+    // Entries hold records in the catalog layout, so keys change with its version
+    cd_byte version = CD_INDEX_VERSION;
+    int fd = open(file, O_RDONLY);
+    if (fd == -1) return 0;
+    hash = cd_cache_hash(hash, &version, sizeof(cd_byte));
+    // Files are identified by size and their both ends, without reading them whole
+    buf = (unsigned char*)malloc(CD_CACHE_BLOCK);
+    bytes = pread(fd, buf, CD_CACHE_BLOCK, 0);
+    if (bytes > 0) hash = cd_cache_hash(hash, buf, bytes);
+    if ((bytes != -1) && (size > CD_CACHE_BLOCK)) {
+        offset = (size > 2 * CD_CACHE_BLOCK) ? size - CD_CACHE_BLOCK : CD_CACHE_BLOCK;
+        bytes = pread(fd, buf, size - offset, offset);
+        if (bytes > 0) hash = cd_cache_hash(hash, buf, bytes);
+    }
+    free(buf);
+    close(fd);
+    if (bytes == -1) return 0;
+    sprintf(key, "%016llx%016llx", (unsigned long long)size, (unsigned long long)hash);
+    return 1;
+}
+
+char* cd_cache_path(cd_cache* cache, const char* key, const char* suffix) {
+    char* path = (char*)malloc(strlen(cache->dir) + CD_CACHE_KEY_LEN + strlen(suffix) + 2);
+    sprintf(path, "%s/%s%s", cache->dir, key, suffix);
+    return path;
+}
+
+int cd_cache_get(cd_cache* cache, const char* key, const char* suffix) {
+    char* path = cd_cache_path(cache, key, suffix);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    return fd;
+}
+
+int cd_cache_create(cd_cache* cache, char** tpath) {
+    *tpath = (char*)malloc(strlen(cache->dir) + 16);
+    sprintf(*tpath, "%s/.cdindex.XXXXXX", cache->dir);
+    int fd = mkstemp(*tpath);
+    if (fd == -1) {
+        CD_LOG(CD_LOG_WARNING, "[warning] failed to create temporary file in %s\n", cache->dir);
+        free(*tpath);
+        *tpath = NULL;
+    }
+    return fd;
+}
+
+void cd_cache_put(cd_cache* cache, int fd, char* tpath, const char* key, const char* suffix) {
+    char* path = cd_cache_path(cache, key, suffix);
+    fchmod(fd, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    close(fd);
+    // Entries appear complete, even when several indexers share the cache
+    if (rename(tpath, path) == -1) unlink(tpath);
+    free(path);
+    free(tpath);
+}
+
+int cd_cache_link(const char* from, const char* to) {
+    char buf[8192];
+    ssize_t bytes;
+    unlink(to);
+    if (link(from, to) == 0) return 1;
+    if (errno != EXDEV) return 0;
+    int ifd = open(from, O_RDONLY);
+    if (ifd == -1) return 0;
+    int ofd = open(to, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if (ofd == -1) {
+        close(ifd);
+        return 0;
+    }
+    while ((bytes = read(ifd, buf, sizeof(buf))) > 0) {
+        if (write(ofd, buf, bytes) != bytes) {
+            bytes = -1;
+            break;
+        }
+    }
+    close(ofd);
+    close(ifd);
+    if (bytes == -1) unlink(to);
+    return (bytes == 0);
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_CACHE_H_
+#define _CD_CACHE_H_
+
+#include "data.h"
+
+#define CD_CACHE_BLOCK      65536   // Bytes hashed at the head and at the tail
+#define CD_CACHE_KEY_LEN    32      // Hex size and hash
+
+typedef struct {
+    const char* dir;
+} cd_cache;
+
+cd_cache* cd_cache_open(const char* dir);
+
+void cd_cache_close(cd_cache* cache);
+
+int cd_cache_key(const char* file, cd_size size, char* key);
+
+char* cd_cache_path(cd_cache* cache, const char* key, const char* suffix);
+
+int cd_cache_get(cd_cache* cache, const char* key, const char* suffix);
+
+int cd_cache_create(cd_cache* cache, char** tpath);
+
+void cd_cache_put(cd_cache* cache, int fd, char* tpath, const char* key, const char* suffix);
+
+int cd_cache_link(const char* from, const char* to);
+
+#endif /* _CD_CACHE_H_ */
@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "catalog.h"
+
+static const char* cd_catalog_mmap(int fd, size_t length) {
+    if (!length) return NULL;
+    void* map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    return (map == MAP_FAILED) ? NULL : (const char*)map;
+}
+
+cd_catalog* cd_catalog_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+    int compressed = cd_block_open(fd);
+    cd_catalog* catalog = (cd_catalog*)calloc(1, sizeof(cd_catalog));
+    catalog->path = strdup(path);
+    catalog->fd = fd;
+    catalog->names_fd = -1;
+    if (compressed == -1) {
+        // Damaged compressed index cannot be read at all, so it is left empty
+        catalog->damaged = 1;
+        return catalog;
+    }
+    catalog->length = cd_block_size(fd);
+    // Otherwise blocks are read with pread(), like for the compressed one
+    if (!compressed) catalog->map = cd_catalog_mmap(fd, catalog->length);
+    size_t size = (catalog->length < sizeof(cd_iso_header)) ? catalog->length : sizeof(cd_iso_header);
+    const void* header = cd_catalog_data(catalog, 0, size, &catalog->header);
+    if (header && (header != &catalog->header)) memcpy(&catalog->header, header, size);
+    // Records of previous versions are read by offsets, they have no names heap or another one
+    if (!header || (size != sizeof(cd_iso_header)) || (catalog->header.mark.version != CD_INDEX_VERSION) ||
+        memcmp(catalog->header.mark.mark, CD_INDEX_MARK, CD_INDEX_MARK_LEN)) return catalog;
+    catalog->records = (catalog->length - sizeof(cd_iso_header)) / CD_RECORD_SIZE;
+    char* names_path = cd_catalog_sidecar(catalog, CD_NAMES_EXT);
+    catalog->names_fd = open(names_path, O_RDONLY);
+    free(names_path);
+    if (catalog->names_fd != -1) {
+        compressed = cd_block_open(catalog->names_fd);
+        if (compressed == -1) {
+            close(catalog->names_fd);
+            catalog->names_fd = -1;
+        } else {
+            catalog->names_length = cd_block_size(catalog->names_fd);
+            if (!compressed) catalog->names = cd_catalog_mmap(catalog->names_fd, catalog->names_length);
+        }
+    }
+    return catalog;
+}
+
+static void cd_catalog_check_free(cd_catalog_check* check) {
+    free(check->index.checked);
+    free(check->names.checked);
+    free(check->buffer);
+    cd_catalog_unmap(check->map, check->length);
+    free(check);
+}
+
+void cd_catalog_close(cd_catalog* catalog) {
+    cd_catalog_mapped* sidecar;
+    while ((sidecar = catalog->sidecars)) {
+        catalog->sidecars = sidecar->next;
+        if (sidecar->map) cd_catalog_unmap(sidecar->map, sidecar->length);
+        free(sidecar->ext);
+        free(sidecar);
+    }
+    if (catalog->check) cd_catalog_check_free(catalog->check);
+    if (catalog->names) munmap((void*)catalog->names, catalog->names_length);
+    if (catalog->map) munmap((void*)catalog->map, catalog->length);
+    if (catalog->names_fd != -1) {
+        cd_block_close(catalog->names_fd);
+        close(catalog->names_fd);
+    }
+    cd_block_close(catalog->fd);
+    close(catalog->fd);
+    free(catalog->path);
+    free(catalog);
+}
+
+char* cd_catalog_sidecar(cd_catalog* catalog, const char* ext) {
+    size_t length = strlen(catalog->path);
+    size_t ext_length = strlen(ext);
+    // Index names which are too short keep their extension
+    size_t base = (length > ext_length) ? length - ext_length : length;
+    char* path = (char*)malloc(base + ext_length + 1);
+    memcpy(path, catalog->path, base);
+    strcpy(path + base, ext);
+    return path;
+}
+
+// Sidecars are checked whole, they are mapped once
+static int cd_catalog_check_map(cd_catalog* catalog, const char* ext, const char* map, size_t length) {
+    cd_offset i;
+    const cd_check_file* file = cd_check_find(catalog->check->map, ext);
+    // Written later than checksums
+    if (!file) return 0;
+    const cd_dword* sums = cd_check_sums(catalog->check->map, (const cd_check_header*)catalog->check->map) + file->first;
+    if (file->size != length) {
+        catalog->damaged = 1;
+        return 0;
+    }
+    for (i = 0; i < CD_CHECK_BLOCKS(length, catalog->check->block); i++) {
+        size_t offset = i * catalog->check->block;
+        size_t size = (length - offset < catalog->check->block) ? length - offset : catalog->check->block;
+        if (cd_crc32c(0, map + offset, size) != sums[i]) {
+            catalog->damaged = 1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+const char* cd_catalog_map(cd_catalog* catalog, const char* ext, size_t* length) {
+    struct stat st;
+    const char* map = NULL;
+    char* path = cd_catalog_sidecar(catalog, ext);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd == -1) return NULL;
+    if (!fstat(fd, &st)) {
+        *length = st.st_size;
+        map = cd_catalog_mmap(fd, *length);
+    }
+    close(fd);
+    if (map && catalog->check && !cd_catalog_check_map(catalog, ext, map, *length)) {
+        cd_catalog_unmap(map, *length);
+        return NULL;
+    }
+    return map;
+}
+
+void cd_catalog_unmap(const char* map, size_t length) {
+    munmap((void*)map, length);
+}
+
+const void* cd_catalog_sidecar_entry(cd_catalog* catalog, const char* ext, cd_offset offset, size_t size) {
+    cd_catalog_mapped* sidecar;
+    for (sidecar = catalog->sidecars; sidecar && strcmp(sidecar->ext, ext); sidecar = sidecar->next);
+    if (!sidecar) {
+        // Missing and damaged sidecars are remembered too, so they are not mapped again
+        sidecar = (cd_catalog_mapped*)calloc(1, sizeof(cd_catalog_mapped));
+        sidecar->ext = strdup(ext);
+        sidecar->map = cd_catalog_map(catalog, ext, &sidecar->length);
+        sidecar->next = catalog->sidecars;
+        catalog->sidecars = sidecar;
+    }
+    if (!sidecar->map || (offset > sidecar->length) || (size > sidecar->length - offset)) return NULL;
+    return sidecar->map + offset;
+}
+
+static int cd_catalog_sums_init(cd_catalog_check* check, cd_catalog_sums* sums, const char* ext, size_t length) {
+    const cd_check_file* file = cd_check_find(check->map, ext);
+    if (!file || (file->size != length)) return 0;
+    sums->sums = cd_check_sums(check->map, (const cd_check_header*)check->map) + file->first;
+    sums->checked = (uint8_t*)calloc(CD_CHECK_BLOCKS(length, check->block) / 8 + 1, 1);
+    return 1;
+}
+
+int cd_catalog_verify(cd_catalog* catalog) {
+    size_t length;
+    if (catalog->check) return 1;
+    const char* map = cd_catalog_map(catalog, CD_CHECK_EXT, &length);
+    if (!map) return 0;
+    cd_catalog_check* check = (cd_catalog_check*)calloc(1, sizeof(cd_catalog_check));
+    check->map = map;
+    check->length = length;
+    if (!cd_check_valid(map, length)) {
+        cd_catalog_check_free(check);
+        return -1;
+    }
+    check->block = ((const cd_check_header*)map)->block;
+    if (!cd_catalog_sums_init(check, &check->index, CD_CHECK_INDEX_EXT, catalog->length) ||
+        ((catalog->names_fd != -1) && !cd_catalog_sums_init(check, &check->names, CD_NAMES_EXT, catalog->names_length))) {
+        cd_catalog_check_free(check);
+        return -1;
+    }
+    catalog->check = check;
+    return 1;
+}
+
+int cd_catalog_check_block(cd_catalog* catalog, cd_catalog_sums* sums, cd_offset block) {
+    cd_catalog_check* check = catalog->check;
+    int index = (sums == &check->index);
+    const char* data = (index) ? catalog->map : catalog->names;
+    size_t length = (index) ? catalog->length : catalog->names_length;
+    size_t offset = block * check->block;
+    size_t size = (length - offset < check->block) ? length - offset : check->block;
+    if (data) {
+        data += offset;
+    } else {
+        // Compressed blocks are of the same size, so this one gets cached for the read
+        if (!check->buffer) check->buffer = (char*)malloc(check->block);
+        if (cd_block_pread((index) ? catalog->fd : catalog->names_fd, check->buffer, size, offset) == (ssize_t)size) data = check->buffer;
+    }
+    if (!data || (cd_crc32c(0, data, size) != sums->sums[block])) {
+        catalog->damaged = 1;
+        return 0;
+    }
+    sums->checked[block >> 3] |= 1 << (block & 7);
+    return 1;
+}
+
+int cd_catalog_lookup(cd_catalog* catalog, cd_offset first, cd_offset count, const char* name, size_t length, cd_file_entry* entry) {
+    cd_catalog_iter iter;
+    const cd_record* record;
+    char buffer[CD_NAME_MAX];
+    if (length > CD_NAME_MAX) length = CD_NAME_MAX;
+    for (cd_catalog_children(catalog, first, count, &iter); (record = cd_catalog_next(catalog, &iter));) {
+        if (record->length != length) continue;
+        const char* file = cd_catalog_name(catalog, record, buffer);
+        if (file && !memcmp(file, name, length)) return cd_catalog_unpack(catalog, record, iter.id, entry);
+    }
+    return 0;
+}
+
+char* cd_catalog_path(cd_catalog* catalog, cd_offset id) {
+    cd_offset i, depth;
+    cd_record buffer;
+    const cd_record* record;
+    char name[CD_NAME_MAX];
+    size_t length = 0;
+    // Lengths first, parents of a broken index could loop
+    for (i = id, depth = 0; i; i = record->parent, depth++) {
+        if (depth == catalog->records) catalog->damaged = 1;
+        if ((depth == catalog->records) || !(record = cd_catalog_record(catalog, i, &buffer))) return NULL;
+        length += record->length + 1;
+    }
+    char* path = (char*)malloc((length) ? length : 1);
+    path[(length) ? --length : 0] = '\0';
+    for (i = id; i; i = record->parent) {
+        record = cd_catalog_record(catalog, i, &buffer);
+        const char* file = (record) ? cd_catalog_name(catalog, record, name) : NULL;
+        if (!file) {
+            free(path);
+            return NULL;
+        }
+        length -= record->length;
+        memcpy(path + length, file, record->length);
+        if (length) path[--length] = '/';
+    }
+    return path;
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_CATALOG_H_
+#define _CD_CATALOG_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "data.h"
+#include "record.h"
+#include "block.h"
+#include "check.h"
+
+// Checksums of the index or of its names, and blocks found intact so far
+typedef struct {
+    const cd_dword* sums;
+    uint8_t* checked;       // Bit per block
+} cd_catalog_sums;
+
+typedef struct {
+    const char* map;        // Checksums file
+    size_t length;
+    cd_dword block;
+    cd_catalog_sums index;
+    cd_catalog_sums names;
+    char* buffer;           // Block of compressed file being checked
+} cd_catalog_check;
+
+// Sidecar mapped while the catalog is open
+typedef struct __cd_catalog_mapped cd_catalog_mapped;
+struct __cd_catalog_mapped {
+    char* ext;
+    const char* map;        // NULL if there is none, it is empty or damaged
+    size_t length;
+    cd_catalog_mapped* next;
+};
+
+// Index opened for reading with its names heap, both are mapped unless
+// they are compressed, then they are read through blocks
+typedef struct {
+    char* path;             // Of the index, sidecars are named after it
+    int fd;
+    int names_fd;           // Names heap or -1 if there is none or the index is not of the current version
+    const char* map;        // Index or NULL if it is read through blocks
+    size_t length;          // Of uncompressed index
+    const char* names;      // Names heap or NULL if it is read through blocks
+    size_t names_length;
+    cd_iso_header header;   // Zeroed if the index is shorter
+    cd_offset records;      // Number of records, 0 if the index is not of the current version
+    cd_catalog_check* check;    // Checksums, if blocks are verified as they are read, or NULL
+    int damaged;            // Some block did not match its checksum or links of files looped
+    cd_catalog_mapped* sidecars;    // Mapped by cd_catalog_sidecar_entry()
+} cd_catalog;
+
+#define CD_CATALOG_RUN 64   // Records of a packed directory read through blocks at once
+
+typedef struct {
+    cd_offset id;           // Of the file returned last
+    cd_offset next;         // Of the file to return, 0 after the last one
+    cd_offset left;         // Files which can follow, links of a damaged index could loop
+    cd_offset last;         // After the last file of a packed directory, or 0 if files are linked by next
+    cd_offset run;          // First record in buffer, 0 if there are none
+    cd_offset size;         // Records in buffer
+    cd_record buffer[CD_CATALOG_RUN];   // Records of the index read through blocks
+} cd_catalog_iter;
+
+// Opens the index and its names heap, returns NULL if the index cannot be opened;
+// the catalog is damaged if the first block of the index cannot be read
+cd_catalog* cd_catalog_open(const char* path);
+
+void cd_catalog_close(cd_catalog* catalog);
+
+// Path of the sidecar with the extension, which replaces the one of the index
+char* cd_catalog_sidecar(cd_catalog* catalog, const char* ext);
+
+// Maps the whole sidecar, returns NULL if there is none or it is empty
+const char* cd_catalog_map(cd_catalog* catalog, const char* ext, size_t* length);
+
+void cd_catalog_unmap(const char* map, size_t length);
+
+// Bytes of the sidecar at the offset, which is mapped on first use until the
+// catalog is closed, or NULL if there are not so many
+const void* cd_catalog_sidecar_entry(cd_catalog* catalog, const char* ext, cd_offset offset, size_t size);
+
+// Verifies each block of the index and names when it is read first, and
+// sidecars when they are mapped; returns 0 if there are no checksums and
+// -1 if they are damaged or do not match the files
+int cd_catalog_verify(cd_catalog* catalog);
+
+// Checks the block, marks the catalog damaged if it does not match
+int cd_catalog_check_block(cd_catalog* catalog, cd_catalog_sums* sums, cd_offset block);
+
+static inline int cd_catalog_checked(cd_catalog* catalog, cd_catalog_sums* sums, off_t offset, size_t size) {
+    cd_offset block, last;
+    if (!size) return 1;
+    for (block = offset / catalog->check->block, last = (offset + size - 1) / catalog->check->block; block <= last; block++) {
+        if (!(sums->checked[block >> 3] & (1 << (block & 7))) && !cd_catalog_check_block(catalog, sums, block)) return 0;
+    }
+    return 1;
+}
+
+// Bytes of the index at the offset, in the map or read into buf, or NULL if there are not so many
+static inline const void* cd_catalog_data(cd_catalog* catalog, off_t offset, size_t size, void* buf) {
+    if ((offset < 0) || ((size_t)offset > catalog->length) || (size > catalog->length - offset)) return NULL;
+    if (catalog->check && !cd_catalog_checked(catalog, &catalog->check->index, offset, size)) return NULL;
+    if (catalog->map) return catalog->map + offset;
+    if (cd_block_pread(catalog->fd, buf, size, offset) == (ssize_t)size) return buf;
+    // Block which cannot be uncompressed, or the file was truncated
+    catalog->damaged = 1;
+    return NULL;
+}
+
+// Record by its ID, in the map or read into record, or NULL if there is no such
+static inline const cd_record* cd_catalog_record(cd_catalog* catalog, cd_offset id, cd_record* record) {
+    if (!id || (id > catalog->records)) return NULL;
+    return (const cd_record*)cd_catalog_data(catalog, CD_RECORD_OFFSET(id), CD_RECORD_SIZE, record);
+}
+
+// Name of the record, which is not terminated, in the map or read into name of CD_NAME_MAX bytes
+static inline const char* cd_catalog_name(cd_catalog* catalog, const cd_record* record, char* name) {
+    if ((catalog->names_fd == -1) || (record->name > catalog->names_length) ||
+        (record->length > catalog->names_length - record->name)) return NULL;
+    if (catalog->check && !cd_catalog_checked(catalog, &catalog->check->names, record->name, record->length)) return NULL;
+    if (catalog->names) return catalog->names + record->name;
+    if (!record->length) return name;
+    if (cd_block_pread(catalog->names_fd, name, record->length, record->name) == record->length) return name;
+    catalog->damaged = 1;
+    return NULL;
+}
+
+// Entry of the record, with the name only terminated, not padded
+static inline int cd_catalog_unpack(cd_catalog* catalog, const cd_record* record, cd_offset id, cd_file_entry* entry) {
+    const char* name = cd_catalog_name(catalog, record, entry->name);
+    if (!name) return 0;
+    cd_record_unpack(record, id, entry);
+    if (name != entry->name) memcpy(entry->name, name, record->length);
+    if (record->length < CD_NAME_MAX) entry->name[record->length] = '\0';
+    return 1;
+}
+
+// Same as cd_record_read(), but the name is only terminated, not padded
+static inline int cd_catalog_entry(cd_catalog* catalog, cd_offset id, cd_file_entry* entry) {
+    cd_record buffer;
+    const cd_record* record = cd_catalog_record(catalog, id, &buffer);
+    return (record) ? cd_catalog_unpack(catalog, record, id, entry) : 0;
+}
+
+// Files of the directory are returned by cd_catalog_next() from the first one; count
+// is the one of the directory, packed files are read one after another instead of by next
+static inline void cd_catalog_children(cd_catalog* catalog, cd_offset first, cd_offset count, cd_catalog_iter* iter) {
+    iter->id = 0;
+    iter->next = first;
+    iter->left = catalog->records;
+    iter->last = (first && count && (first <= catalog->records) && (count <= catalog->records - first + 1)) ? first + count : 0;
+    iter->run = 0;
+    iter->size = 0;
+}
+
+// Record of a packed directory, files read through blocks are buffered by runs
+static inline const cd_record* cd_catalog_packed(cd_catalog* catalog, cd_catalog_iter* iter) {
+    if (catalog->map) return cd_catalog_record(catalog, iter->next, iter->buffer);
+    if (!iter->run || (iter->next - iter->run >= iter->size)) {
+        iter->size = (iter->last - iter->next > CD_CATALOG_RUN) ? CD_CATALOG_RUN : iter->last - iter->next;
+        if (!cd_catalog_data(catalog, CD_RECORD_OFFSET(iter->next), iter->size * CD_RECORD_SIZE, iter->buffer)) {
+            iter->run = 0;
+            return NULL;
+        }
+        iter->run = iter->next;
+    }
+    return &iter->buffer[iter->next - iter->run];
+}
+
+static inline const cd_record* cd_catalog_next(cd_catalog* catalog, cd_catalog_iter* iter) {
+    const cd_record* record;
+    if (iter->last) {
+        if (!iter->next) return NULL;
+        if (!(record = cd_catalog_packed(catalog, iter))) return NULL;
+        iter->id = iter->next;
+        iter->next = (iter->next + 1 < iter->last) ? iter->next + 1 : 0;
+        return record;
+    }
+    if (!iter->left) {
+        // More files than records, so they loop
+        if (iter->next) catalog->damaged = 1;
+        return NULL;
+    }
+    if (!(record = cd_catalog_record(catalog, iter->next, iter->buffer))) return NULL;
+    iter->id = iter->next;
+    iter->next = record->next;
+    iter->left--;
+    return record;
+}
+
+// Finds the file among count files of the directory from first, or linked from it by next if count is 0
+int cd_catalog_lookup(cd_catalog* catalog, cd_offset first, cd_offset count, const char* name, size_t length, cd_file_entry* entry);
+
+// Path of the record built from names of its parents, to be freed, or NULL if they cannot be read
+char* cd_catalog_path(cd_catalog* catalog, cd_offset id);
+
+#endif /* _CD_CATALOG_H_ */
@@ -19,6 +19,16 @@
 #define DEBUG_OUTPUT(FORMAT, ARGS ...)
 #endif
 
+#define CD_LOG_ERROR    0
+#define CD_LOG_WARNING  1
+#define CD_LOG_INFO     2       // Stages and totals
+#define CD_LOG_FILE     3       // Every directory, file and archive
+
+extern int cd_log_level;
+
+#define CD_LOG(LEVEL, FORMAT, ARGS ...) \
+    do { if ((LEVEL) <= cd_log_level) printf(FORMAT, ## ARGS); } while (0)
+
 #define __DEBUG(STRING) \
     printf(STRING)
 #define _DEBUG(FORMAT, ARGS ...) \
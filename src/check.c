@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cdindex.h"
+#include "check.h"
+#include "record.h"
+#include "sorted.h"
+#include "columns.h"
+#include "base.h"
+#include "audio.h"
+#include "video.h"
+
+// Files of the catalog which are checked, if they exist, the index first
+static const char* cd_check_exts[] = {
+    CD_CHECK_INDEX_EXT, CD_NAMES_EXT, CD_SLINKS_EXT, CD_SORTED_EXT, CD_COLUMNS_EXT,
+    CD_PICTURE_EXT, CD_MUSIC_EXT, CD_VIDEO_EXT, CD_ASTREAMS_EXT, NULL
+};
+
+static char* cd_check_sidecar(const char* base_name, const char* ext) {
+    size_t length = strlen(base_name) - 4;
+    char* path = (char*)malloc(length + strlen(ext) + 1);
+    memcpy(path, base_name, length);
+    strcpy(path + length, ext);
+    return path;
+}
+
+// Appends checksums of the file, returns -1 if it cannot be read
+static int cd_check_file_sums(const char* path, cd_check_file* file, cd_dword** sums, cd_offset* count, char* buf) {
+    ssize_t bytes;
+    off_t offset;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return 0;
+    // Uncompressed data is checked, so that cdindex -z keeps checksums valid
+    if (cd_block_open(fd) == -1) {
+        close(fd);
+        return -1;
+    }
+    file->size = cd_block_size(fd);
+    file->first = *count;
+    *sums = (cd_dword*)realloc(*sums, (*count + CD_CHECK_BLOCKS(file->size, CD_CHECK_BLOCK)) * sizeof(cd_dword));
+    for (offset = 0; offset < (off_t)file->size; offset += bytes) {
+        bytes = cd_block_pread(fd, buf, CD_CHECK_BLOCK, offset);
+        if (bytes <= 0) break;
+        (*sums)[(*count)++] = cd_crc32c(0, buf, bytes);
+    }
+    cd_block_close(fd);
+    close(fd);
+    return (offset == (off_t)file->size) ? 1 : -1;
+}
+
+int cd_check_build(const char* base_name) {
+    int i, found;
+    cd_dword sum;
+    cd_check_header header;
+    cd_check_file files[sizeof(cd_check_exts) / sizeof(cd_check_exts[0])];
+    cd_dword* sums = NULL;
+    cd_offset count = 0;
+    int result = 1;
+    char* check_name = cd_check_sidecar(base_name, CD_CHECK_EXT);
+    char* buf = (char*)malloc(CD_CHECK_BLOCK);
+    memcpy(&header.mark.mark, CD_CHECK_MARK, CD_INDEX_MARK_LEN);
+    header.mark.version = CD_CHECK_VERSION;
+    header.block = CD_CHECK_BLOCK;
+    header.files = 0;
+    for (i = 0; result && cd_check_exts[i]; i++) {
+        char* path = cd_check_sidecar(base_name, cd_check_exts[i]);
+        memset(&files[header.files], '\0', sizeof(cd_check_file));
+        strncpy(files[header.files].ext, cd_check_exts[i], CD_CHECK_EXT_LEN);
+        found = cd_check_file_sums(path, &files[header.files], &sums, &count, buf);
+        if (found == -1) CD_LOG(CD_LOG_ERROR, "[error] failed to read for checksums: \"%s\"\n", path);
+        else if (found) header.files++;
+        // The index itself must be there
+        if ((found == -1) || (!i && !found)) result = 0;
+        free(path);
+    }
+    FILE* file = (result) ? fopen(check_name, "w") : NULL;
+    if (file) {
+        sum = cd_crc32c(0, &header, sizeof(cd_check_header));
+        sum = cd_crc32c(sum, files, header.files * sizeof(cd_check_file));
+        sum = cd_crc32c(sum, sums, count * sizeof(cd_dword));
+        result = (fwrite(&header, sizeof(cd_check_header), 1, file) == 1) &&
+                 (fwrite(files, sizeof(cd_check_file), header.files, file) == header.files) &&
+                 (fwrite(sums, sizeof(cd_dword), count, file) == count) &&
+                 (fwrite(&sum, sizeof(cd_dword), 1, file) == 1);
+        if (fclose(file)) result = 0;
+    } else {
+        result = 0;
+    }
+    if (result) {
+        CD_LOG(CD_LOG_INFO, "[check] checksummed %u files in %llu blocks\n", header.files, (unsigned long long)count);
+    } else {
+        CD_LOG(CD_LOG_ERROR, "[error] failed to write checksums: \"%s\"\n", check_name);
+        unlink(check_name);
+    }
+    free(sums);
+    free(buf);
+    free(check_name);
+    return result;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_CHECK_H_
+#define _CD_CHECK_H_
+
+#include <sys/types.h>
+#include <string.h>
+
+#include "data.h"
+#include "block.h"
+#include "crc.h"
+
+#define CD_CHECK_EXT        ".cdk"
+#define CD_CHECK_MARK       "CDK"
+#define CD_CHECK_VERSION    0x01
+#define CD_CHECK_BLOCK      CD_BLOCK_SIZE   // Same as of compressed files, so their blocks are checked whole
+#define CD_CHECK_EXT_LEN    8
+#define CD_CHECK_INDEX_EXT  ".cdi"  // Of the index itself
+
+// Followed by cd_check_file for each file of the catalog, by CRC-32C of
+// their blocks of uncompressed data, file after file, and by CRC-32C of
+// everything before it
+typedef struct {
+    cd_index_mark mark;
+    cd_dword block;         // Size of checked blocks
+    cd_dword files;
+} packed(cd_check_header);
+
+typedef struct {
+    char ext[CD_CHECK_EXT_LEN]; // Replaces the extension of the index, padded with zeros
+    cd_offset size;         // Of uncompressed data
+    cd_offset first;        // Number of its first checksum
+} packed(cd_check_file);
+
+#define CD_CHECK_BLOCKS(SIZE, BLOCK) \
+    ((SIZE) / (BLOCK) + ((SIZE) % (BLOCK) != 0))
+
+static inline const cd_dword* cd_check_sums(const char* map, const cd_check_header* header) {
+    return (const cd_dword*)(map + sizeof(cd_check_header) + header->files * sizeof(cd_check_file));
+}
+
+// True if the mapped checksums are complete and intact
+static inline int cd_check_valid(const char* map, size_t length) {
+    cd_dword i, sum;
+    cd_offset blocks, sums = 0;
+    const cd_check_header* header = (const cd_check_header*)map;
+    if ((length < sizeof(cd_check_header) + sizeof(cd_dword)) ||
+        memcmp(&header->mark.mark, CD_CHECK_MARK, CD_INDEX_MARK_LEN) || (header->mark.version != CD_CHECK_VERSION) ||
+        !header->block || (header->files > (length - sizeof(cd_check_header)) / sizeof(cd_check_file))) return 0;
+    const cd_check_file* files = (const cd_check_file*)(map + sizeof(cd_check_header));
+    size_t left = (length - sizeof(cd_check_header) - header->files * sizeof(cd_check_file)) / sizeof(cd_dword);
+    for (i = 0; i < header->files; i++) {
+        blocks = CD_CHECK_BLOCKS(files[i].size, header->block);
+        if ((files[i].first != sums) || (blocks >= left - sums)) return 0;
+        sums += blocks;
+    }
+    if ((const char*)(cd_check_sums(map, header) + sums + 1) != map + length) return 0;
+    memcpy(&sum, map + length - sizeof(cd_dword), sizeof(cd_dword));
+    return (cd_crc32c(0, map, length - sizeof(cd_dword)) == sum);
+}
+
+// Checksums of the file with the extension, or NULL if it was not checked
+static inline const cd_check_file* cd_check_find(const char* map, const char* ext) {
+    cd_dword i;
+    const cd_check_header* header = (const cd_check_header*)map;
+    const cd_check_file* files = (const cd_check_file*)(map + sizeof(cd_check_header));
+    for (i = 0; i < header->files; i++) {
+        if (!strncmp(files[i].ext, ext, CD_CHECK_EXT_LEN)) return &files[i];
+    }
+    return NULL;
+}
+
+// Writes checksums of the index and of its sidecars, which must be complete
+int cd_check_build(const char* base_name);
+
+#endif /* _CD_CHECK_H_ */
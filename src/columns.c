@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cdindex.h"
+#include "columns.h"
+
+// Writes values of the chunk into their places in the column and moves to the next column
+static int cd_columns_write(int fd, const void* values, size_t width, off_t* column, cd_offset first, cd_offset count, cd_offset records) {
+    ssize_t length = count * width;
+    int result = (pwrite(fd, values, length, *column + (off_t)first * width) == length);
+    *column += (off_t)records * width;
+    return result;
+}
+
+int cd_columns_build(const char* base_name, const char* heap_name) {
+    struct stat base_stat, names_stat;
+    cd_columns_header header;
+    cd_offset i, first, chunk;
+    int result = 0;
+    int fd = open(base_name, O_RDONLY);
+    int names_fd = open(heap_name, O_RDONLY);
+    char* columns_name = strdup(base_name);
+    columns_name[strlen(base_name)-1] = 'c';
+    int cfd = open(columns_name, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if ((fd != -1) && (names_fd != -1) && (cfd != -1) && !fstat(fd, &base_stat) && !fstat(names_fd, &names_stat)) {
+        memcpy(&header.mark.mark, CD_COLUMNS_MARK, CD_INDEX_MARK_LEN);
+        header.mark.version = CD_COLUMNS_VERSION;
+        header.columns = CD_COLUMNS_COUNT;
+        header.records = (base_stat.st_size - sizeof(cd_iso_header)) / CD_RECORD_SIZE;
+        header.names = names_stat.st_size;
+        cd_record* records = (cd_record*)malloc(CD_COLUMNS_BUFFER * CD_RECORD_SIZE);
+        cd_offset* offsets = (cd_offset*)malloc(CD_COLUMNS_BUFFER * sizeof(cd_offset));
+        cd_time* times = (cd_time*)malloc(CD_COLUMNS_BUFFER * sizeof(cd_time));
+        cd_type* types = (cd_type*)malloc(CD_COLUMNS_BUFFER * sizeof(cd_type));
+        result = (write(cfd, &header, sizeof(cd_columns_header)) == sizeof(cd_columns_header));
+        // Each chunk of records is spread over all columns
+        for (first = 0; result && (first < header.records); first += chunk) {
+            off_t column = sizeof(cd_columns_header);
+            chunk = (header.records - first > CD_COLUMNS_BUFFER) ? CD_COLUMNS_BUFFER : header.records - first;
+            if (pread(fd, records, chunk * CD_RECORD_SIZE, CD_RECORD_OFFSET(first + 1)) != chunk * CD_RECORD_SIZE) {
+                result = 0;
+                break;
+            }
+            for (i = 0; i < chunk; i++) offsets[i] = records[i].size;
+            result &= cd_columns_write(cfd, offsets, sizeof(cd_size), &column, first, chunk, header.records);
+            for (i = 0; i < chunk; i++) offsets[i] = records[i].parent;
+            result &= cd_columns_write(cfd, offsets, sizeof(cd_offset), &column, first, chunk, header.records);
+            for (i = 0; i < chunk; i++) offsets[i] = records[i].child;
+            result &= cd_columns_write(cfd, offsets, sizeof(cd_offset), &column, first, chunk, header.records);
+            for (i = 0; i < chunk; i++) offsets[i] = records[i].next;
+            result &= cd_columns_write(cfd, offsets, sizeof(cd_offset), &column, first, chunk, header.records);
+            for (i = 0; i < chunk; i++) times[i] = records[i].mtime;
+            result &= cd_columns_write(cfd, times, sizeof(cd_time), &column, first, chunk, header.records);
+            for (i = 0; i < chunk; i++) types[i] = records[i].type;
+            result &= cd_columns_write(cfd, types, sizeof(cd_type), &column, first, chunk, header.records);
+        }
+        free(types);
+        free(times);
+        free(offsets);
+        free(records);
+    }
+    if ((cfd != -1) && close(cfd)) result = 0;
+    if (result) {
+        CD_LOG(CD_LOG_INFO, "[columns] wrote attributes of %llu records\n", (unsigned long long)header.records);
+    } else {
+        CD_LOG(CD_LOG_ERROR, "[error] failed to write columns: \"%s\"\n", columns_name);
+        unlink(columns_name);
+    }
+    if (names_fd != -1) close(names_fd);
+    if (fd != -1) close(fd);
+    free(columns_name);
+    return result;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_COLUMNS_H_
+#define _CD_COLUMNS_H_
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "data.h"
+#include "record.h"
+#include "catalog.h"
+
+#define CD_COLUMNS_EXT      ".cdc"
+#define CD_COLUMNS_MARK     "CDC"
+#define CD_COLUMNS_VERSION  0x01
+#define CD_COLUMNS_COUNT    6
+#define CD_COLUMNS_BUFFER   4096    // Records converted at once
+
+// Followed by arrays of records values, indexed by ID minus one: size,
+// parent, child, next, mtime and type, wider ones first to keep them aligned
+typedef struct {
+    cd_index_mark mark;
+    cd_dword columns;       // Number of arrays
+    cd_offset records;      // Records of the index it was built for
+    cd_offset names;        // Size of the names heap it was built for
+} packed(cd_columns_header);
+
+typedef struct {
+    const char* map;
+    size_t length;
+    cd_offset records;
+    const cd_size* size;
+    const cd_offset* parent;
+    const cd_offset* child;
+    const cd_offset* next;
+    const cd_time* mtime;
+    const cd_type* type;
+} cd_columns;
+
+#define CD_COLUMNS_LENGTH(RECORDS) \
+    (sizeof(cd_columns_header) + (size_t)(RECORDS) * (4 * sizeof(cd_offset) + sizeof(cd_time) + sizeof(cd_type)))
+
+// Maps the columns next to the index, or returns NULL if there are none or they are stale
+static inline cd_columns* cd_columns_open(cd_catalog* catalog) {
+    size_t length;
+    const char* map = cd_catalog_map(catalog, CD_COLUMNS_EXT, &length);
+    if (!map) return NULL;
+    const cd_columns_header* header = (const cd_columns_header*)map;
+    if ((length < sizeof(cd_columns_header)) ||
+        memcmp(&header->mark.mark, CD_COLUMNS_MARK, CD_INDEX_MARK_LEN) || (header->mark.version != CD_COLUMNS_VERSION) ||
+        (header->columns != CD_COLUMNS_COUNT) || (header->records != catalog->records) ||
+        (header->names != catalog->names_length) || (length != CD_COLUMNS_LENGTH(header->records)) || !header->records) {
+        cd_catalog_unmap(map, length);
+        return NULL;
+    }
+    cd_columns* columns = (cd_columns*)malloc(sizeof(cd_columns));
+    columns->map = map;
+    columns->length = length;
+    columns->records = header->records;
+    columns->size = (const cd_size*)(map + sizeof(cd_columns_header));
+    columns->parent = (const cd_offset*)(columns->size + header->records);
+    columns->child = columns->parent + header->records;
+    columns->next = columns->child + header->records;
+    columns->mtime = (const cd_time*)(columns->next + header->records);
+    columns->type = (const cd_type*)(columns->mtime + header->records);
+    return columns;
+}
+
+static inline void cd_columns_close(cd_columns* columns) {
+    cd_catalog_unmap(columns->map, columns->length);
+    free(columns);
+}
+
+// Writes the columns for the index, which must be complete
+int cd_columns_build(const char* base_name, const char* heap_name);
+
+#endif /* _CD_COLUMNS_H_ */
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "crc.h"
+
+#define CD_CRC32C_POLY  0x82F63B78  // Reflected
+
+typedef uint32_t (*cd_crc32c_func)(uint32_t crc, const unsigned char* data, size_t length);
+
+// Eight bytes at a time, each table gives CRC of a byte one position further
+static uint32_t cd_crc32c_table[8][256];
+
+static uint32_t cd_crc32c_soft(uint32_t crc, const unsigned char* data, size_t length) {
+    uint64_t word;
+    while (length && ((uintptr_t)data & 7)) {
+        crc = cd_crc32c_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        length--;
+    }
+    for (; length >= 8; data += 8, length -= 8) {
+        memcpy(&word, data, 8);
+        word ^= crc;
+        crc = cd_crc32c_table[7][word & 0xFF] ^ cd_crc32c_table[6][(word >> 8) & 0xFF] ^
+              cd_crc32c_table[5][(word >> 16) & 0xFF] ^ cd_crc32c_table[4][(word >> 24) & 0xFF] ^
+              cd_crc32c_table[3][(word >> 32) & 0xFF] ^ cd_crc32c_table[2][(word >> 40) & 0xFF] ^
+              cd_crc32c_table[1][(word >> 48) & 0xFF] ^ cd_crc32c_table[0][word >> 56];
+    }
+    while (length--) crc = cd_crc32c_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t cd_crc32c_hard(uint32_t crc, const unsigned char* data, size_t length) {
+    uint64_t word, value = crc;
+    while (length && ((uintptr_t)data & 7)) {
+        value = _mm_crc32_u8(value, *data++);
+        length--;
+    }
+    for (; length >= 8; data += 8, length -= 8) {
+        memcpy(&word, data, 8);
+        value = _mm_crc32_u64(value, word);
+    }
+    while (length--) value = _mm_crc32_u8(value, *data++);
+    return value;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t cd_crc32c_hard(uint32_t crc, const unsigned char* data, size_t length) {
+    uint64_t word;
+    while (length && ((uintptr_t)data & 7)) {
+        crc = __crc32cb(crc, *data++);
+        length--;
+    }
+    for (; length >= 8; data += 8, length -= 8) {
+        memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+    }
+    while (length--) crc = __crc32cb(crc, *data++);
+    return crc;
+}
+#endif
+
+static cd_crc32c_func cd_crc32c_impl = cd_crc32c_soft;
+
+// Before main(), so that threads of cdverify find it ready
+__attribute__((constructor))
+static void cd_crc32c_init(void) {
+    uint32_t i, j, crc;
+    for (i = 0; i < 256; i++) {
+        for (crc = i, j = 0; j < 8; j++) crc = (crc & 1) ? (crc >> 1) ^ CD_CRC32C_POLY : crc >> 1;
+        cd_crc32c_table[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++) {
+        for (j = 1; j < 8; j++) cd_crc32c_table[j][i] = cd_crc32c_table[0][cd_crc32c_table[j-1][i] & 0xFF] ^ (cd_crc32c_table[j-1][i] >> 8);
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) cd_crc32c_impl = cd_crc32c_hard;
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    cd_crc32c_impl = cd_crc32c_hard;
+#endif
+}
+
+uint32_t cd_crc32c(uint32_t crc, const void* data, size_t length) {
+    return ~cd_crc32c_impl(~crc, (const unsigned char*)data, length);
+}
@@ -0,0 +1,15 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_CRC_H_
+#define _CD_CRC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C of the data continuing crc, which is 0 to start; uses CRC32
+// instructions of SSE 4.2 or ARMv8, if the CPU has them
+uint32_t cd_crc32c(uint32_t crc, const void* data, size_t length);
+
+#endif /* _CD_CRC_H_ */
@@ -18,8 +18,10 @@
 #define CD_INDEX_MARK_LEN   3
 #define CD_INDEX_MARK       "CDI"
 #define CD_LINKS_MARK       "CDL"
-#define CD_INDEX_VERSION    0x02
+#define CD_NAMES_MARK       "CDN"
+#define CD_INDEX_VERSION    0x05
 #define CD_LINKS_VERSION    0x01
+#define CD_NAMES_VERSION    0x01
 
 typedef enum {
     CD_DIR = 0,     // directory
@@ -35,7 +37,7 @@ typedef uint16_t cd_mode;
 typedef uint16_t cd_uid;
 typedef uint16_t cd_gid;
 typedef uint16_t cd_word;
-typedef uint32_t cd_offset;
+typedef uint64_t cd_offset;
 typedef uint32_t cd_time;
 typedef uint32_t cd_dword;
 typedef uint64_t cd_size;
@@ -47,7 +49,7 @@ typedef struct {
 
 typedef struct {
     char mark[3];           // "CDI"
-    cd_byte version;        // 0x02
+    cd_byte version;        // 0x05
 } packed(cd_index_mark);
 
 typedef struct {
@@ -75,6 +77,24 @@ typedef struct  {
     cd_offset parent;       // Parent directory
     cd_offset child;        // First file in the directory (for dirs)
     cd_offset next;         // Next file in the directory
-} packed(cd_file_entry);    // 290 (id is not written)
+    cd_offset count;        // Files stored one after another from child, or 0
+    cd_offset heap;         // Offset of the name in the names heap, 0 if not stored yet
+} packed(cd_file_entry);    // Not written as is, see cd_record
+
+typedef struct {
+    cd_type type;           // Type (dir, symlink or file)
+    cd_byte length;         // Length of the name
+    cd_mode mode;           // Access permissions
+    cd_time mtime;          // Modification time
+    cd_uid uid;             // UID
+    cd_gid gid;             // GID
+    cd_size size;           // Size of the file
+    cd_offset name;         // Offset of the name in the names heap (.cdn)
+    cd_offset info;         // Offset in info database
+    cd_offset parent;       // Parent directory
+    cd_offset child;        // First file in the directory (for dirs)
+    cd_offset next;         // Next file in the directory
+    cd_offset count;        // Files stored one after another from child, or 0
+} packed(cd_record);        // 68
 
 #endif /* _CD_DATA_H_ */
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "plugin.h"
 #include "cdindex.h"
@@ -26,6 +27,13 @@ typedef struct {
     regex_t* __regex;
 } cd_external_cmd;
 
+typedef struct {
+    FILE* pipe;
+    char buf[CD_LINE_BUFFER];
+} cd_external_list;
+
+static pthread_mutex_t cd_external_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static inline int isunsafe(int c) {
     if ((c == 0x20) ||  // SPACE
         (c == 0x21) ||  // !
@@ -77,11 +85,13 @@ static cd_external_cmd cd_external_cmds[] = {
 
 void* cd_external_open(void* dummy, const char* file) {
     cd_external_cmd* cmd;
+    // Archives may be opened from several threads
+    pthread_mutex_lock(&cd_external_lock);
     for (cmd = cd_external_cmds; cmd->command; cmd++) {
         if (!cmd->__regex) {
             cmd->__regex = (regex_t*)malloc(sizeof(regex_t));
             if (regcomp(cmd->__regex, cmd->regex, REG_EXTENDED|REG_ICASE|REG_NOSUB) != 0) {
-                printf("[error] regcomp failed: %s\n", cmd->regex);
+                CD_LOG(CD_LOG_ERROR, "[error] regcomp failed: %s\n", cmd->regex);
                 free(cmd->__regex);
                 cmd->__regex = NULL;
                 continue;
@@ -91,23 +101,27 @@ void* cd_external_open(void* dummy, const char* file) {
             if (regexec(cmd->__regex, file, 0, NULL, 0) == 0) break;
         }
     }
+    pthread_mutex_unlock(&cd_external_lock);
     if (cmd->command) {
         char* command = (char*)malloc(strlen(cmd->command) + strsafelen(file) + 9);
         strcpy(command, cmd->command);
         strcat(command, " list \"");
         strsafecat(command, file);
         strcat(command, "\"");
-        printf("[external] %s...\n", command);
+        CD_LOG(CD_LOG_FILE, "[external] %s...\n", command);
         FILE* pipe = popen(command, "r");
         free(command);
-        return pipe;
+        if (!pipe) return NULL;
+        cd_external_list* list = (cd_external_list*)malloc(sizeof(cd_external_list));
+        list->pipe = pipe;
+        return list;
     }
     return NULL;
 }
 
-int cd_external_read(void* pipe, const char** name, const char** link, struct stat64* stat) {
-    static char buf[CD_LINE_BUFFER];
-    while (fgets(buf, CD_LINE_BUFFER, pipe)) {
+int cd_external_read(void* handle, const char** name, const char** link, struct stat64* stat) {
+    char* buf = ((cd_external_list*)handle)->buf;
+    while (fgets(buf, CD_LINE_BUFFER, ((cd_external_list*)handle)->pipe)) {
         int length = strlen(buf);
         char* s = buf;
         // Mode
@@ -150,8 +164,9 @@ int cd_external_read(void* pipe, const char** name, const char** link, struct st
     return -1;
 }
 
-void cd_external_close(void* pipe) {
-    pclose(pipe);
+void cd_external_close(void* handle) {
+    pclose(((cd_external_list*)handle)->pipe);
+    free(handle);
 }
 
 static cd_plugin_info cd_external = {
@@ -3,7 +3,10 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "cdindex.h"
 #include "extract.h"
 
 cd_extractor_info* cd_extractors;
@@ -26,7 +29,7 @@ void cd_free_extractors() {
         if (extractor->finish) {
             if (extractor->__udata) extractor->finish(extractor->__udata);
             else {
-                printf("[error] user data disappeared: %s\n", extractor->name);
+                CD_LOG(CD_LOG_ERROR, "[error] user data disappeared: %s\n", extractor->name);
             }
         }
     }
@@ -36,12 +39,12 @@ void cd_add_extractor(cd_extractor_info* info, cd_base* base) {
     if (info->next) info->next = NULL;
     if (info->init) {
         if (!info->finish) {
-            printf("[error] missing finish function: %s\n", info->name);
+            CD_LOG(CD_LOG_ERROR, "[error] missing finish function: %s\n", info->name);
             return;
         }
         info->__udata = info->init(base);
         if (!info->__udata) {
-            printf("[error] failed to load extractor: %s\n", info->name);
+            CD_LOG(CD_LOG_ERROR, "[error] failed to load extractor: %s\n", info->name);
             return;
         }
     }
@@ -60,7 +63,7 @@ cd_extractor_info* cd_find_extractor(const char* file) {
         if (!extractor->__regex) {
             extractor->__regex = (regex_t*)malloc(sizeof(regex_t));
             if (regcomp(extractor->__regex, extractor->regex, REG_EXTENDED|REG_ICASE|REG_NOSUB) != 0) {
-                printf("[error] regcomp failed: %s\n", extractor->regex);
+                CD_LOG(CD_LOG_ERROR, "[error] regcomp failed: %s\n", extractor->regex);
                 free(extractor->__regex);
                 extractor->__regex = NULL;
                 continue;
@@ -72,3 +75,46 @@ cd_extractor_info* cd_find_extractor(const char* file) {
     }
     return extractor;
 }
+
+cd_offset cd_extract(cd_extractor_info* extractor, const char* file, cd_file_entry* entry, cd_base* base) {
+    int fd;
+    char* tpath;
+    char* thumbnail;
+    cd_offset info;
+    cd_stats_io io;
+    uint64_t start = 0;
+    char key[CD_CACHE_KEY_LEN+1];
+    char suffix[strlen(extractor->name) + 2];
+    sprintf(suffix, ".%s", extractor->name);
+    if (base->stats) {
+        cd_stats_io_read(&io);
+        start = cd_stats_now();
+    }
+    int cached = base->cache && extractor->save && extractor->load && cd_cache_key(file, entry->size, key);
+    if (cached && ((fd = cd_cache_get(base->cache, key, suffix)) != -1)) {
+        thumbnail = cd_cache_path(base->cache, key, "");
+        info = extractor->load(fd, thumbnail, entry, extractor->__udata);
+        free(thumbnail);
+        close(fd);
+        if (info) {
+            CD_LOG(CD_LOG_FILE, "[extractor] reusing cached data for \"%s\"\n", file);
+            if (base->stats) cd_stats_add_io(cd_stats_stage(base->stats, "cache", extractor->name), start, &io);
+            return info;
+        }
+    }
+    CD_LOG(CD_LOG_FILE, "[extractor] extracting \"%s\" using \"%s\"...\n", file, extractor->name);
+    info = extractor->getdata(file, entry, extractor->__udata);
+    if (cached && info && ((fd = cd_cache_create(base->cache, &tpath)) != -1)) {
+        thumbnail = cd_cache_path(base->cache, key, "");
+        if (extractor->save(info, entry, fd, thumbnail, extractor->__udata)) {
+            cd_cache_put(base->cache, fd, tpath, key, suffix);
+        } else {
+            close(fd);
+            unlink(tpath);
+            free(tpath);
+        }
+        free(thumbnail);
+    }
+    if (base->stats) cd_stats_add_io(cd_stats_stage(base->stats, "extractor", extractor->name), start, &io);
+    return info;
+}
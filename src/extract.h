@@ -15,6 +15,9 @@
 typedef void* (*cd_extractor_init)(cd_base*);
 typedef cd_offset (*cd_extractor_getdata)(const char*, cd_file_entry*, void*);
 typedef void (*cd_extractor_finish)(void*);
+typedef cd_offset (*cd_extractor_copy)(cd_offset, cd_offset, cd_file_entry*, void*);
+typedef int (*cd_extractor_save)(cd_offset, cd_file_entry*, int, const char*, void*);
+typedef cd_offset (*cd_extractor_load)(int, const char*, cd_file_entry*, void*);
 
 typedef struct __cd_extractor_info cd_extractor_info;
 struct __cd_extractor_info {
@@ -23,6 +26,9 @@ struct __cd_extractor_info {
     cd_extractor_init init;
     cd_extractor_getdata getdata;
     cd_extractor_finish finish;
+    cd_extractor_copy copy;     // Reuses data of the previous index
+    cd_extractor_save save;     // Stores data in the cache
+    cd_extractor_load load;     // Reuses data from the cache
     void* __udata;
     regex_t* __regex;
     cd_extractor_info* next;
@@ -37,6 +43,8 @@ void cd_add_extractor(cd_extractor_info* info, cd_base* base);
 
 cd_extractor_info* cd_find_extractor(const char* file);
 
+cd_offset cd_extract(cd_extractor_info* extractor, const char* file, cd_file_entry* entry, cd_base* base);
+
 void cd_extractor_load_audio(cd_base* base);
 void cd_extractor_load_image(cd_base* base);
 void cd_extractor_load_video(cd_base* base);
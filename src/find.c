@@ -30,6 +30,8 @@
  * our options:
  *  -nodefdir - do not use default directory
  *  -noarc    - do not go inside archives
+ *  -verify   - check blocks of catalogs against their checksums (see
+ *              cdindex -k) as they are read, skip catalogs that fail
  */
 
 void cd_find_freereq(cd_find_req* req) {
@@ -77,6 +79,8 @@ cd_find_req* cd_find_getargs(int argc, char* argv[]) {
                     req->nodefdir = true;
                 } else if (!strcmp(&argv[i][1], "noarc")) {
                     req->noarc = true;
+                } else if (!strcmp(&argv[i][1], "verify")) {
+                    req->verify = true;
                 } else if (!strcmp(&argv[i][1], "printf")) {
                 } else {
                     exp = (cd_find_exp*)malloc(sizeof(cd_find_exp));
@@ -43,6 +43,7 @@ typedef struct {
     const char* path;
     cd_bool nodefdir;
     cd_bool noarc;
+    cd_bool verify;
     cd_find_exp* exp;
     const char* format;
 } cd_find_req;
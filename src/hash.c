@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hash.h"
+
+#define CD_HASH_LOAD        2       // Items per bucket before growing
+
+static inline uint32_t cd_hash_key(const void* key, size_t length) {
+    size_t i;
+    uint32_t hash = 2166136261u;
+    for (i = 0; i < length; i++) {
+        hash ^= ((const unsigned char*)key)[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+cd_hash* cd_hash_create(unsigned int size) {
+    cd_hash* hash = (cd_hash*)malloc(sizeof(cd_hash));
+    hash->size = (size) ? size : 1;
+    hash->count = 0;
+    hash->items = (cd_hash_item**)calloc(hash->size, sizeof(cd_hash_item*));
+    return hash;
+}
+
+void cd_hash_free(cd_hash* hash) {
+    unsigned int i;
+    cd_hash_item* item;
+    cd_hash_item* next;
+    for (i = 0; i < hash->size; i++) {
+        for (item = hash->items[i]; item; item = next) {
+            next = item->next;
+            free(item);
+        }
+    }
+    free(hash->items);
+    free(hash);
+}
+
+static void cd_hash_grow(cd_hash* hash) {
+    unsigned int i, bucket;
+    unsigned int size = hash->size * 2;
+    cd_hash_item* item;
+    cd_hash_item* next;
+    cd_hash_item** items = (cd_hash_item**)calloc(size, sizeof(cd_hash_item*));
+    if (!items) return;
+    for (i = 0; i < hash->size; i++) {
+        for (item = hash->items[i]; item; item = next) {
+            next = item->next;
+            bucket = cd_hash_key(item->key, item->length) % size;
+            item->next = items[bucket];
+            items[bucket] = item;
+        }
+    }
+    free(hash->items);
+    hash->items = items;
+    hash->size = size;
+}
+
+cd_offset cd_hash_get(cd_hash* hash, const void* key, size_t length) {
+    cd_hash_item* item;
+    for (item = hash->items[cd_hash_key(key, length) % hash->size]; item; item = item->next) {
+        if ((item->length == length) && !memcmp(item->key, key, length)) return item->value;
+    }
+    return 0;
+}
+
+void cd_hash_set(cd_hash* hash, const void* key, size_t length, cd_offset value) {
+    cd_hash_item* item;
+    unsigned int bucket = cd_hash_key(key, length) % hash->size;
+    for (item = hash->items[bucket]; item; item = item->next) {
+        if ((item->length == length) && !memcmp(item->key, key, length)) {
+            item->value = value;
+            return;
+        }
+    }
+    item = (cd_hash_item*)malloc(sizeof(cd_hash_item) + length);
+    item->value = value;
+    item->length = length;
+    memcpy(item->key, key, length);
+    item->next = hash->items[bucket];
+    hash->items[bucket] = item;
+    if (++hash->count > hash->size * CD_HASH_LOAD) cd_hash_grow(hash);
+}
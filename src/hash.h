@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_HASH_H_
+#define _CD_HASH_H_
+
+#include <stddef.h>
+
+#include "data.h"
+
+typedef struct __cd_hash_item cd_hash_item;
+struct __cd_hash_item {
+    cd_offset value;
+    size_t length;
+    cd_hash_item* next;
+    char key[];
+};
+
+typedef struct {
+    cd_hash_item** items;
+    unsigned int size;
+    unsigned int count;
+} cd_hash;
+
+cd_hash* cd_hash_create(unsigned int size);
+
+void cd_hash_free(cd_hash* hash);
+
+cd_offset cd_hash_get(cd_hash* hash, const void* key, size_t length);
+
+void cd_hash_set(cd_hash* hash, const void* key, size_t length, cd_offset value);
+
+#endif /* _CD_HASH_H_ */
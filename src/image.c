@@ -10,8 +10,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
 #include <wand/MagickWand.h>
 
+#include "cdindex.h"
 #include "extract.h"
 #include "image.h"
 
@@ -19,7 +21,7 @@ int wand_count = 0;
 
 typedef struct {
     cd_base* base;
-    MagickWand* wand;
+    int genesis;            // Counted in wand_count
     const char* dir;
     int skip_thumbs;
     int dir_created;
@@ -49,43 +51,70 @@ int cd_create_data_dir(const char* dir) {
             struct stat dstat;
             error = stat(dir, &dstat);
             if (error || !S_ISDIR(dstat.st_mode)) {
-                printf("[warning] unable to create data directory %s\n", dir);
+                CD_LOG(CD_LOG_WARNING, "[warning] unable to create data directory %s\n", dir);
                 return 1;
             }
         } else {
-            printf("[warning] failed to create data directory %s\n", dir);
+            CD_LOG(CD_LOG_WARNING, "[warning] failed to create data directory %s\n", dir);
             return 1;
         }
     }
     return 0;
 }
 
-int cd_get_image_fd(cd_base* base) {
+off_t cd_add_picture(cd_base* base, cd_picture_entry* entry) {
+    off_t offset = 0;
+    // Image and raw image extractors append here from several threads
+    pthread_mutex_lock(&base->lock);
     if (base->images_fd == -1) {
-        base->images_fd = open(base->images_name, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-        if (base->images_fd == -1) return 0;
-        cd_picture_mark mark;
-        memcpy(&mark.mark, CD_PICTURE_MARK, CD_PICTURE_MARK_LEN);
-        mark.version = CD_PICTURE_VERSION;
-        write(base->images_fd, &mark, sizeof(cd_picture_mark));
+        base->images_fd = cd_sidecar_open(base, base->images_name);
+        if ((base->images_fd != -1) && (lseek(base->images_fd, 0, SEEK_END) == 0)) {
+            cd_picture_mark mark;
+            memcpy(&mark.mark, CD_PICTURE_MARK, CD_PICTURE_MARK_LEN);
+            mark.version = CD_PICTURE_VERSION;
+            write(base->images_fd, &mark, sizeof(cd_picture_mark));
+        }
+    }
+    if (base->images_fd != -1) {
+        offset = lseek(base->images_fd, 0, SEEK_END);
+        write(base->images_fd, entry, sizeof(cd_picture_entry));
     }
-    return base->images_fd;
+    pthread_mutex_unlock(&base->lock);
+    return offset;
+}
+
+off_t cd_read_picture(cd_base* base, int fd, off_t from, cd_offset id) {
+    cd_picture_entry entry;
+    if ((fd == -1) || (pread(fd, &entry, sizeof(cd_picture_entry), from) != sizeof(cd_picture_entry))) return 0;
+    entry.offset = id;
+    return cd_add_picture(base, &entry);
+}
+
+int cd_save_picture(cd_base* base, cd_offset info, int fd) {
+    cd_picture_entry entry;
+    if (pread(base->images_fd, &entry, sizeof(cd_picture_entry), info) != sizeof(cd_picture_entry)) return 0;
+    return (write(fd, &entry, sizeof(cd_picture_entry)) == sizeof(cd_picture_entry));
 }
 
 MagickWand* cd_image_get_magick_wand(cd_image_base* ibase) {
-    if (!ibase->wand) {
+    pthread_mutex_lock(&ibase->base->lock);
+    if (!ibase->genesis) {
         if (!IsMagickWandInstantiated()) MagickWandGenesis();
-        ibase->wand = NewMagickWand();
+        ibase->genesis = 1;
         wand_count++;
     }
-    return ibase->wand;
+    pthread_mutex_unlock(&ibase->base->lock);
+    // Wands are not shared, so that images can be read concurrently
+    return NewMagickWand();
 }
 
 int cd_image_thumbnail_init(cd_image_base* ibase) {
+    pthread_mutex_lock(&ibase->base->lock);
     if (!ibase->dir_created) {
         ibase->skip_thumbs = cd_create_data_dir(ibase->dir);
         ibase->dir_created = 1;
     }
+    pthread_mutex_unlock(&ibase->base->lock);
     return !ibase->skip_thumbs;
 }
 
@@ -151,7 +180,7 @@ int cd_image_get_coordinates(MagickWand* wand, float* lat, float* lon) {
 void* cd_image_init(cd_base* base) {
     cd_image_base* ibase = (cd_image_base*)malloc(sizeof(cd_image_base));
     ibase->base = base;
-    ibase->wand = NULL;
+    ibase->genesis = 0;
     size_t baselen = strlen(base->base_name);
     ibase->dir = (char*)malloc(baselen - 3);
     strncpy((char*)ibase->dir, base->base_name, baselen - 4);
@@ -162,10 +191,9 @@ void* cd_image_init(cd_base* base) {
 }
 
 cd_offset cd_image_getdata(const char* file, cd_file_entry* cdentry, void* udata) {
-    int images_fd = cd_get_image_fd(((cd_image_base*)udata)->base);
-    if (images_fd == -1) return 0;
     MagickWand* wand = cd_image_get_magick_wand((cd_image_base*)udata);
-    if (wand && (MagickReadImage(wand, file) != MagickFalse)) {
+    if (!wand) return 0;
+    if (MagickReadImage(wand, file) != MagickFalse) {
         cd_picture_entry entry;
         memset(&entry, 0x00, sizeof(cd_picture_entry));
         entry.offset = cdentry->id;
@@ -197,19 +225,18 @@ cd_offset cd_image_getdata(const char* file, cd_file_entry* cdentry, void* udata
         }
         entry.ctime = cd_image_get_ctime(wand);
         cd_image_get_coordinates(wand, &entry.latitude, &entry.longitude);
-        off_t offset = lseek(images_fd, 0, SEEK_END);
-        write(images_fd, &entry, sizeof(cd_picture_entry));
+        off_t offset = cd_add_picture(((cd_image_base*)udata)->base, &entry);
 #ifdef INCLUDE_THUMBNAILS
-        if (cd_image_thumbnail_init((cd_image_base*)udata)) {
+        if (offset && cd_image_thumbnail_init((cd_image_base*)udata)) {
             if (cd_get_thumbnail_size(&width, &height)) {
                 MagickResizeImage(wand, width, height, LanczosFilter, 1);
             }
             MagickAutoOrientImage(wand);
             MagickStripImage(wand);
             MagickSetImageCompressionQuality(wand, CD_THUMBNAIL_JPEG_QUALITY);
-            char* tpath = (char*)malloc(strlen(((cd_image_base*)udata)->dir) + 16);
-            sprintf(tpath, "%s/%u.jpg", ((cd_image_base*)udata)->dir, cdentry->id);
-            printf("[image] writing thumbnail to %s\n", tpath);
+            char* tpath = (char*)malloc(strlen(((cd_image_base*)udata)->dir) + 32);
+            sprintf(tpath, "%s/%llu.jpg", ((cd_image_base*)udata)->dir, (unsigned long long)cdentry->id);
+            CD_LOG(CD_LOG_FILE, "[image] writing thumbnail to %s\n", tpath);
             if (MagickGetImageAlphaChannel(wand)) {
                 PixelWand* pixel = NewPixelWand();
                 PixelSetColor(pixel, "grey");
@@ -224,16 +251,60 @@ cd_offset cd_image_getdata(const char* file, cd_file_entry* cdentry, void* udata
             free(tpath);
         }
 #endif /* INCLUDE_THUMBNAILS */
+        DestroyMagickWand(wand);
         return offset;
     } else {
-        printf("[warning] failed to open image %s\n", file);
+        CD_LOG(CD_LOG_WARNING, "[warning] failed to open image %s\n", file);
     }
+    DestroyMagickWand(wand);
     return 0;
 }
 
+cd_offset cd_image_copy(cd_offset info, cd_offset previous, cd_file_entry* cdentry, void* udata) {
+    off_t offset = cd_read_picture(((cd_image_base*)udata)->base, ((cd_image_base*)udata)->base->update->images_fd, info, cdentry->id);
+#ifdef INCLUDE_THUMBNAILS
+    if (offset && cd_image_thumbnail_init((cd_image_base*)udata)) {
+        char from[32], to[32];
+        sprintf(from, "%llu.jpg", (unsigned long long)previous);
+        sprintf(to, "%llu.jpg", (unsigned long long)cdentry->id);
+        cd_relink_thumbnail(((cd_image_base*)udata)->dir, from, to);
+    }
+#endif /* INCLUDE_THUMBNAILS */
+    return offset;
+}
+
+int cd_image_save(cd_offset info, cd_file_entry* cdentry, int fd, const char* thumbnail, void* udata) {
+    if (!cd_save_picture(((cd_image_base*)udata)->base, info, fd)) return 0;
+#ifdef INCLUDE_THUMBNAILS
+    char* from = (char*)malloc(strlen(((cd_image_base*)udata)->dir) + 32);
+    sprintf(from, "%s/%llu.jpg", ((cd_image_base*)udata)->dir, (unsigned long long)cdentry->id);
+    char* to = (char*)malloc(strlen(thumbnail) + 5);
+    sprintf(to, "%s.jpg", thumbnail);
+    cd_cache_link(from, to);
+    free(to);
+    free(from);
+#endif /* INCLUDE_THUMBNAILS */
+    return 1;
+}
+
+cd_offset cd_image_load(int fd, const char* thumbnail, cd_file_entry* cdentry, void* udata) {
+    off_t offset = cd_read_picture(((cd_image_base*)udata)->base, fd, 0, cdentry->id);
+#ifdef INCLUDE_THUMBNAILS
+    if (offset && cd_image_thumbnail_init((cd_image_base*)udata)) {
+        char* from = (char*)malloc(strlen(thumbnail) + 5);
+        sprintf(from, "%s.jpg", thumbnail);
+        char* to = (char*)malloc(strlen(((cd_image_base*)udata)->dir) + 32);
+        sprintf(to, "%s/%llu.jpg", ((cd_image_base*)udata)->dir, (unsigned long long)cdentry->id);
+        cd_cache_link(from, to);
+        free(to);
+        free(from);
+    }
+#endif /* INCLUDE_THUMBNAILS */
+    return offset;
+}
+
 void cd_image_finish(void* udata) {
-    if (((cd_image_base*)udata)->wand) {
-        DestroyMagickWand(((cd_image_base*)udata)->wand);
+    if (((cd_image_base*)udata)->genesis) {
         wand_count--;
         if (IsMagickWandInstantiated() && (wand_count <= 0)) MagickWandTerminus();
     }
@@ -247,6 +318,9 @@ static cd_extractor_info cd_image = {
     cd_image_init,
     cd_image_getdata,
     cd_image_finish,
+    cd_image_copy,
+    cd_image_save,
+    cd_image_load,
     NULL,
     NULL,
     NULL
@@ -12,13 +12,13 @@
 
 #define CD_PICTURE_MARK     "CDP"
 #define CD_PICTURE_MARK_LEN 3
-#define CD_PICTURE_VERSION  0x01
+#define CD_PICTURE_VERSION  0x02
 
 extern int wand_count;
 
 typedef struct {
     char mark[3];           // "CDP"
-    cd_byte version;        // 0x01
+    cd_byte version;        // 0x02
 } packed(cd_picture_mark);
 
 typedef struct {
@@ -36,6 +36,10 @@ int cd_get_thumbnail_size(int* width, int* height);
 
 int cd_create_data_dir(const char* dir);
 
-int cd_get_image_fd(cd_base* base);
+off_t cd_add_picture(cd_base* base, cd_picture_entry* entry);
+
+off_t cd_read_picture(cd_base* base, int fd, off_t from, cd_offset id);
+
+int cd_save_picture(cd_base* base, cd_offset info, int fd);
 
 #endif /* _CD_IMAGE_H_ */
@@ -11,6 +11,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <linux/iso_fs.h>
 #include <time.h>
@@ -19,26 +20,143 @@
 #include "index.h"
 #include "plugin.h"
 #include "extract.h"
+#include "hash.h"
+#include "iso.h"
 
 #define false   0
 #define true    1
 
-void cd_fix_prev(cd_file_entry* parent, cd_file_entry* next, cd_base* base) {
+#define CD_TAILS_SIZE   1024    // Initial size of directory tails cache
+#define CD_DIRS_SIZE    1024    // Initial size of directory paths cache
+#define CD_BATCH_SIZE   256     // Initial number of names per stat batch
+#define CD_AHEAD_JOBS   2       // Archives ingested ahead per worker
+
+#define CD_MEMBERS_SUFFIX   ".members"
+
+typedef struct {
+    cd_file_entry* root;    // Archive entry
+    cd_hash* dirs;          // Directory path -> id
+    cd_hash* tails;         // Directory id -> id of the last child
+    cd_file_entry upper;    // Parent of the current member
+    char* last;             // Parent path of the previous member
+    size_t last_length;
+    size_t last_size;
+    cd_offset last_id;
+} cd_ingest;
+
+typedef struct {
+    cd_offset count;        // Number of members, stored after symlinks
+    cd_offset child;        // First member of the archive
+    cd_offset links;        // Size of symlinks, stored after the header
+} packed(cd_cached_members);
+
+typedef struct {
+    cd_extractor_info* extractor;
+    char* file;
+    cd_file_entry entry;
+    cd_base* base;
+} cd_extract_job;
+
+typedef struct __cd_archive_job cd_archive_job;
+struct __cd_archive_job {
+    char* file;
+    cd_plugin_info* plugin;
+    cd_file_entry root;     // Archive entry, members get local ids from 1
+    cd_offset offset;       // Next local id
+    cd_base* base;          // Private in-memory base for members
+    cd_size position;       // On the disc if the tree was read from an image, or 0
+    int done;
+    cd_archive_job* next;
+};
+
+typedef struct {
+    cd_archive_job* first;  // Archives in walk order, not spliced yet
+    cd_archive_job* queued; // First archive not submitted yet
+    cd_archive_job* last;
+    int ahead;              // Submitted, but not spliced
+    int image;              // Tree was read from an image, so st_ino of files is their first block
+} cd_archives;
+
+static cd_offset cd_append_name(cd_file_entry* entry, size_t length, cd_base* base) {
+    cd_offset offset = base->heap_size;
+    if (length && (pwrite(base->heap_fd, entry->name, length, offset) != length)) {
+        CD_LOG(CD_LOG_ERROR, "[error] failed to write name: \"%s\" (%llu)\n", entry->name, (unsigned long long)entry->id);
+        base->failed = 1;
+        return 0;
+    }
+    base->heap_size += length;
+    return offset;
+}
+
+// Names seen before are not written again, the record points to the first copy
+static cd_offset cd_save_name(cd_file_entry* entry, cd_base* base) {
+    size_t length = strnlen(entry->name, CD_NAME_MAX);
+    if (!base->names || !length) return cd_append_name(entry, length, base);
+    cd_offset offset = cd_hash_get(base->names, entry->name, length);
+    if (offset) return offset;
+    offset = cd_append_name(entry, length, base);
+    if (offset && (base->names->count < CD_NAMES_INTERNED)) cd_hash_set(base->names, entry->name, length, offset);
+    return offset;
+}
+
+void cd_save_entry(cd_file_entry* entry, cd_base* base) {
+    cd_record record;
+    uint64_t start = (base->stats) ? cd_stats_now() : 0;
+    if (base->tree) {
+        cd_tree_save(base->tree, entry);
+        if (base->stats) cd_stats_add(base->stats->record, start, 1, CD_ENTRY_SIZE, 0);
+        return;
+    }
+    // Name is stored once, records are rewritten as the directory fills
+    int named = (entry->heap == 0);
+    if (named) entry->heap = cd_save_name(entry, base);
+    cd_record_pack(entry, &record);
+    DEBUG_OUTPUT(DEBUG_BASEIO, "saving record #%llu\n", (unsigned long long)entry->id);
+    if (pwrite(base->base_fd, &record, CD_RECORD_SIZE, CD_RECORD_OFFSET(entry->id)) != CD_RECORD_SIZE) {
+        CD_LOG(CD_LOG_ERROR, "[error] failed to write record: \"%s\" (%llu)\n", entry->name, (unsigned long long)entry->id);
+        base->failed = 1;
+    }
+    if (base->stats) cd_stats_add(base->stats->record, start, 1, CD_RECORD_SIZE + ((named) ? record.length : 0), 1 + named);
+}
+
+int cd_load_entry(cd_offset id, cd_file_entry* entry, cd_base* base) {
+    if (base->tree) return cd_tree_load(base->tree, id, entry);
+    return cd_record_read(base->base_fd, base->heap_fd, id, entry);
+}
+
+void cd_save_info(cd_offset id, cd_offset info, cd_base* base) {
+    if (base->tree) {
+        cd_file_entry entry;
+        if (cd_tree_load(base->tree, id, &entry)) {
+            entry.info = info;
+            cd_tree_save(base->tree, &entry);
+        }
+        return;
+    }
+    off_t offset = CD_RECORD_OFFSET(id) + offsetof(cd_record, info);
+    if (pwrite(base->base_fd, &info, sizeof(cd_offset), offset) != sizeof(cd_offset)) {
+        CD_LOG(CD_LOG_ERROR, "[error] failed to update record #%llu\n", (unsigned long long)id);
+        base->failed = 1;
+    }
+}
+
+void cd_fix_prev(cd_file_entry* parent, cd_file_entry* next, cd_base* base, cd_hash* tails) {
     if (parent->child != next->id) {
-        off_t offset;
-        cd_offset index;
+        cd_offset index = (tails) ? cd_hash_get(tails, &parent->id, sizeof(cd_offset)) : 0;
         cd_file_entry entry;
-        for (index = parent->child; index;) {
-            offset = sizeof(cd_iso_header) + (index - 1) * (sizeof(cd_file_entry) - sizeof(cd_offset));
-            if (lseek(base->base_fd, offset, SEEK_SET) == offset) {
-                read(base->base_fd, (void*)&entry + sizeof(cd_offset), sizeof(cd_file_entry) - sizeof(cd_offset));
-                index = entry.next;
-            } else return;
+        if (index) {
+            if (!cd_load_entry(index, &entry, base)) return;
+        } else {
+            for (index = parent->child; index;) {
+                if (cd_load_entry(index, &entry, base)) {
+                    index = entry.next;
+                } else return;
+            }
         }
         entry.next = next->id;
-        lseek(base->base_fd, offset, SEEK_SET);
-        write(base->base_fd, (void*)&entry + sizeof(cd_offset), sizeof(cd_file_entry) - sizeof(cd_offset));
+        cd_save_entry(&entry, base);
     }
+    if (tails) cd_hash_set(tails, &parent->id, sizeof(cd_offset), next->id);
 }
 
 const char* cd_copy_filename(const char* path, char* name) {
@@ -91,20 +209,12 @@ cd_file_entry* cd_create_entry(const char* name, struct stat64* stat, cd_file_en
     if (parent && (parent->child == 0)) parent->child = entry->id;
     entry->child = 0;
     entry->next = 0;
+    entry->count = 0;
+    entry->heap = 0;
 
     return entry;
 }
 
-void cd_save_entry(cd_file_entry* entry, cd_base* base) {
-    off_t offset = sizeof(cd_iso_header) + (entry->id - 1) * (sizeof(cd_file_entry) - sizeof(cd_offset));
-    if (lseek(base->base_fd, offset, SEEK_SET) == offset) {
-        DEBUG_OUTPUT(DEBUG_BASEIO, "saving record #%u\n", entry->id);
-        write(base->base_fd, (void*)entry + sizeof(cd_offset), sizeof(cd_file_entry) - sizeof(cd_offset));
-    } else {
-        printf("[error] seek failed: \"%s\" (%u)\n", entry->name, entry->id);
-    }
-}
-
 void cd_update_entry(struct stat64* stat, cd_file_entry* entry, cd_base* base) {
     entry->mode  = (unsigned short)stat->st_mode;
     entry->mtime = stat->st_mtime;
@@ -115,234 +225,835 @@ void cd_update_entry(struct stat64* stat, cd_file_entry* entry, cd_base* base) {
     cd_save_entry(entry, base);
 }
 
-cd_file_entry* cd_autocreate_path(const char* path, cd_file_entry* upper, cd_offset* offset, cd_base* base) {
-    const char* dir = path;
-    char* end = strchr(path, '/');
-    cd_file_entry* parent = upper;
-    cd_file_entry* entry = NULL;
-    while (end && *(end+1)) {
-        entry = (cd_file_entry*)malloc(sizeof(cd_file_entry));
+size_t cd_parent_length(const char* path) {
+    size_t length = strlen(path);
+    if (length && (path[length-1] == '/')) length--;
+    while (length && (path[length-1] != '/')) length--;
+    return (length) ? length - 1 : 0;
+}
+
+cd_offset cd_autocreate_path(const char* path, size_t length, cd_ingest* ingest, cd_offset* offset, cd_base* base) {
+    cd_offset id = 0;
+    const char* end;
+    const char* dir;
+    cd_file_entry entries[2];
+    cd_file_entry* entry;
+    cd_file_entry* parent = ingest->root;
+    // Directories exist as prefixes, so look for the first missing one
+    for (dir = path; dir < path + length; dir = end + 1) {
+        end = memchr(dir, '/', path + length - dir);
+        if (!end) end = path + length;
+        cd_offset index = cd_hash_get(ingest->dirs, path, end - path);
+        if (!index) break;
+        id = index;
+    }
+    if (id) {
+        if (!cd_load_entry(id, &entries[0], base)) return 0;
+        parent = &entries[0];
+    }
+    for (; dir < path + length; dir = end + 1) {
+        end = memchr(dir, '/', path + length - dir);
+        if (!end) end = path + length;
+        if ((end == dir) || (end - dir > CD_NAME_MAX)) return 0;
+        entry = (parent == &entries[0]) ? &entries[1] : &entries[0];
         memset(entry->name, '\0', CD_NAME_MAX);
         memcpy(entry->name, dir, end - dir);
-        if (entry->name[0]) {
-            entry->id    = (*offset)++;
-            entry->type  = CD_DIR;
-            entry->mode  = (unsigned short)S_IFDIR|S_IRUSR|S_IXUSR|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH;
-            entry->mtime = 0;
-            entry->uid   = 0;
-            entry->gid   = 0;
-            entry->size  = 0;
-            entry->info  = 0;
-            entry->parent = parent->id;
-            if (parent->child == 0) parent->child = entry->id;
-            entry->child = 0;
-            entry->next  = 0;
-            if (parent == upper) {
-                printf("[warning] automatically creating directory %s\n", entry->name);
-            } else {
-                printf("[warning] automatically creating directory %s (under %s)\n", entry->name, parent->name);
-            }
-        } else {
-            free(entry);
-            return NULL;
-        }
-        if (parent == upper) {
-            cd_fix_prev(parent, entry, base);
+        entry->id    = (*offset)++;
+        entry->type  = CD_DIR;
+        entry->mode  = (unsigned short)S_IFDIR|S_IRUSR|S_IXUSR|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH;
+        entry->mtime = 0;
+        entry->uid   = 0;
+        entry->gid   = 0;
+        entry->size  = 0;
+        entry->info  = 0;
+        entry->parent = parent->id;
+        if (parent->child == 0) parent->child = entry->id;
+        entry->child = 0;
+        entry->next  = 0;
+        entry->count = 0;
+        entry->heap  = 0;
+        if (parent == ingest->root) {
+            CD_LOG(CD_LOG_WARNING, "[warning] automatically creating directory %s\n", entry->name);
         } else {
-            cd_save_entry(parent, base);
-            free(parent);
+            CD_LOG(CD_LOG_WARNING, "[warning] automatically creating directory %s (under %s)\n", entry->name, parent->name);
         }
+        cd_fix_prev(parent, entry, base, ingest->tails);
+        if ((parent != ingest->root) && (parent->child == entry->id)) cd_save_entry(parent, base);
+        cd_hash_set(ingest->dirs, path, end - path, entry->id);
         parent = entry;
-        dir = end + 1;
-        end = strchr(dir, '/');
     }
-    if (entry) cd_save_entry(entry, base);
-    return entry;
+    if (parent == ingest->root) return 0;
+    cd_save_entry(parent, base);
+    return parent->id;
 }
 
-cd_file_entry* cd_find_parent(const char* path, cd_file_entry* parent, cd_offset* eoff, cd_base* base) {
-    char* next = strchr(path, '/');
-    if (!next || !*(next+1)) return parent;
-    off_t offset;
-    const char* dir;
-    cd_offset index = parent->id + 1;
-    cd_file_entry* upper = NULL;
-    cd_file_entry* entry = (cd_file_entry*)malloc(sizeof(cd_file_entry));
-    for (dir = path; next && *(next+1);) {
-        if (index) {
-            for (;;) {
-                offset = sizeof(cd_iso_header) + (index - 1) * (sizeof(cd_file_entry) - sizeof(cd_offset));
-                if (lseek(base->base_fd, offset, SEEK_SET) == offset) {
-                    if (read(base->base_fd, (void*)entry + sizeof(cd_offset), sizeof(cd_file_entry) - sizeof(cd_offset)) > 0) {
-                        entry->id = index;
-                        if (!strncmp(entry->name, dir, next - dir) && !entry->name[next-dir]) {
-                            index = entry->child;
-                            free(upper);
-                            upper = (cd_file_entry*)malloc(sizeof(cd_file_entry));
-                            memcpy(upper, entry, sizeof(cd_file_entry));
-                            break;
-                        } else if (entry->next) {
-                            index = entry->next;
-                            continue;
+cd_file_entry* cd_find_parent(const char* path, cd_ingest* ingest, cd_offset* offset, cd_base* base) {
+    cd_offset id;
+    size_t length = cd_parent_length(path);
+    if (!length) return ingest->root;
+    // Members of archives usually come grouped by directory
+    if ((length == ingest->last_length) && !memcmp(path, ingest->last, length)) {
+        id = ingest->last_id;
+    } else {
+        id = cd_hash_get(ingest->dirs, path, length);
+        if (!id) id = cd_autocreate_path(path, length, ingest, offset, base);
+        if (!id) return NULL;
+        if (length > ingest->last_size) {
+            ingest->last_size = length;
+            ingest->last = (char*)realloc(ingest->last, ingest->last_size);
+        }
+        memcpy(ingest->last, path, length);
+        ingest->last_length = length;
+        ingest->last_id = id;
+    }
+    if (!cd_load_entry(id, &ingest->upper, base)) return NULL;
+    return &ingest->upper;
+}
+
+off_t cd_add_symlink(const char* path, unsigned long size, cd_base* base) {
+    uint64_t start = (base->stats) ? cd_stats_now() : 0;
+    if (base->slinks_fd == -1) {
+        base->slinks_fd = cd_sidecar_open(base, base->slinks_name);
+        if (base->slinks_fd == -1) return 0;
+        if (lseek(base->slinks_fd, 0, SEEK_END) == 0) {
+            cd_index_mark mark;
+            memcpy(&mark.mark, CD_LINKS_MARK, CD_INDEX_MARK_LEN);
+            mark.version = CD_LINKS_VERSION;
+            write(base->slinks_fd, &mark, sizeof(cd_index_mark));
+        }
+    }
+    off_t offset = lseek(base->slinks_fd, 0, SEEK_END);
+    write(base->slinks_fd, path, size);
+    if (base->stats) cd_stats_add(base->stats->symlink, start, 1, size, 2);
+    return offset;
+}
+
+void cd_index_archive(const char* file, cd_file_entry* entry, cd_plugin_info* plugin, cd_offset* offset, cd_base* base) {
+    struct stat64 stat;
+    cd_stats_io io;
+    uint64_t start = 0;
+    if (base->stats) {
+        cd_stats_io_read(&io);
+        start = cd_stats_now();
+    }
+    void* arc = (plugin->init) ? plugin->init() : NULL;
+    if (!plugin->init || arc) {
+        void* handle;
+        if ((handle = plugin->open(arc, file))) {
+            int psave;
+            size_t length;
+            const char* path;
+            int errors = false;
+            const char* symlink;
+            cd_ingest ingest;
+            cd_file_entry* upper;
+            cd_file_entry archive;
+            char name[CD_NAME_MAX];
+            memset(&ingest, '\0', sizeof(cd_ingest));
+            ingest.root = entry;
+            ingest.dirs = cd_hash_create(CD_DIRS_SIZE);
+            ingest.tails = cd_hash_create(CD_TAILS_SIZE);
+            CD_LOG(CD_LOG_FILE, "[plugin] indexing \"%s\" using %s...\n", file, plugin->name);
+            while (plugin->read(handle, &path, &symlink, &stat) != -1) {
+                psave = false;
+                upper = cd_find_parent(path, &ingest, offset, base);
+                if (upper) {
+                    if ((upper != entry) && (upper->child == 0)) psave = true;
+                    cd_copy_filename(path, name);
+                    length = strlen(path);
+                    if (length && (path[length-1] == '/')) length--;
+                    cd_offset index = (S_ISDIR(stat.st_mode)) ? cd_hash_get(ingest.dirs, path, length) : 0;
+                    if (index && cd_load_entry(index, &archive, base)) {
+                        // We created this dir automatically before, now update it
+                        cd_update_entry(&stat, &archive, base);
+                    } else {
+                        cd_create_entry(name, &stat, &archive, upper, offset);
+                        if ((archive.type == CD_LNK) && symlink) {
+                            archive.size = strlen(symlink);
+                            if (archive.size) archive.info = cd_add_symlink(symlink, archive.size, base);
                         }
+                        cd_save_entry(&archive, base);
+                        if (psave) cd_save_entry(upper, base);
+                        cd_fix_prev(upper, &archive, base, ingest.tails);
+                        if (archive.type == CD_DIR) cd_hash_set(ingest.dirs, path, length, archive.id);
                     }
-                    free(entry);
-                    entry = cd_autocreate_path(dir, (upper) ? upper : parent, eoff, base);
-                    if (upper) free(upper);
-                    return entry;
                 } else {
-                    free(entry);
-                    if (upper) free(upper);
-                    return NULL;
+                    errors = true;
+                    CD_LOG(CD_LOG_ERROR, "[error] parent not found: \"%s\"\n", path);
                 }
             }
+            if (errors) CD_LOG(CD_LOG_WARNING, "[warning] indexed with errors: \"%s\"\n", file);
+            cd_hash_free(ingest.dirs);
+            cd_hash_free(ingest.tails);
+            free(ingest.last);
+            plugin->close(handle);
+            entry->type = CD_ARC;
         } else {
-            free(entry);
-            if (upper) free(upper);
-            return NULL;
+            if (!plugin->ignore_errors) CD_LOG(CD_LOG_ERROR, "[error] could not open archive: \"%s\"\n", file);
         }
-        dir = next + 1;
-        next = strchr(dir, '/');
+        if (plugin->finish) plugin->finish(arc);
+    } else {
+        CD_LOG(CD_LOG_ERROR, "[error] init failed: %s\n", plugin->name);
     }
-    if (upper) free(upper);
-    return entry;
+    if (base->stats) cd_stats_add_io(cd_stats_stage(base->stats, "plugin", plugin->name), start, &io);
 }
 
-cd_offset cd_find_entry(cd_file_entry* parent, const char* name, cd_file_entry* entry, cd_base* base) {
-    off_t offset;
-    cd_offset index;
-    for (index = parent->child; index;) {
-        offset = sizeof(cd_iso_header) + (index - 1) * (sizeof(cd_file_entry) - sizeof(cd_offset));
-        if ((lseek(base->base_fd, offset, SEEK_SET) == offset) &&
-            (read(base->base_fd, (void*)entry + sizeof(cd_offset), sizeof(cd_file_entry) - sizeof(cd_offset)) > 0)) {
-            if (!strncmp(entry->name, name, CD_NAME_MAX)) return entry->id = index;
-            else index = entry->next;
-        } else break;
+static void cd_copy_members(cd_tree* tree, int slinks_fd, cd_offset first, cd_offset count, cd_offset child, cd_file_entry* entry, cd_offset* offset, cd_base* base) {
+    cd_offset id;
+    cd_file_entry member;
+    cd_arena_mark mark;
+    // Members go right after the archive, as if they were ingested here
+    cd_offset delta = *offset - first;
+    cd_arena_mark_get(base->arena, &mark);
+    for (id = first; id < first + count; id++) {
+        if (!cd_tree_load(tree, id, &member)) continue;
+        member.id += delta;
+        member.heap = 0;
+        // Top level members have the archive as parent, which is not copied
+        member.parent = ((member.parent >= first) && (member.parent < first + count)) ? member.parent + delta : entry->id;
+        if (member.child) member.child += delta;
+        if (member.next) member.next += delta;
+        if ((member.type == CD_LNK) && member.size && member.info) {
+            char* linkpath = (char*)cd_arena_alloc(base->arena, member.size);
+            if (pread(slinks_fd, linkpath, member.size, member.info) == member.size) {
+                member.info = cd_add_symlink(linkpath, member.size, base);
+            } else {
+                member.info = 0;
+            }
+            cd_arena_release(base->arena, &mark);
+        }
+        cd_save_entry(&member, base);
     }
-    return 0;
+    *offset += count;
+    if (child) entry->child = child + delta;
 }
 
-off_t cd_add_symlink(const char* path, unsigned long size, cd_base* base) {
-    if (base->slinks_fd == -1) {
-        base->slinks_fd = open(base->slinks_name, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-        if (base->slinks_fd == -1) return 0;
-        cd_index_mark mark;
-        memcpy(&mark.mark, CD_LINKS_MARK, CD_INDEX_MARK_LEN);
-        mark.version = CD_LINKS_VERSION;
-        write(base->slinks_fd, &mark, sizeof(cd_index_mark));
+static int cd_cached_archive(const char* key, cd_file_entry* entry, cd_offset* offset, cd_base* base) {
+    cd_tree* tree = NULL;
+    cd_cached_members header;
+    int fd = cd_cache_get(base->cache, key, CD_MEMBERS_SUFFIX);
+    if (fd == -1) return false;
+    if ((read(fd, &header, sizeof(cd_cached_members)) == sizeof(cd_cached_members)) &&
+        (tree = cd_tree_read(fd, sizeof(cd_cached_members) + header.links)) && (tree->count == header.count)) {
+        // Symlink offsets are in the cache entry itself
+        cd_copy_members(tree, fd, 1, header.count, header.child, entry, offset, base);
+        entry->type = CD_ARC;
+    } else {
+        CD_LOG(CD_LOG_WARNING, "[warning] broken cache entry: %s%s\n", key, CD_MEMBERS_SUFFIX);
     }
-    off_t offset = lseek(base->slinks_fd, 0, SEEK_END);
-    write(base->slinks_fd, path, size);
-    return offset;
+    if (tree) cd_tree_free(tree);
+    close(fd);
+    return (entry->type == CD_ARC);
 }
 
-void cd_index(const char* path, cd_file_entry* parent, cd_offset* offset, cd_base* base) {
-    DIR* dir = opendir(path);
-    if (dir) {
-        chdir(path);
-        struct stat64 stat;
-        struct dirent* file;
-        cd_file_entry* prev = NULL;
-        while ((file = readdir(dir))) {
-            if (!strcmp(file->d_name, ".")) continue;
-            if (!strcmp(file->d_name, "..")) continue;
-            if (lstat64(file->d_name, &stat) != -1) {
-                if (!S_ISDIR(stat.st_mode) &&
-                    !S_ISREG(stat.st_mode) &&
-                    !S_ISLNK(stat.st_mode)) {
-                    DEBUG_OUTPUT(DEBUG_INDEX, "skipping \"%s\" (type:%03d)\n", file->d_name, file->d_type);
-                    continue;
-                }
-                cd_file_entry* entry = cd_create_entry(file->d_name, &stat, NULL, parent, offset);
-                if (entry->type == CD_DIR) {
-                    printf("[dir] indexing \"%s\"...\n", file->d_name);
-                    cd_index(file->d_name, entry, offset, base);
-                } else if (entry->type == CD_LNK) {
-                    char* linkpath = (char*)malloc(entry->size);
-                    if (readlink(file->d_name, linkpath, entry->size) != -1) {
-                        entry->info = cd_add_symlink(linkpath, entry->size, base);
-                        free(linkpath);
-                    }
-                } else if (entry->type == CD_REG) {
+static void cd_cache_archive(const char* key, cd_file_entry* entry, cd_offset first, cd_offset count, cd_base* base) {
+    char* tpath;
+    cd_offset id;
+    cd_file_entry member;
+    cd_arena_mark mark;
+    cd_cached_members header;
+    int fd = cd_cache_create(base->cache, &tpath);
+    if (fd == -1) return;
+    cd_arena_mark_get(base->arena, &mark);
+    // Members are stored with IDs from 1, with the archive as 0
+    cd_offset delta = first - 1;
+    header.count = count;
+    header.child = (entry->child) ? entry->child - delta : 0;
+    header.links = 0;
+    char* records = (char*)malloc(count * CD_ENTRY_SIZE);
+    lseek(fd, sizeof(cd_cached_members), SEEK_SET);
+    for (id = first; id < first + count; id++) {
+        if (!cd_load_entry(id, &member, base)) break;
+        member.parent = (member.parent == entry->id) ? 0 : member.parent - delta;
+        if (member.child) member.child -= delta;
+        if (member.next) member.next -= delta;
+        if ((member.type == CD_LNK) && member.size && member.info) {
+            char* linkpath = (char*)cd_arena_alloc(base->arena, member.size);
+            int stored = (pread(base->slinks_fd, linkpath, member.size, member.info) == member.size) &&
+                         (write(fd, linkpath, member.size) == member.size);
+            cd_arena_release(base->arena, &mark);
+            if (!stored) break;
+            member.info = sizeof(cd_cached_members) + header.links;
+            header.links += member.size;
+        }
+        member.heap = 0;
+        memcpy(records + (id - first) * CD_ENTRY_SIZE, (void*)&member + sizeof(cd_offset), CD_ENTRY_SIZE);
+    }
+    if ((id == first + count) &&
+        (write(fd, records, count * CD_ENTRY_SIZE) == count * CD_ENTRY_SIZE) &&
+        (pwrite(fd, &header, sizeof(cd_cached_members), 0) == sizeof(cd_cached_members))) {
+        cd_cache_put(base->cache, fd, tpath, key, CD_MEMBERS_SUFFIX);
+    } else {
+        close(fd);
+        unlink(tpath);
+        free(tpath);
+    }
+    free(records);
+}
 
-                    // Check for extractors
-                    cd_extractor_info* extractor = cd_find_extractor(file->d_name);
-                    if (extractor) {
-                        printf("[extractor] extracting \"%s\" using \"%s\"...\n", file->d_name, extractor->name);
-                        entry->info = extractor->getdata(file->d_name, entry, extractor->__udata);
-                    }
+static void cd_index_cached(const char* file, cd_file_entry* entry, cd_plugin_info* plugin, cd_offset* offset, cd_base* base) {
+    char key[CD_CACHE_KEY_LEN+1];
+    cd_offset first = *offset;
+    int cached = base->cache && cd_cache_key(file, entry->size, key);
+    if (cached && cd_cached_archive(key, entry, offset, base)) {
+        CD_LOG(CD_LOG_FILE, "[plugin] reusing cached listing for \"%s\"\n", file);
+        return;
+    }
+    cd_index_archive(file, entry, plugin, offset, base);
+    if (cached && (entry->type == CD_ARC)) cd_cache_archive(key, entry, first, *offset - first, base);
+}
 
-                    // Check for plugins
-                    cd_plugin_info* plugin = cd_find_plugin(file->d_name);
-                    if (plugin) {
-                        void* arc = (plugin->init) ? plugin->init() : NULL;
-                        if (!plugin->init || arc) {
-                            void* handle;
-                            if ((handle = plugin->open(arc, file->d_name))) {
-                                int psave;
-                                const char* path;
-                                int errors = false;
-                                const char* symlink;
-                                cd_file_entry* upper;
-                                cd_file_entry archive;
-                                char name[CD_NAME_MAX];
-                                printf("[plugin] indexing \"%s\" using %s...\n", file->d_name, plugin->name);
-                                while (plugin->read(handle, &path, &symlink, &stat) != -1) {
-                                    psave = false;
-                                    upper = cd_find_parent(path, entry, offset, base);
-                                    if (upper) {
-                                        if ((upper != entry) && (upper->child == 0)) psave = true;
-                                        cd_copy_filename(path, name);
-                                        if (S_ISDIR(stat.st_mode) && cd_find_entry(upper, name, &archive, base)) {
-                                            // We created this dir automatically before, now update it
-                                            cd_update_entry(&stat, &archive, base);
-                                        } else {
-                                            cd_create_entry(name, &stat, &archive, upper, offset);
-                                            if ((archive.type == CD_LNK) && symlink) {
-                                                archive.size = strlen(symlink);
-                                                if (archive.size) archive.info = cd_add_symlink(symlink, archive.size, base);
-                                            }
-                                            cd_save_entry(&archive, base);
-                                            if (psave) cd_save_entry(upper, base);
-                                            cd_fix_prev(upper, &archive, base);
-                                        }
-                                        if (upper != entry) free(upper);
-                                    } else {
-                                        errors = true;
-                                        printf("[error] parent not found: \"%s\"\n", path);
-                                    }
-                                }
-                                if (errors) printf("[warning] indexed with errors: \"%s\"\n", file->d_name);
-                                plugin->close(handle);
-                                entry->type = CD_ARC;
-                            } else {
-                                if (!plugin->ignore_errors) printf("[error] could not open archive: \"%s\"\n", file->d_name);
-                            }
-                            if (plugin->finish) plugin->finish(arc);
-                        } else {
-                            printf("[error] init failed: %s\n", plugin->name);
-                        }
-                    }
+static void cd_extract_run(void* data) {
+    cd_extract_job* job = (cd_extract_job*)data;
+    cd_offset info = cd_extract(job->extractor, job->file, &job->entry, job->base);
+    if (info && job->base->pool) {
+        cd_pool_report(job->base->pool, job->entry.id, info);
+    } else if (info) {
+        cd_save_info(job->entry.id, info, job->base);
+    }
+    free(job->file);
+    free(job);
+}
 
-                }
-                if (prev) {
-                    prev->next = entry->id;
-                    cd_save_entry(prev, base);
-                    free(prev);
-                }
-                prev = entry;
+static void cd_archive_run(void* data) {
+    cd_archive_job* job = (cd_archive_job*)data;
+    cd_index_cached(job->file, &job->root, job->plugin, &job->offset, job->base);
+}
+
+static void cd_splice_archive(cd_archives* archives, cd_file_entry* entry, cd_offset* offset, cd_base* base) {
+    cd_archive_job* job = archives->first;
+    while (archives->queued && (archives->ahead < base->pool->count * CD_AHEAD_JOBS)) {
+        archives->queued->base->cache = base->cache;
+        archives->queued->base->stats = base->stats;
+        cd_pool_submit(base->pool, cd_archive_run, archives->queued, &archives->queued->done);
+        archives->queued = archives->queued->next;
+        archives->ahead++;
+    }
+    cd_pool_sync(base->pool, &job->done);
+    archives->first = job->next;
+    archives->ahead--;
+    cd_copy_members(job->base->tree, job->base->slinks_fd, 1, job->offset - 1, job->root.child, entry, offset, base);
+    entry->type = job->root.type;
+    job->base->cache = NULL;
+    cd_base_close(job->base);
+    free(job->file);
+    free(job);
+}
+
+// Drops the first archive, which the walk went past without splicing it
+static void cd_discard_archive(cd_archives* archives, cd_base* base) {
+    cd_archive_job* job = archives->first;
+    if (job == archives->queued) {
+        archives->queued = job->next;
+    } else {
+        // Workers may still be writing its base
+        cd_pool_sync(base->pool, &job->done);
+        archives->ahead--;
+    }
+    archives->first = job->next;
+    job->base->cache = NULL;
+    cd_base_close(job->base);
+    free(job->file);
+    free(job);
+}
+
+// Looks the archive up by path, dropping those before it, returns 0 if it was not collected
+static int cd_reach_archive(cd_archives* archives, const char* file, cd_base* base) {
+    cd_archive_job* job;
+    for (job = archives->first; job && strcmp(job->file, file); job = job->next);
+    if (!job) return 0;
+    while (archives->first != job) cd_discard_archive(archives, base);
+    return 1;
+}
+
+static int cd_index_unchanged(cd_file_entry* previous, cd_size size, cd_time mtime) {
+    return (previous->size == size) && (previous->mtime == mtime);
+}
+
+// Position of the file on the disc for -b, known without opening it if the tree was read from an image
+static inline cd_size cd_index_position(cd_scan_node* node, cd_archives* archives) {
+    return (archives && archives->image) ? (cd_size)node->stat.st_ino * node->stat.st_blksize : 0;
+}
+
+static void cd_collect_archives(const char* path, cd_scan_node* dir, cd_archives* archives, cd_update* update, cd_file_entry* upper) {
+    size_t length = strlen(path);
+    cd_scan_node* node;
+    cd_plugin_info* plugin;
+    cd_file_entry previous;
+    for (node = dir->child; node; node = node->next) {
+        if (!S_ISDIR(node->stat.st_mode) && !S_ISREG(node->stat.st_mode)) continue;
+        // Unchanged archives will be copied from the previous index
+        int found = update && cd_update_lookup(update, (upper) ? upper->id : 0, node->name, &previous);
+        if (found && S_ISREG(node->stat.st_mode) && ((previous.type == CD_REG) || (previous.type == CD_ARC)) &&
+            cd_index_unchanged(&previous, node->stat.st_size, node->stat.st_mtime)) continue;
+        char* file = (char*)malloc(length + strlen(node->name) + 2);
+        sprintf(file, (length && (path[length-1] == '/')) ? "%s%s" : "%s/%s", path, node->name);
+        if (S_ISDIR(node->stat.st_mode)) {
+            cd_collect_archives(file, node, archives, (found && (previous.type == CD_DIR)) ? update : NULL, &previous);
+            free(file);
+        } else if ((plugin = cd_find_plugin(node->name))) {
+            cd_archive_job* job = (cd_archive_job*)malloc(sizeof(cd_archive_job));
+            job->file = file;
+            job->plugin = plugin;
+            memset(&job->root, '\0', sizeof(cd_file_entry));
+            job->root.type = CD_REG;
+            job->root.size = node->stat.st_size;
+            job->offset = 1;
+            job->base = cd_base_create();
+            job->position = cd_index_position(node, archives);
+            job->done = false;
+            job->next = NULL;
+            if (archives->last) archives->last->next = job;
+            else archives->first = job;
+            archives->last = job;
+        } else {
+            free(file);
+        }
+    }
+}
+
+static void cd_index_previous(const char* name, cd_file_entry* entry, cd_file_entry* previous, cd_offset* offset, cd_base* base) {
+    cd_extractor_info* extractor = cd_find_extractor(name);
+    if (extractor && extractor->copy && previous->info) {
+        entry->info = extractor->copy(previous->info, previous->id, entry, extractor->__udata);
+    }
+    if (previous->type == CD_ARC) {
+        CD_LOG(CD_LOG_FILE, "[update] reusing archive \"%s\"\n", name);
+        // Members follow the archive, unless the index was repacked
+        cd_copy_members(base->update->tree, base->update->slinks_fd, (previous->child) ? previous->child : previous->id + 1,
+                        cd_update_count(base->update, previous->id), previous->child, entry, offset, base);
+        entry->count = previous->count;
+        entry->type = CD_ARC;
+    }
+}
+
+static void cd_index_file(const char* file, cd_size position, cd_file_entry* entry, cd_file_entry* previous, cd_offset* offset, cd_base* base, cd_archives* archives) {
+    if (entry->type == CD_LNK) {
+        cd_arena_mark mark;
+        cd_arena_mark_get(base->arena, &mark);
+        char* linkpath = (char*)cd_arena_alloc(base->arena, entry->size);
+        if (readlink(file, linkpath, entry->size) != -1) {
+            entry->info = cd_add_symlink(linkpath, entry->size, base);
+        }
+        cd_arena_release(base->arena, &mark);
+    } else if (entry->type == CD_REG) {
+        const char* name = strrchr(file, '/');
+        name = (name) ? name + 1 : file;
+
+        // Unchanged files keep their data
+        if (previous && cd_index_unchanged(previous, entry->size, entry->mtime)) {
+            cd_index_previous(name, entry, previous, offset, base);
+            return;
+        }
+
+        // Check for extractors
+        cd_extractor_info* extractor = cd_find_extractor(name);
+        if (extractor && (base->pool || base->schedule)) {
+            cd_extract_job* job = (cd_extract_job*)malloc(sizeof(cd_extract_job));
+            job->extractor = extractor;
+            job->file = strdup(file);
+            memcpy(&job->entry, entry, sizeof(cd_file_entry));
+            job->base = base;
+            if (base->schedule) {
+                // Extractors run after the walk, so that the drive reads files in order
+                cd_schedule_add(base->schedule, (position) ? position : cd_schedule_block(file), cd_extract_run, job, NULL);
             } else {
-                printf("[error] stat failed: \"%s\"\n", file->d_name);
+                cd_pool_submit(base->pool, cd_extract_run, job, NULL);
             }
+        } else if (extractor) {
+            entry->info = cd_extract(extractor, file, entry, base);
+        }
+
+        // Check for plugins
+        cd_plugin_info* plugin = cd_find_plugin(name);
+        if (plugin) {
+            if (archives && cd_reach_archive(archives, file, base)) {
+                cd_splice_archive(archives, entry, offset, base);
+            } else {
+                cd_index_cached(file, entry, plugin, offset, base);
+            }
+        }
+    }
+}
+
+static void cd_index_dir(cd_dir* dir, const char* path, cd_file_entry* parent, cd_offset* offset, cd_base* base);
+
+// Entries of a directory take turns in two slots: the new one and the previous one, which waits for its next
+static inline cd_file_entry* cd_index_slot(cd_file_entry* slots, cd_file_entry* prev) {
+    return (prev == &slots[0]) ? &slots[1] : &slots[0];
+}
+
+static cd_file_entry* cd_index_node(const char* name, struct stat64* stat, cd_dir* dir, cd_dir* sub, const char* path, cd_file_entry* parent, cd_file_entry* prev, cd_file_entry* slots, cd_offset* offset, cd_base* base) {
+    cd_dir opened;
+    if (!S_ISDIR(stat->st_mode) &&
+        !S_ISREG(stat->st_mode) &&
+        !S_ISLNK(stat->st_mode)) {
+        DEBUG_OUTPUT(DEBUG_INDEX, "skipping \"%s\" (mode:%06o)\n", name, stat->st_mode);
+        if (sub) cd_dir_close(sub);
+        return prev;
+    }
+    // Released by the caller after the node is done
+    char* file = cd_arena_path(base->arena, path, name);
+    cd_file_entry* entry = cd_create_entry(name, stat, cd_index_slot(slots, prev), parent, offset);
+    cd_file_entry previous;
+    int found = (base->update) ? cd_update_find(base->update, parent, entry, &previous) : false;
+    if ((entry->type == CD_DIR) && base->journal && cd_journal_skip(base->journal, entry, offset)) {
+        CD_LOG(CD_LOG_FILE, "[resume] skipping \"%s\"\n", name);
+        if (sub) cd_dir_close(sub);
+    } else if (entry->type == CD_DIR) {
+        CD_LOG(CD_LOG_FILE, "[dir] indexing \"%s\"...\n", name);
+        if (!sub && cd_dir_open(&opened, dir->fd, name)) sub = &opened;
+        if (sub) {
+            cd_index_dir(sub, file, entry, offset, base);
+            cd_dir_close(sub);
+        } else {
+            CD_LOG(CD_LOG_ERROR, "[error] opendir failed: \"%s\"\n", name);
+        }
+        if (base->journal) cd_journal_done_dir(base->journal, entry, *offset);
+    } else {
+        cd_index_file(file, 0, entry, (found) ? &previous : NULL, offset, base, NULL);
+    }
+    if (prev) {
+        prev->next = entry->id;
+        cd_save_entry(prev, base);
+    }
+    return entry;
+}
+
+static cd_update_list* cd_index_listed(cd_file_entry* parent, cd_update_list* list, cd_base* base) {
+    // Directories that did not change are listed from the previous index
+    if (base->update && parent && cd_update_list_open(base->update, parent, list)) {
+        DEBUG_OUTPUT(DEBUG_INDEX, "listing \"%s\" from the previous index\n", parent->name);
+        return list;
+    }
+    return NULL;
+}
+
+static const char* cd_index_read(cd_dir* dir, unsigned char* type, cd_update_list* list, cd_base* base) {
+    if (list) {
+        *type = DT_UNKNOWN;
+        return cd_update_list_read(base->update, list);
+    }
+    return cd_dir_read(dir, type);
+}
+
+static void cd_index_batch(cd_dir* dir, const char* path, cd_file_entry* parent, cd_offset* offset, cd_base* base) {
+    unsigned int i;
+    const char* name;
+    unsigned char type;
+    unsigned int count = 0;
+    unsigned int size = CD_BATCH_SIZE;
+    cd_file_entry* prev = NULL;
+    cd_arena_mark scope, mark;
+    cd_update_list listed;
+    cd_update_list* list = cd_index_listed(parent, &listed, base);
+    cd_arena_mark_get(base->arena, &scope);
+    cd_file_entry* slots = (cd_file_entry*)cd_arena_alloc(base->arena, 2 * sizeof(cd_file_entry));
+    char** names = (char**)malloc(size * sizeof(char*));
+    // Read the whole directory, so that all stats go to the ring at once
+    while ((name = cd_index_read(dir, &type, list, base))) {
+        if ((type != DT_UNKNOWN) && (type != DT_DIR) && (type != DT_REG) && (type != DT_LNK)) {
+            DEBUG_OUTPUT(DEBUG_INDEX, "skipping \"%s\" (type:%03d)\n", name, type);
+            continue;
+        }
+        if (count == size) {
+            size *= 2;
+            names = (char**)realloc(names, size * sizeof(char*));
+        }
+        names[count++] = cd_arena_strdup(base->arena, name);
+    }
+    if (dir->bytes == -1) CD_LOG(CD_LOG_ERROR, "[error] readdir failed: \"%s\"\n", path);
+    struct stat64* stats = (struct stat64*)cd_arena_alloc(base->arena, count * sizeof(struct stat64));
+    int* results = (int*)cd_arena_alloc(base->arena, count * sizeof(int));
+    cd_arena_mark_get(base->arena, &mark);
+    uint64_t start = (base->stats) ? cd_stats_now() : 0;
+    unsigned int entries = base->uring->entries;
+    if (!cd_uring_stat(base->uring, dir->fd, (const char**)names, stats, results, count)) {
+        CD_LOG(CD_LOG_WARNING, "[warning] io_uring failed, using plain stat\n");
+        cd_uring_free(base->uring);
+        base->uring = NULL;
+    }
+    if (base->stats) cd_stats_add(base->stats->stat, start, count, 0, (count + entries - 1) / entries);
+    for (i = 0; i < count; i++) {
+        if (results[i] != -1) {
+            prev = cd_index_node(names[i], &stats[i], dir, NULL, path, parent, prev, slots, offset, base);
+            cd_arena_release(base->arena, &mark);
+        } else {
+            CD_LOG(CD_LOG_ERROR, "[error] stat failed: \"%s\"\n", names[i]);
+        }
+    }
+    if (prev) cd_save_entry(prev, base);
+    cd_arena_release(base->arena, &scope);
+    free(names);
+}
+
+static int cd_index_stat(int dirfd, const char* name, int flags, struct stat64* stat, cd_base* base) {
+    if (!base->stats) return cd_scan_stat(dirfd, name, flags, stat);
+    uint64_t start = cd_stats_now();
+    int result = cd_scan_stat(dirfd, name, flags, stat);
+    cd_stats_add(base->stats->stat, start, 1, 0, 1);
+    return result;
+}
+
+static void cd_index_dir(cd_dir* dir, const char* path, cd_file_entry* parent, cd_offset* offset, cd_base* base) {
+    int result;
+    cd_dir sub;
+    int opened;
+    const char* name;
+    unsigned char type;
+    struct stat64 stat;
+    cd_file_entry* prev = NULL;
+    cd_file_entry* slots;
+    cd_arena_mark scope, mark;
+    cd_update_list listed;
+    cd_update_list* list;
+    if (base->uring) {
+        cd_index_batch(dir, path, parent, offset, base);
+        return;
+    }
+    list = cd_index_listed(parent, &listed, base);
+    cd_arena_mark_get(base->arena, &scope);
+    slots = (cd_file_entry*)cd_arena_alloc(base->arena, 2 * sizeof(cd_file_entry));
+    cd_arena_mark_get(base->arena, &mark);
+    while ((name = cd_index_read(dir, &type, list, base))) {
+        opened = false;
+        if (type == DT_DIR) {
+            // No need to look the name up twice, stat the opened directory
+            opened = cd_dir_open(&sub, dir->fd, name);
+            result = (opened) ? cd_index_stat(sub.fd, "", AT_EMPTY_PATH, &stat, base) : cd_index_stat(dir->fd, name, 0, &stat, base);
+        } else if ((type == DT_UNKNOWN) || (type == DT_REG) || (type == DT_LNK)) {
+            result = cd_index_stat(dir->fd, name, 0, &stat, base);
+        } else {
+            DEBUG_OUTPUT(DEBUG_INDEX, "skipping \"%s\" (type:%03d)\n", name, type);
+            continue;
+        }
+        if (result == -1) {
+            CD_LOG(CD_LOG_ERROR, "[error] stat failed: \"%s\"\n", name);
+            if (opened) cd_dir_close(&sub);
+            continue;
         }
+        prev = cd_index_node(name, &stat, dir, (opened) ? &sub : NULL, path, parent, prev, slots, offset, base);
+        cd_arena_release(base->arena, &mark);
+    }
+    if (dir->bytes == -1) CD_LOG(CD_LOG_ERROR, "[error] readdir failed: \"%s\"\n", path);
+    if (prev) cd_save_entry(prev, base);
+    cd_arena_release(base->arena, &scope);
+}
+
+void cd_index(const char* path, cd_file_entry* parent, cd_offset* offset, cd_base* base) {
+    cd_dir dir;
+    if (cd_dir_open(&dir, AT_FDCWD, path)) {
+        cd_index_dir(&dir, path, parent, offset, base);
+        cd_dir_close(&dir);
+    } else {
+        CD_LOG(CD_LOG_ERROR, "[error] opendir failed: \"%s\"\n", path);
+    }
+}
+
+static void cd_extract_streamed(void* data, const char* file) {
+    cd_extract_job* job = (cd_extract_job*)data;
+    if (file) {
+        job->file = strdup(file);
+        cd_extract_run(job);
+    } else {
+        CD_LOG(CD_LOG_WARNING, "[warning] no data to extract: \"%.*s\"\n", CD_NAME_MAX, job->entry.name);
+        free(job);
+    }
+}
+
+static void cd_index_streamed(cd_scan_node* node, cd_file_entry* entry, cd_offset* offset, cd_base* base) {
+    if ((entry->type != CD_REG) || !node->stat.st_ino) return;
+    off_t position = (off_t)node->stat.st_ino * node->stat.st_blksize;
+
+    // Extractors get the data when the read of the device passes it
+    cd_extractor_info* extractor = cd_find_extractor(node->name);
+    if (extractor) {
+        cd_extract_job* job = (cd_extract_job*)malloc(sizeof(cd_extract_job));
+        job->extractor = extractor;
+        job->file = NULL;
+        memcpy(&job->entry, entry, sizeof(cd_file_entry));
+        job->base = base;
+        cd_stream_add(base->stream, position, entry->size, node->name, cd_extract_streamed, job);
+    }
+
+    // Members are numbered right after the archive, so it is read right away
+    cd_plugin_info* plugin = cd_find_plugin(node->name);
+    if (plugin) {
+        char* file = cd_stream_copy(base->stream, position, entry->size, node->name);
+        if (file) {
+            cd_index_cached(file, entry, plugin, offset, base);
+            unlink(file);
+            free(file);
+        }
+    }
+}
+
+static void cd_index_tree(const char* path, cd_scan_node* dir, cd_file_entry* parent, cd_offset* offset, cd_base* base, cd_archives* archives) {
+    cd_scan_node* node;
+    cd_file_entry* prev = NULL;
+    cd_arena_mark scope, mark;
+    cd_arena_mark_get(base->arena, &scope);
+    cd_file_entry* slots = (cd_file_entry*)cd_arena_alloc(base->arena, 2 * sizeof(cd_file_entry));
+    cd_arena_mark_get(base->arena, &mark);
+    for (node = dir->child; node; node = node->next) {
+        if (!node->stat.st_mode) continue; // Failed to stat
+        // Trees read from an image have no files to open, unless it is mounted too
+        char* file = (path) ? cd_arena_path(base->arena, path, node->name) : NULL;
+        cd_file_entry* entry = cd_create_entry(node->name, &node->stat, cd_index_slot(slots, prev), parent, offset);
+        cd_file_entry previous;
+        int found = (base->update) ? cd_update_find(base->update, parent, entry, &previous) : false;
+        if ((entry->type == CD_DIR) && base->journal && cd_journal_skip(base->journal, entry, offset)) {
+            CD_LOG(CD_LOG_FILE, "[resume] skipping \"%s\"\n", node->name);
+        } else if (entry->type == CD_DIR) {
+            CD_LOG(CD_LOG_FILE, "[dir] indexing \"%s\"...\n", node->name);
+            cd_index_tree(file, node, entry, offset, base, archives);
+            if (base->journal) cd_journal_done_dir(base->journal, entry, *offset);
+        } else if (node->link) {
+            entry->info = cd_add_symlink(node->link, entry->size, base);
+        } else if (file) {
+            cd_index_file(file, cd_index_position(node, archives), entry, (found) ? &previous : NULL, offset, base, archives);
+        } else if (found && cd_index_unchanged(&previous, entry->size, entry->mtime)) {
+            cd_index_previous(node->name, entry, &previous, offset, base);
+        } else if (base->stream) {
+            cd_index_streamed(node, entry, offset, base);
+        }
+        cd_arena_release(base->arena, &mark);
         if (prev) {
+            prev->next = entry->id;
             cd_save_entry(prev, base);
-            free(prev);
         }
-        chdir("..");
-        closedir(dir);
-    } else {
-        printf("[error] opendir failed: \"%s\"\n", path);
+        prev = entry;
+    }
+    if (prev) cd_save_entry(prev, base);
+    cd_arena_release(base->arena, &scope);
+}
+
+static void cd_index_walk(const char* path, cd_scan_node* dir, cd_file_entry* parent, cd_offset* offset, cd_base* base, int image) {
+    cd_archives archives;
+    memset(&archives, '\0', sizeof(cd_archives));
+    archives.image = image;
+    // Archives are known in advance, so workers can ingest them ahead of the walk
+    if (base->pool) {
+        cd_collect_archives(path, dir, &archives, base->update, NULL);
+        archives.queued = archives.first;
+    }
+    // All archives go to workers at once, ordered by their position on the disc
+    if (base->pool && base->schedule) {
+        cd_archive_job* job;
+        for (job = archives.first; job; job = job->next) {
+            job->base->cache = base->cache;
+            job->base->stats = base->stats;
+            cd_schedule_add(base->schedule, (job->position) ? job->position : cd_schedule_block(job->file), cd_archive_run, job, &job->done);
+        }
+        cd_schedule_run(base->schedule, base->pool);
+        archives.queued = NULL;
+    }
+    cd_index_tree(path, dir, parent, offset, base, &archives);
+    while (archives.first) cd_discard_archive(&archives, base);
+}
+
+void cd_index_scanned(const char* path, cd_scan_node* dir, cd_file_entry* parent, cd_offset* offset, cd_base* base) {
+    cd_index_walk(path, dir, parent, offset, base, false);
+}
+
+void cd_index_image(const char* device, const char* path, cd_file_entry* parent, cd_offset* offset, cd_base* base) {
+    cd_stats_io io;
+    uint64_t start = 0;
+    if (base->stats) {
+        cd_stats_io_read(&io);
+        start = cd_stats_now();
+    }
+    cd_scan_node* root = cd_iso_scan(device);
+    if (base->stats) cd_stats_add_io(cd_stats_stage(base->stats, "iso", NULL), start, &io);
+    if (root) {
+        if (path) cd_index_walk(path, root, parent, offset, base, true);
+        else cd_index_tree(NULL, root, parent, offset, base, NULL);
+        cd_scan_free(root);
+    }
+}
+
+static void cd_repack_file(cd_file_entry* previous, cd_file_entry* entry, cd_base* base) {
+    if ((previous->type == CD_LNK) && previous->size && previous->info) {
+        cd_arena_mark mark;
+        cd_arena_mark_get(base->arena, &mark);
+        char* linkpath = (char*)cd_arena_alloc(base->arena, previous->size);
+        if (pread(base->update->slinks_fd, linkpath, previous->size, previous->info) == previous->size) {
+            entry->info = cd_add_symlink(linkpath, previous->size, base);
+        }
+        cd_arena_release(base->arena, &mark);
+    } else if (previous->info) {
+        cd_extractor_info* extractor = cd_find_extractor(previous->name);
+        if (extractor && extractor->copy) {
+            entry->info = extractor->copy(previous->info, previous->id, entry, extractor->__udata);
+        }
+    }
+}
+
+// Files of the directory get IDs one after another, before any of their children
+static void cd_repack_dir(cd_offset first, cd_file_entry* parent, cd_offset* offset, cd_base* base) {
+    cd_offset id, i, count = 0;
+    cd_offset size = 16;
+    cd_offset* heap = (cd_offset*)malloc(size * sizeof(cd_offset));
+    cd_file_entry previous;
+    cd_file_entry entry;
+    for (id = first; id && cd_tree_load(base->update->tree, id, &previous); id = previous.next) {
+        if (count == size) {
+            size *= 2;
+            heap = (cd_offset*)realloc(heap, size * sizeof(cd_offset));
+        }
+        // Names of the directory follow each other too, unless they were seen before
+        heap[count++] = (base->tree) ? 0 : cd_save_name(&previous, base);
+    }
+    cd_offset run = *offset;
+    *offset += count;
+    if (parent) {
+        parent->child = (count) ? run : 0;
+        parent->count = count;
+    }
+    for (id = first, i = 0; i < count; id = previous.next, i++) {
+        if (!cd_tree_load(base->update->tree, id, &previous)) break;
+        memcpy(&entry, &previous, sizeof(cd_file_entry));
+        entry.id = run + i;
+        entry.parent = (parent) ? parent->id : 0;
+        entry.next = (i + 1 < count) ? entry.id + 1 : 0;
+        entry.info = 0;
+        entry.child = 0;
+        entry.count = 0;
+        entry.heap = heap[i];
+        cd_repack_file(&previous, &entry, base);
+        if (previous.child) cd_repack_dir(previous.child, &entry, offset, base);
+        cd_save_entry(&entry, base);
+    }
+    free(heap);
+}
+
+void cd_repack(cd_offset* offset, cd_base* base) {
+    if (!base->update) return;
+    write(base->base_fd, &base->update->header, sizeof(cd_iso_header));
+    cd_repack_dir(1, NULL, offset, base);
+}
+
+void cd_index_wait(cd_base* base) {
+    cd_offset i;
+    if (base->stream) {
+        cd_stats_io io;
+        uint64_t start = 0;
+        if (base->stats) {
+            cd_stats_io_read(&io);
+            start = cd_stats_now();
+        }
+        cd_stream_run(base->stream, base->pool);
+        if (base->stats) cd_stats_add_io(cd_stats_stage(base->stats, "stream", NULL), start, &io);
+    }
+    if (base->schedule) cd_schedule_run(base->schedule, base->pool);
+    if (base->pool) {
+        cd_pool_wait(base->pool);
+        // All records are final by now, so just patch their info
+        for (i = 0; i < base->pool->done; i++) {
+            cd_save_info(base->pool->results[i].id, base->pool->results[i].info, base);
+        }
+        cd_pool_free(base->pool);
+        base->pool = NULL;
     }
 }
 
@@ -402,6 +1113,6 @@ void cd_header(const char* device, cd_base* base) {
         write(base->base_fd, &header, sizeof(cd_iso_header));
         close(fd);
     } else {
-        printf("[error] failed to open: \"%s\"\n", device);
+        CD_LOG(CD_LOG_ERROR, "[error] failed to open: \"%s\"\n", device);
     }
 }
@@ -7,9 +7,19 @@
 
 #include "data.h"
 #include "base.h"
+#include "scan.h"
 
 void cd_index(const char* path, cd_file_entry* parent, cd_offset* offset, cd_base* base);
 
+void cd_index_scanned(const char* path, cd_scan_node* dir, cd_file_entry* parent, cd_offset* offset, cd_base* base);
+
+void cd_index_image(const char* device, const char* path, cd_file_entry* parent, cd_offset* offset, cd_base* base);
+
+// Rewrites the previous index, so that files of each directory are stored one after another
+void cd_repack(cd_offset* offset, cd_base* base);
+
+void cd_index_wait(cd_base* base);
+
 void cd_header(const char* device, cd_base* base);
 
 void cd_fix_string(char* string, int length);
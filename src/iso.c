@@ -0,0 +1,473 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <linux/iso_fs.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "cdindex.h"
+#include "data.h"
+#include "hash.h"
+#include "iso.h"
+
+#define CD_ISO_DIR_MAX      0x4000000   // Larger directories or path tables are corrupt
+#define CD_ISO_MODE         0555        // What isofs shows without Rock Ridge
+
+#define CD_NM_CURRENT       0x02
+#define CD_NM_PARENT        0x04
+
+#define CD_SL_CONTINUE      0x01
+#define CD_SL_CURRENT       0x02
+#define CD_SL_PARENT        0x04
+#define CD_SL_ROOT          0x08
+
+#define CD_TF_CREATE        0x01
+#define CD_TF_MODIFY        0x02
+#define CD_TF_LONG_FORM     0x80
+
+#define CD_ISO_SEEN         ((cd_offset)-1) // Directory read outside of the path table
+
+typedef struct {
+    char name[CD_NAME_MAX+1];
+    size_t name_length;
+    char* link;
+    size_t link_length;
+    int link_continue;      // Last component continues in the next one
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    int attributes;         // Got PX
+    time_t mtime;
+    int timed;              // Got modification time in TF
+    uint32_t child;         // CL, where the relocated directory is
+    int relocated;          // RE, shown where CL points to
+} cd_iso_susp;
+
+static inline uint32_t cd_iso_731(const void* data) {
+    const unsigned char* p = (const unsigned char*)data;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint16_t cd_iso_721(const void* data) {
+    const unsigned char* p = (const unsigned char*)data;
+    return p[0] | (p[1] << 8);
+}
+
+static int cd_iso_read(cd_iso* iso, uint32_t block, size_t length, void* buf) {
+    return (pread(iso->fd, buf, length, (off_t)block * iso->block) == (ssize_t)length);
+}
+
+static time_t cd_iso_time(const unsigned char* date) {
+    struct tm tm;
+    memset(&tm, '\0', sizeof(struct tm));
+    tm.tm_year = date[0];
+    tm.tm_mon  = date[1] - 1;
+    tm.tm_mday = date[2];
+    tm.tm_hour = date[3];
+    tm.tm_min  = date[4];
+    tm.tm_sec  = date[5];
+    // Offset from GMT is in 15 minute intervals
+    return timegm(&tm) - (signed char)date[6] * 15 * 60;
+}
+
+static time_t cd_iso_long_time(const unsigned char* date) {
+    struct tm tm;
+    memset(&tm, '\0', sizeof(struct tm));
+    if (sscanf((const char*)date, "%04d%02d%02d%02d%02d%02d",
+        &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+        &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) return 0;
+    tm.tm_year -= 1900;
+    tm.tm_mon--;
+    return timegm(&tm) - (signed char)date[16] * 15 * 60;
+}
+
+static void cd_iso_append(cd_iso_susp* susp, const void* data, size_t length) {
+    susp->link = (char*)realloc(susp->link, susp->link_length + length + 1);
+    memcpy(&susp->link[susp->link_length], data, length);
+    susp->link_length += length;
+    susp->link[susp->link_length] = '\0';
+}
+
+static void cd_iso_parse_link(cd_iso_susp* susp, const unsigned char* data, unsigned int length) {
+    unsigned int size;
+    while (length >= 2) {
+        size = data[1];
+        if (2 + size > length) break;
+        if (susp->link_length && !susp->link_continue && (susp->link[susp->link_length-1] != '/')) {
+            cd_iso_append(susp, "/", 1);
+        }
+        if (data[0] & CD_SL_ROOT) cd_iso_append(susp, "/", 1);
+        else if (data[0] & CD_SL_PARENT) cd_iso_append(susp, "..", 2);
+        else if (data[0] & CD_SL_CURRENT) cd_iso_append(susp, ".", 1);
+        else cd_iso_append(susp, &data[2], size);
+        susp->link_continue = data[0] & CD_SL_CONTINUE;
+        data += 2 + size;
+        length -= 2 + size;
+    }
+}
+
+static void cd_iso_parse_susp(cd_iso* iso, const unsigned char* area, unsigned int length, cd_iso_susp* susp, int depth) {
+    unsigned int size;
+    uint32_t ce_block = 0, ce_offset = 0, ce_length = 0;
+    while (length >= 4) {
+        size = area[2];
+        if ((size < 4) || (size > length)) break;
+        if (!memcmp(area, "PX", 2) && (size >= 36)) {
+            susp->mode = cd_iso_731(&area[4]);
+            susp->uid = cd_iso_731(&area[20]);
+            susp->gid = cd_iso_731(&area[28]);
+            susp->attributes = 1;
+        } else if (!memcmp(area, "NM", 2) && (size >= 5)) {
+            if (!(area[4] & (CD_NM_CURRENT|CD_NM_PARENT))) {
+                unsigned int part = size - 5;
+                if (susp->name_length + part > CD_NAME_MAX) part = CD_NAME_MAX - susp->name_length;
+                memcpy(&susp->name[susp->name_length], &area[5], part);
+                susp->name_length += part;
+                susp->name[susp->name_length] = '\0';
+            }
+        } else if (!memcmp(area, "SL", 2) && (size >= 5)) {
+            cd_iso_parse_link(susp, &area[5], size - 5);
+        } else if (!memcmp(area, "TF", 2) && (size >= 5)) {
+            unsigned int stamp = (area[4] & CD_TF_LONG_FORM) ? 17 : 7;
+            const unsigned char* time = &area[5];
+            if (area[4] & CD_TF_CREATE) time += stamp;
+            if ((area[4] & CD_TF_MODIFY) && (time + stamp <= area + size)) {
+                susp->mtime = (stamp == 17) ? cd_iso_long_time(time) : cd_iso_time(time);
+                susp->timed = 1;
+            }
+        } else if (!memcmp(area, "CL", 2) && (size >= 12)) {
+            susp->child = cd_iso_731(&area[4]);
+        } else if (!memcmp(area, "RE", 2)) {
+            susp->relocated = 1;
+        } else if (!memcmp(area, "CE", 2) && (size >= 28)) {
+            ce_block = cd_iso_731(&area[4]);
+            ce_offset = cd_iso_731(&area[12]);
+            ce_length = cd_iso_731(&area[20]);
+        } else if (!memcmp(area, "ST", 2)) {
+            break;
+        }
+        area += size;
+        length -= size;
+    }
+    // Continuation area follows the entries of this one
+    if (ce_length && (ce_length <= iso->block) && (ce_offset < iso->block) && (depth < CD_ISO_CE_DEPTH)) {
+        size_t blocks = (ce_offset + ce_length + iso->block - 1) / iso->block;
+        unsigned char* buf = (unsigned char*)malloc(blocks * iso->block);
+        if (cd_iso_read(iso, ce_block, blocks * iso->block, buf)) {
+            cd_iso_parse_susp(iso, &buf[ce_offset], ce_length, susp, depth + 1);
+        }
+        free(buf);
+    }
+}
+
+static void cd_iso_name(cd_iso* iso, const unsigned char* id, unsigned int length, char* name) {
+    unsigned int i, c;
+    size_t j = 0;
+    if (iso->joliet) {
+        for (i = 0; i + 1 < length; i += 2) {
+            c = (id[i] << 8) | id[i+1];
+            if (c < 0x80) {
+                if (j + 1 > CD_NAME_MAX) break;
+                name[j++] = c;
+            } else if (c < 0x800) {
+                if (j + 2 > CD_NAME_MAX) break;
+                name[j++] = 0xC0 | (c >> 6);
+                name[j++] = 0x80 | (c & 0x3F);
+            } else {
+                if (j + 3 > CD_NAME_MAX) break;
+                name[j++] = 0xE0 | (c >> 12);
+                name[j++] = 0x80 | ((c >> 6) & 0x3F);
+                name[j++] = 0x80 | (c & 0x3F);
+            }
+        }
+        if ((j > 2) && (name[j-2] == ';') && (name[j-1] == '1')) j -= 2;
+        while ((j >= 2) && (name[j-1] == '.')) j--;
+    } else {
+        // Same as isofs with map=normal
+        for (i = 0; (i < length) && (j < CD_NAME_MAX); i++) name[j++] = tolower(id[i]);
+        if ((j > 2) && (name[j-2] == ';') && (name[j-1] == '1')) {
+            j -= 2;
+            if ((j > 1) && (name[j-1] == '.')) j--;
+        }
+        for (i = 0; i < j; i++) {
+            if (name[i] == ';') name[i] = '.';
+        }
+    }
+    name[j] = '\0';
+}
+
+static cd_scan_node* cd_iso_dir(cd_iso* iso, uint32_t extent) {
+    uint32_t size, pos, length, data;
+    uint32_t following = 0;     // Block after the previous part of a file
+    unsigned int area;
+    char name[CD_NAME_MAX+1];
+    cd_iso_susp susp;
+    cd_scan_node* node;
+    cd_scan_node* first = NULL;
+    cd_scan_node* last = NULL;
+    int multi = 0;
+    unsigned char* buf = (unsigned char*)malloc(iso->block);
+    struct iso_directory_record* record = (struct iso_directory_record*)buf;
+    if (!cd_iso_read(iso, extent, iso->block, buf)) {
+        CD_LOG(CD_LOG_ERROR, "[error] failed to read directory at block %u\n", extent);
+        free(buf);
+        return NULL;
+    }
+    // The "." record tells the size of the whole directory
+    size = cd_iso_731(record->size);
+    if (size > CD_ISO_DIR_MAX) {
+        CD_LOG(CD_LOG_ERROR, "[error] invalid directory at block %u\n", extent);
+        free(buf);
+        return NULL;
+    }
+    if (size > iso->block) {
+        size = (size + iso->block - 1) / iso->block * iso->block;
+        buf = (unsigned char*)realloc(buf, size);
+        if (!cd_iso_read(iso, extent + 1, size - iso->block, &buf[iso->block])) {
+            CD_LOG(CD_LOG_ERROR, "[error] failed to read directory at block %u\n", extent);
+            free(buf);
+            return NULL;
+        }
+    } else {
+        size = iso->block;
+    }
+    for (pos = 0; pos < size; pos += length) {
+        record = (struct iso_directory_record*)&buf[pos];
+        length = record->length[0];
+        if (length == 0) {
+            // Records do not cross blocks, the rest of the block is padding
+            length = iso->block - pos % iso->block;
+            continue;
+        }
+        if ((length < sizeof(struct iso_directory_record)) || (pos + length > size) ||
+            (sizeof(struct iso_directory_record) + record->name_len[0] > length)) break;
+        if ((record->name_len[0] == 1) && ((unsigned char)record->name[0] <= 1)) continue; // "." and ".."
+        if (record->flags[0] & 0x04) continue; // Associated file, hidden by isofs
+        memset(&susp, '\0', sizeof(cd_iso_susp));
+        if (iso->rockridge) {
+            area = sizeof(struct iso_directory_record) + record->name_len[0] + !(record->name_len[0] & 1) + iso->skip;
+            if (area < length) cd_iso_parse_susp(iso, &buf[pos + area], length - area, &susp, 0);
+        }
+        if (susp.relocated) {
+            free(susp.link);
+            continue;
+        }
+        if (susp.name_length) strcpy(name, susp.name);
+        else cd_iso_name(iso, (const unsigned char*)record->name, record->name_len[0], name);
+        // Parts of a large file come as records with the same name
+        data = cd_iso_731(record->size);
+        if (multi && last && !strcmp(last->name, name)) {
+            last->stat.st_size += data;
+            if (cd_iso_731(record->extent) != following) last->stat.st_ino = 0;
+            following = cd_iso_731(record->extent) + (data + iso->block - 1) / iso->block;
+            multi = record->flags[0] & 0x80;
+            free(susp.link);
+            continue;
+        }
+        multi = record->flags[0] & 0x80;
+        node = (cd_scan_node*)malloc(sizeof(cd_scan_node));
+        memset(&node->stat, '\0', sizeof(struct stat64));
+        if (susp.attributes) {
+            node->stat.st_mode = susp.mode;
+            node->stat.st_uid = susp.uid;
+            node->stat.st_gid = susp.gid;
+        } else {
+            node->stat.st_mode = ((record->flags[0] & 0x02) ? S_IFDIR : S_IFREG) | CD_ISO_MODE;
+        }
+        if (susp.child) node->stat.st_mode = (node->stat.st_mode & ~S_IFMT) | S_IFDIR;
+        if (!S_ISDIR(node->stat.st_mode) &&
+            !S_ISREG(node->stat.st_mode) &&
+            !S_ISLNK(node->stat.st_mode)) {
+            DEBUG_OUTPUT(DEBUG_INDEX, "skipping \"%s\" (mode:%06o)\n", name, node->stat.st_mode);
+            free(susp.link);
+            free(node);
+            continue;
+        }
+        node->stat.st_mtime = (susp.timed) ? susp.mtime : cd_iso_time(record->date);
+        if (S_ISLNK(node->stat.st_mode)) {
+            node->link = (susp.link) ? susp.link : strdup("");
+            node->stat.st_size = susp.link_length;
+        } else {
+            free(susp.link);
+            node->link = NULL;
+            node->stat.st_size = data;
+        }
+        // Directories are linked to their listings by the extent, files are read by it
+        node->stat.st_ino = (susp.child) ? susp.child : cd_iso_731(record->extent);
+        node->stat.st_blksize = iso->block;
+        following = node->stat.st_ino + (data + iso->block - 1) / iso->block;
+        // Interleaved files are not contiguous
+        if (!S_ISDIR(node->stat.st_mode) && (record->file_unit_size[0] || record->interleave[0])) node->stat.st_ino = 0;
+        node->name = strdup(name);
+        node->child = NULL;
+        node->next = NULL;
+        if (last) last->next = node;
+        else first = node;
+        last = node;
+    }
+    free(buf);
+    return first;
+}
+
+static int cd_iso_compare(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t* cd_iso_path_table(cd_iso* iso, struct iso_primary_descriptor* pd, unsigned int* count) {
+    uint32_t size = cd_iso_731(pd->path_table_size);
+    uint32_t pos, i, j;
+    unsigned int length;
+    struct iso_path_table* record;
+    *count = 0;
+    if (!size || (size > CD_ISO_DIR_MAX)) return NULL;
+    unsigned char* buf = (unsigned char*)malloc(size);
+    if (!cd_iso_read(iso, cd_iso_731(pd->type_l_path_table), size, buf)) {
+        free(buf);
+        return NULL;
+    }
+    uint32_t* extents = (uint32_t*)malloc((size / sizeof(struct iso_path_table) + 1) * sizeof(uint32_t));
+    for (pos = 0; pos + sizeof(struct iso_path_table) <= size; pos += length) {
+        record = (struct iso_path_table*)&buf[pos];
+        length = record->name_len[0];
+        if (!length) break;
+        extents[(*count)++] = cd_iso_731(record->extent);
+        length = sizeof(struct iso_path_table) + length + (length & 1);
+    }
+    free(buf);
+    // Directories are read in the order they are on the disc
+    qsort(extents, *count, sizeof(uint32_t), cd_iso_compare);
+    for (i = 0, j = 0; i < *count; i++) {
+        if (!j || (extents[j-1] != extents[i])) extents[j++] = extents[i];
+    }
+    *count = j;
+    return extents;
+}
+
+static void cd_iso_link(cd_iso* iso, cd_iso_listing* listings, cd_hash* extents, cd_scan_node* dir) {
+    cd_scan_node* node;
+    for (node = dir->child; node; node = node->next) {
+        if (!S_ISDIR(node->stat.st_mode)) continue;
+        uint32_t extent = node->stat.st_ino;
+        cd_offset index = cd_hash_get(extents, &extent, sizeof(uint32_t));
+        if (index == CD_ISO_SEEN) continue;
+        if (index) {
+            // Listed twice means a loop
+            if (listings[index-1].used) continue;
+            listings[index-1].used = 1;
+            node->child = listings[index-1].first;
+        } else {
+            DEBUG_OUTPUT(DEBUG_INDEX, "directory \"%s\" is not in the path table\n", node->name);
+            cd_hash_set(extents, &extent, sizeof(uint32_t), CD_ISO_SEEN);
+            node->child = cd_iso_dir(iso, extent);
+        }
+        cd_iso_link(iso, listings, extents, node);
+    }
+}
+
+cd_scan_node* cd_iso_scan(const char* device) {
+    unsigned int i, count;
+    uint32_t block;
+    char buf[sizeof(struct iso_volume_descriptor)];
+    struct iso_primary_descriptor primary;
+    struct iso_primary_descriptor joliet;
+    struct iso_primary_descriptor* pd = NULL;
+    struct iso_volume_descriptor* vd = (struct iso_volume_descriptor*)buf;
+    struct iso_supplementary_descriptor* sd = (struct iso_supplementary_descriptor*)buf;
+    struct iso_directory_record* record;
+    cd_iso iso;
+    memset(&iso, '\0', sizeof(cd_iso));
+    iso.fd = open(device, O_RDONLY|O_LARGEFILE);
+    if (iso.fd == -1) {
+        CD_LOG(CD_LOG_ERROR, "[error] failed to open: \"%s\"\n", device);
+        return NULL;
+    }
+    iso.block = ISOFS_BLOCK_SIZE;
+    for (block = CD_ISO_START; cd_iso_read(&iso, block, sizeof(buf), buf); block++) {
+        if (memcmp(vd->id, ISO_STANDARD_ID, sizeof(vd->id))) break;
+        if ((unsigned char)vd->type[0] == ISO_VD_END) break;
+        else if (((unsigned char)vd->type[0] == ISO_VD_PRIMARY) && !pd) {
+            memcpy(&primary, buf, sizeof(struct iso_primary_descriptor));
+            pd = &primary;
+        } else if (((unsigned char)vd->type[0] == ISO_VD_SUPPLEMENTARY) && !iso.joliet &&
+                   (sd->escape[0] == '%') && (sd->escape[1] == '/') &&
+                   ((sd->escape[2] == '@') || (sd->escape[2] == 'C') || (sd->escape[2] == 'E'))) {
+            memcpy(&joliet, buf, sizeof(struct iso_primary_descriptor));
+            iso.joliet = 1;
+        }
+    }
+    if (!pd) {
+        CD_LOG(CD_LOG_ERROR, "[error] no ISO 9660 volume descriptor: \"%s\"\n", device);
+        close(iso.fd);
+        return NULL;
+    }
+    if (cd_iso_721(pd->logical_block_size) >= 512) iso.block = cd_iso_721(pd->logical_block_size);
+
+    // Rock Ridge is preferred over Joliet, as isofs does
+    unsigned char* root = (unsigned char*)malloc(iso.block);
+    record = (struct iso_directory_record*)pd->root_directory_record;
+    if (cd_iso_read(&iso, cd_iso_731(record->extent), iso.block, root)) {
+        record = (struct iso_directory_record*)root;
+        unsigned char* area = &root[sizeof(struct iso_directory_record) + 1];
+        if ((record->length[0] >= sizeof(struct iso_directory_record) + 8) &&
+            !memcmp(area, "SP", 2) && (area[4] == 0xBE) && (area[5] == 0xEF)) {
+            iso.rockridge = 1;
+            iso.skip = area[6];
+        }
+    }
+    free(root);
+    if (iso.rockridge) iso.joliet = 0;
+    else if (iso.joliet) pd = &joliet;
+    DEBUG_OUTPUT(DEBUG_INDEX, "reading \"%s\" (rockridge:%d, joliet:%d)\n", device, iso.rockridge, iso.joliet);
+
+    cd_iso_listing* listings = NULL;
+    uint32_t* extents = cd_iso_path_table(&iso, pd, &count);
+    cd_hash* map = cd_hash_create(count + 1);
+    if (extents) {
+        listings = (cd_iso_listing*)malloc(count * sizeof(cd_iso_listing));
+        for (i = 0; i < count; i++) {
+            listings[i].extent = extents[i];
+            listings[i].first = cd_iso_dir(&iso, extents[i]);
+            listings[i].used = 0;
+            cd_hash_set(map, &extents[i], sizeof(uint32_t), i + 1);
+        }
+        free(extents);
+    } else {
+        CD_LOG(CD_LOG_WARNING, "[warning] no path table, reading directories as found: \"%s\"\n", device);
+    }
+
+    cd_scan_node* node = (cd_scan_node*)malloc(sizeof(cd_scan_node));
+    record = (struct iso_directory_record*)pd->root_directory_record;
+    memset(&node->stat, '\0', sizeof(struct stat64));
+    node->stat.st_mode = S_IFDIR | CD_ISO_MODE;
+    node->stat.st_mtime = cd_iso_time(record->date);
+    node->stat.st_size = cd_iso_731(record->size);
+    node->stat.st_ino = cd_iso_731(record->extent);
+    node->name = strdup(device);
+    node->link = NULL;
+    node->next = NULL;
+    node->child = NULL;
+    // Root is linked like any other directory
+    cd_scan_node top;
+    memset(&top, '\0', sizeof(cd_scan_node));
+    top.child = node;
+    cd_iso_link(&iso, listings, map, &top);
+
+    for (i = 0; i < count; i++) {
+        if (!listings[i].used) cd_scan_free(listings[i].first);
+    }
+    free(listings);
+    cd_hash_free(map);
+    close(iso.fd);
+    CD_LOG(CD_LOG_INFO, "[iso] read %u directories from \"%s\"\n", count, device);
+    return node;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_ISO_H_
+#define _CD_ISO_H_
+
+#include <stdint.h>
+
+#include "scan.h"
+
+#define CD_ISO_START        16      // Block of the first volume descriptor
+#define CD_ISO_CE_DEPTH     8       // Maximum chained continuation areas
+
+typedef struct {
+    int fd;
+    unsigned int block;     // Logical block size
+    int joliet;             // Names are UCS-2
+    int rockridge;          // Names and attributes come from SUSP entries
+    unsigned int skip;      // Bytes to skip in system use areas (SP)
+} cd_iso;
+
+typedef struct {
+    uint32_t extent;        // First block of the directory
+    cd_scan_node* first;    // Entries in directory record order
+    int used;               // Already linked into the tree
+} cd_iso_listing;
+
+// Node's st_ino is the first block of its data (0 if not contiguous), st_blksize is the block size
+cd_scan_node* cd_iso_scan(const char* device);
+
+#endif /* _CD_ISO_H_ */
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cdindex.h"
+#include "journal.h"
+
+#define false   0
+#define true    1
+
+#define CD_JOURNAL_DIRS     1024    // Initial size of directories map
+#define CD_JOURNAL_PENDING  4096    // Initial size of the write buffer
+
+static size_t cd_journal_key(char* key, cd_offset id, cd_time mtime, const char* name, size_t length) {
+    memcpy(key, &id, sizeof(cd_offset));
+    memcpy(key + sizeof(cd_offset), &mtime, sizeof(cd_time));
+    memcpy(key + sizeof(cd_offset) + sizeof(cd_time), name, length);
+    return sizeof(cd_offset) + sizeof(cd_time) + length;
+}
+
+static cd_journal_sidecar* cd_journal_sidecar_get(cd_journal* journal, const char* path, int add) {
+    int i;
+    for (i = 0; i < journal->sidecars_count; i++) {
+        if (!strcmp(journal->sidecars[i].path, path)) return &journal->sidecars[i];
+    }
+    if (!add) return NULL;
+    if (journal->sidecars_count == journal->sidecars_size) {
+        journal->sidecars_size *= 2;
+        journal->sidecars = (cd_journal_sidecar*)realloc(journal->sidecars, journal->sidecars_size * sizeof(cd_journal_sidecar));
+    }
+    cd_journal_sidecar* sidecar = &journal->sidecars[journal->sidecars_count++];
+    sidecar->path = strdup(path);
+    sidecar->fd = -1;
+    sidecar->size = 0;
+    return sidecar;
+}
+
+static void cd_journal_append(cd_journal* journal, const void* data, size_t length) {
+    if (journal->pending_length + length > journal->pending_size) {
+        while (journal->pending_length + length > journal->pending_size) journal->pending_size *= 2;
+        journal->pending = (char*)realloc(journal->pending, journal->pending_size);
+    }
+    memcpy(journal->pending + journal->pending_length, data, length);
+    journal->pending_length += length;
+}
+
+// Length of the record at pos, or 0 if it is cut or broken
+static size_t cd_journal_record(const char* buf, size_t pos, size_t length) {
+    int i;
+    size_t at = pos + 1;
+    if (buf[pos] == CD_JOURNAL_DIR) {
+        cd_journal_dir dir;
+        if (at + sizeof(cd_journal_dir) > length) return 0;
+        memcpy(&dir, buf + at, sizeof(cd_journal_dir));
+        at += sizeof(cd_journal_dir) + dir.length;
+    } else if (buf[pos] == CD_JOURNAL_CHECKPOINT) {
+        cd_journal_checkpoint checkpoint;
+        cd_journal_file size;
+        if (at + sizeof(cd_journal_checkpoint) > length) return 0;
+        memcpy(&checkpoint, buf + at, sizeof(cd_journal_checkpoint));
+        at += sizeof(cd_journal_checkpoint);
+        for (i = 0; i < checkpoint.sidecars; i++) {
+            if (at + sizeof(cd_journal_file) > length) return 0;
+            memcpy(&size, buf + at, sizeof(cd_journal_file));
+            at += sizeof(cd_journal_file) + size.length;
+        }
+    } else {
+        return 0;
+    }
+    return (at <= length) ? at - pos : 0;
+}
+
+static void cd_journal_apply(cd_journal* journal, const char* buf, size_t pos) {
+    int i;
+    char key[sizeof(cd_offset) + sizeof(cd_time) + CD_NAME_MAX];
+    if (buf[pos] == CD_JOURNAL_DIR) {
+        cd_journal_dir dir;
+        memcpy(&dir, buf + pos + 1, sizeof(cd_journal_dir));
+        if (journal->count == journal->size) {
+            journal->size *= 2;
+            journal->done = (cd_journal_done*)realloc(journal->done, journal->size * sizeof(cd_journal_done));
+        }
+        journal->done[journal->count].child = dir.child;
+        journal->done[journal->count].next = dir.next;
+        journal->count++;
+        size_t length = cd_journal_key(key, dir.id, dir.mtime, buf + pos + 1 + sizeof(cd_journal_dir), dir.length);
+        cd_hash_set(journal->dirs, key, length, journal->count);
+    } else {
+        cd_journal_checkpoint checkpoint;
+        cd_journal_file size;
+        memcpy(&checkpoint, buf + pos + 1, sizeof(cd_journal_checkpoint));
+        pos += 1 + sizeof(cd_journal_checkpoint);
+        for (i = 0; i < checkpoint.sidecars; i++) {
+            memcpy(&size, buf + pos, sizeof(cd_journal_file));
+            char* path = strndup(buf + pos + sizeof(cd_journal_file), size.length);
+            cd_journal_sidecar_get(journal, path, true)->size = size.size;
+            free(path);
+            pos += sizeof(cd_journal_file) + size.length;
+        }
+        journal->next = checkpoint.next;
+    }
+}
+
+static int cd_journal_load(cd_journal* journal) {
+    int i;
+    size_t pos, length, valid = 0;
+    struct stat64 stat;
+    cd_index_mark mark;
+    journal->fd = open(journal->name, O_RDWR);
+    if (journal->fd == -1) return false;
+    if ((fstat64(journal->fd, &stat) == -1) ||
+        (read(journal->fd, &mark, sizeof(cd_index_mark)) != sizeof(cd_index_mark)) ||
+        memcmp(&mark.mark, CD_JOURNAL_MARK, CD_INDEX_MARK_LEN) || (mark.version != CD_JOURNAL_VERSION)) {
+        close(journal->fd);
+        return false;
+    }
+    char* buf = (char*)malloc(stat.st_size);
+    length = pread(journal->fd, buf, stat.st_size, 0);
+    // Only what the last complete checkpoint covers was written for sure
+    for (pos = sizeof(cd_index_mark); pos < length;) {
+        size_t record = cd_journal_record(buf, pos, length);
+        if (!record) break;
+        pos += record;
+        if (buf[pos - record] == CD_JOURNAL_CHECKPOINT) valid = pos;
+    }
+    for (pos = sizeof(cd_index_mark); pos < valid; pos += cd_journal_record(buf, pos, valid)) {
+        cd_journal_apply(journal, buf, pos);
+    }
+    free(buf);
+    // Sidecars must still have everything the checkpoint counted
+    for (i = 0; i < journal->sidecars_count; i++) {
+        if ((stat64(journal->sidecars[i].path, &stat) == -1) || (stat.st_size < journal->sidecars[i].size)) break;
+    }
+    if (!journal->next || (i < journal->sidecars_count)) {
+        close(journal->fd);
+        return false;
+    }
+    for (i = 0; i < journal->sidecars_count; i++) {
+        if (truncate(journal->sidecars[i].path, journal->sidecars[i].size) == -1) {
+            CD_LOG(CD_LOG_WARNING, "[warning] failed to truncate: \"%s\"\n", journal->sidecars[i].path);
+        }
+    }
+    ftruncate(journal->fd, valid);
+    lseek(journal->fd, valid, SEEK_SET);
+    journal->resumed = journal->next;
+    return true;
+}
+
+static void cd_journal_reset(cd_journal* journal) {
+    int i;
+    for (i = 0; i < journal->sidecars_count; i++) free(journal->sidecars[i].path);
+    journal->sidecars_count = 0;
+    journal->count = 0;
+    journal->next = 0;
+    cd_hash_free(journal->dirs);
+    journal->dirs = cd_hash_create(CD_JOURNAL_DIRS);
+}
+
+cd_journal* cd_journal_open(const char* base_name, int resume) {
+    cd_journal* journal = (cd_journal*)malloc(sizeof(cd_journal));
+    size_t length = strlen(base_name) - 4;
+    journal->name = (char*)malloc(length + strlen(CD_JOURNAL_EXT) + 1);
+    memcpy(journal->name, base_name, length);
+    strcpy(journal->name + length, CD_JOURNAL_EXT);
+    journal->next = 0;
+    journal->resumed = 0;
+    journal->dirs = cd_hash_create(CD_JOURNAL_DIRS);
+    journal->count = 0;
+    journal->size = CD_JOURNAL_DIRS;
+    journal->done = (cd_journal_done*)malloc(journal->size * sizeof(cd_journal_done));
+    journal->sidecars_count = 0;
+    journal->sidecars_size = CD_JOURNAL_SIDECARS;
+    journal->sidecars = (cd_journal_sidecar*)malloc(journal->sidecars_size * sizeof(cd_journal_sidecar));
+    journal->pending_length = 0;
+    journal->pending_size = CD_JOURNAL_PENDING;
+    journal->pending = (char*)malloc(journal->pending_size);
+    if (resume) {
+        if (cd_journal_load(journal)) {
+            CD_LOG(CD_LOG_INFO, "[resume] %llu records and %llu directories are indexed already\n",
+                   (unsigned long long)journal->next - 1, (unsigned long long)journal->count);
+            return journal;
+        }
+        CD_LOG(CD_LOG_WARNING, "[warning] nothing to resume, indexing everything: \"%s\"\n", journal->name);
+        cd_journal_reset(journal);
+    }
+    journal->fd = open(journal->name, O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if (journal->fd == -1) {
+        CD_LOG(CD_LOG_WARNING, "[warning] failed to create journal, indexing cannot be resumed: \"%s\"\n", journal->name);
+        cd_journal_close(journal, false);
+        return NULL;
+    }
+    cd_index_mark mark;
+    memcpy(&mark.mark, CD_JOURNAL_MARK, CD_INDEX_MARK_LEN);
+    mark.version = CD_JOURNAL_VERSION;
+    write(journal->fd, &mark, sizeof(cd_index_mark));
+    return journal;
+}
+
+off_t cd_journal_size(cd_journal* journal, const char* path) {
+    cd_journal_sidecar* sidecar = cd_journal_sidecar_get(journal, path, false);
+    return (sidecar) ? sidecar->size : 0;
+}
+
+void cd_journal_track(cd_journal* journal, const char* path, int fd) {
+    cd_journal_sidecar_get(journal, path, true)->fd = fd;
+}
+
+int cd_journal_skip(cd_journal* journal, cd_file_entry* entry, cd_offset* offset) {
+    char key[sizeof(cd_offset) + sizeof(cd_time) + CD_NAME_MAX];
+    if (!journal->count || (entry->id >= journal->resumed)) return false;
+    size_t length = cd_journal_key(key, entry->id, entry->mtime, entry->name, strnlen(entry->name, CD_NAME_MAX));
+    cd_offset index = cd_hash_get(journal->dirs, key, length);
+    if (!index) return false;
+    entry->child = journal->done[index-1].child;
+    *offset = journal->done[index-1].next;
+    return true;
+}
+
+static void cd_journal_checkpoint_write(cd_journal* journal, cd_offset next) {
+    int i;
+    cd_byte type = CD_JOURNAL_CHECKPOINT;
+    cd_journal_checkpoint checkpoint;
+    cd_journal_file size;
+    checkpoint.next = next;
+    checkpoint.sidecars = 0;
+    for (i = 0; i < journal->sidecars_count; i++) {
+        if (journal->sidecars[i].fd != -1) journal->sidecars[i].size = lseek(journal->sidecars[i].fd, 0, SEEK_END);
+        if (journal->sidecars[i].size > 0) checkpoint.sidecars++;
+    }
+    cd_journal_append(journal, &type, sizeof(cd_byte));
+    cd_journal_append(journal, &checkpoint, sizeof(cd_journal_checkpoint));
+    for (i = 0; i < journal->sidecars_count; i++) {
+        if (journal->sidecars[i].size <= 0) continue;
+        size.size = journal->sidecars[i].size;
+        size.length = strlen(journal->sidecars[i].path);
+        cd_journal_append(journal, &size, sizeof(cd_journal_file));
+        cd_journal_append(journal, journal->sidecars[i].path, size.length);
+    }
+    // One write, so that a checkpoint is either there or cut
+    if (write(journal->fd, journal->pending, journal->pending_length) != journal->pending_length) {
+        CD_LOG(CD_LOG_WARNING, "[warning] failed to write journal: \"%s\"\n", journal->name);
+    }
+    journal->pending_length = 0;
+    journal->next = next;
+}
+
+void cd_journal_done_dir(cd_journal* journal, cd_file_entry* entry, cd_offset next) {
+    cd_byte type = CD_JOURNAL_DIR;
+    cd_journal_dir dir;
+    dir.id = entry->id;
+    dir.mtime = entry->mtime;
+    dir.child = entry->child;
+    dir.next = next;
+    dir.length = strnlen(entry->name, CD_NAME_MAX);
+    cd_journal_append(journal, &type, sizeof(cd_byte));
+    cd_journal_append(journal, &dir, sizeof(cd_journal_dir));
+    cd_journal_append(journal, entry->name, dir.length);
+    // Records up to the resumed point are not all rewritten yet
+    if ((next >= journal->resumed) && (next >= journal->next + CD_JOURNAL_STEP)) cd_journal_checkpoint_write(journal, next);
+}
+
+void cd_journal_close(cd_journal* journal, int complete) {
+    int i;
+    if (journal->fd != -1) close(journal->fd);
+    if (complete) unlink(journal->name);
+    for (i = 0; i < journal->sidecars_count; i++) free(journal->sidecars[i].path);
+    free(journal->sidecars);
+    cd_hash_free(journal->dirs);
+    free(journal->done);
+    free(journal->pending);
+    free(journal->name);
+    free(journal);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_JOURNAL_H_
+#define _CD_JOURNAL_H_
+
+#include <sys/types.h>
+
+#include "data.h"
+#include "hash.h"
+
+#define CD_JOURNAL_EXT      ".cdj"
+#define CD_JOURNAL_MARK     "CDJ"
+#define CD_JOURNAL_VERSION  0x02
+#define CD_JOURNAL_STEP     1024    // Records between checkpoints
+#define CD_JOURNAL_SIDECARS 8       // Initial number of tracked sidecars
+
+#define CD_JOURNAL_DIR          'D'
+#define CD_JOURNAL_CHECKPOINT   'C'
+
+// Modes of cd_base_open()
+#define CD_JOURNAL_NONE     0
+#define CD_JOURNAL_WRITE    1
+#define CD_JOURNAL_RESUME   2
+
+typedef struct {
+    cd_offset id;
+    cd_time mtime;
+    cd_offset child;        // First entry of the directory
+    cd_offset next;         // First ID after the directory
+    cd_byte length;         // Name follows
+} packed(cd_journal_dir);
+
+typedef struct {
+    cd_offset next;         // Records up to here are written, except open directories
+    cd_byte sidecars;       // Sizes of sidecars follow
+} packed(cd_journal_checkpoint);
+
+typedef struct {
+    cd_size size;
+    cd_word length;         // Path follows
+} packed(cd_journal_file);
+
+typedef struct {
+    char* path;
+    int fd;                 // Opened in this run or -1
+    off_t size;             // Committed size
+} cd_journal_sidecar;
+
+typedef struct {
+    cd_offset child;
+    cd_offset next;
+} cd_journal_done;
+
+typedef struct {
+    int fd;
+    char* name;
+    cd_offset next;         // Next ID at the last checkpoint
+    cd_offset resumed;      // Next ID committed by the interrupted run, or 0
+    cd_hash* dirs;          // ID, mtime and name -> index in done, plus one
+    cd_journal_done* done;  // Directories committed by the interrupted run
+    cd_offset count;
+    cd_offset size;
+    cd_journal_sidecar* sidecars;
+    int sidecars_count;
+    int sidecars_size;
+    char* pending;          // Directories completed since the last checkpoint
+    size_t pending_length;
+    size_t pending_size;
+} cd_journal;
+
+// With resume, loads what the interrupted run committed and truncates its sidecars to match
+cd_journal* cd_journal_open(const char* base_name, int resume);
+
+// Committed size of the sidecar, or 0 if it has to be created anew
+off_t cd_journal_size(cd_journal* journal, const char* path);
+
+void cd_journal_track(cd_journal* journal, const char* path, int fd);
+
+// Sets the entry's child and moves offset past the directory, if it was indexed before
+int cd_journal_skip(cd_journal* journal, cd_file_entry* entry, cd_offset* offset);
+
+void cd_journal_done_dir(cd_journal* journal, cd_file_entry* entry, cd_offset next);
+
+// Removes the journal if indexing completed
+void cd_journal_close(cd_journal* journal, int complete);
+
+#endif /* _CD_JOURNAL_H_ */
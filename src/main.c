@@ -4,38 +4,250 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
 
+#include "cdindex.h"
 #include "index.h"
 #include "base.h"
 #include "plugin.h"
 #include "extract.h"
+#include "stats.h"
 
 #define CD_DEVICE       "/dev/cdrom"
 #define CD_MOUNTPOINT   "/media/cdrom"
+#define CD_LOG_BUFSIZE  65536   // Output buffer when not writing to a terminal
+
+enum {
+    CD_OPT_STATS = 256,
+    CD_OPT_STATS_JSON
+};
+
+int cd_log_level = CD_LOG_FILE;
+
+/* options:
+ *  -a      - also write columns of file types, sizes and times, with which
+ *            cdfind checks -type, -size and -mtime without reading records
+ *            (same as --columns)
+ *  -b      - run extractors and plugins in order of file positions on the disc,
+ *            taken from extents of the image with -i
+ *  -c DIR  - cache extracted data and archive listings in DIR, keyed by content
+ *  -i      - read the tree from the device or image itself, not from the mount
+ *            point; files are opened only if the mount point is given as well
+ *  -j N    - scan directories and run extractors using N threads
+ *  -k      - also write CRC-32C checksums of each 64 KiB block of the index
+ *            and of its sidecars, which cdverify and readers check
+ *            (same as --checksums)
+ *  -m      - build the index in memory and write it at once
+ *  -n      - also write the index of file names sorted in each directory,
+ *            with which cdfind and cdbrowse look paths up by binary search
+ *            (same as --sorted)
+ *  -o FILE - same as -s, but also copy the device to the image FILE
+ *  -p      - repack the existing index, so that files of each directory
+ *            are stored one after another and are read at once; takes
+ *            no path and device (same as --repack)
+ *  -q N    - stat directory entries in batches of N using io_uring
+ *  -r      - resume indexing that was interrupted, skipping directories it
+ *            completed; works without -b, -j, -m, -s, -t and -u, which do
+ *            not keep the journal (same as --resume)
+ *  -s      - same as -i, but read the whole device once, from start to end,
+ *            and feed extractors from that read; prints MD5 of the device
+ *  -t DIR  - same as -m, but keep records in a temporary file in DIR
+ *  -u      - update the existing index, reusing data of unchanged files
+ *            (same as --update)
+ *  -v N    - print messages up to level N: 0 - errors, 1 - warnings,
+ *            2 - progress, 3 - every file (default); output is fully
+ *            buffered, if it is not a terminal (same as --verbose=N)
+ *  -z      - compress the index and names by blocks, which readers
+ *            uncompress as they need them; -u and -p uncompress them first
+ *            (same as --compress)
+ *  --stats           - print time, bytes and syscalls spent in each stage
+ *  --stats-json FILE - write the same as JSON to FILE ("-" for stdout)
+ */
+
+static const struct option cd_options[] = {
+    { "update", no_argument, NULL, 'u' },
+    { "resume", no_argument, NULL, 'r' },
+    { "repack", no_argument, NULL, 'p' },
+    { "sorted", no_argument, NULL, 'n' },
+    { "columns", no_argument, NULL, 'a' },
+    { "compress", no_argument, NULL, 'z' },
+    { "checksums", no_argument, NULL, 'k' },
+    { "verbose", required_argument, NULL, 'v' },
+    { "stats", no_argument, NULL, CD_OPT_STATS },
+    { "stats-json", required_argument, NULL, CD_OPT_STATS_JSON },
+    { NULL, 0, NULL, 0 }
+};
 
 int main(int argc, char* argv[]) {
+    int opt;
+    int jobs = 0;
+    int memory = 0;
+    int depth = 0;
+    int update = 0;
+    int resume = 0;
+    int repack = 0;
+    int sorted = 0;
+    int columns = 0;
+    int compress = 0;
+    int checksums = 0;
+    const char* spill = NULL;
+    const char* cache = NULL;
+    int ordered = 0;
+    int image = 0;
+    int stream = 0;
+    const char* output = NULL;
+    int verbose = 0;
+    int stats = 0;
+    const char* json = NULL;
+    int status = EXIT_SUCCESS;
+    while ((opt = getopt_long(argc, argv, "abc:ij:kmno:pq:rst:uv:z", cd_options, NULL)) != -1) {
+        if (opt == 'a') {
+            columns = 1;
+        } else if (opt == 'b') {
+            ordered = 1;
+        } else if (opt == 'c') {
+            cache = optarg;
+        } else if (opt == 'i') {
+            image = 1;
+        } else if (opt == 'j') {
+            jobs = atoi(optarg);
+            if (jobs < 1) {
+                CD_LOG(CD_LOG_ERROR, "[error] invalid number of jobs: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+        } else if (opt == 'k') {
+            checksums = 1;
+        } else if (opt == 'm') {
+            memory = 1;
+        } else if (opt == 'n') {
+            sorted = 1;
+        } else if (opt == 'o') {
+            image = 1;
+            stream = 1;
+            output = optarg;
+        } else if (opt == 'p') {
+            repack = 1;
+        } else if (opt == 'q') {
+            depth = atoi(optarg);
+            if (depth < 1) {
+                CD_LOG(CD_LOG_ERROR, "[error] invalid queue depth: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+        } else if (opt == 'r') {
+            resume = 1;
+        } else if (opt == 's') {
+            image = 1;
+            stream = 1;
+        } else if (opt == 't') {
+            memory = 1;
+            spill = optarg;
+        } else if (opt == 'u') {
+            update = 1;
+        } else if (opt == 'v') {
+            cd_log_level = atoi(optarg);
+            verbose = 1;
+        } else if (opt == 'z') {
+            compress = 1;
+        } else if (opt == CD_OPT_STATS) {
+            stats = 1;
+        } else if (opt == CD_OPT_STATS_JSON) {
+            json = optarg;
+        } else {
+            return EXIT_FAILURE;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    // Per-file lines are not flushed one by one when redirected
+    if (verbose && !isatty(STDOUT_FILENO)) setvbuf(stdout, NULL, _IOFBF, CD_LOG_BUFSIZE);
+    // Journal needs records written as soon as directories are done
+    int journal = (memory || jobs || ordered || stream || update || repack) ? CD_JOURNAL_NONE :
+                  (resume) ? CD_JOURNAL_RESUME : CD_JOURNAL_WRITE;
+    if (resume && !journal) {
+        CD_LOG(CD_LOG_ERROR, "[error] --resume cannot be used with -b, -j, -m, -p, -s, -t or -u\n");
+        return EXIT_FAILURE;
+    }
+    // Files of the index are replaced, so they must be readable first
+    if (repack && (argc >= 2) && (cd_base_version(argv[1]) != CD_INDEX_VERSION)) {
+        CD_LOG(CD_LOG_ERROR, "[error] no index of this version to repack, see cdupgrade: \"%s\"\n", argv[1]);
+        return EXIT_FAILURE;
+    }
     if (argc >= 2) {
         cd_init_plugins();
         cd_plugin_load_archiver();
         cd_plugin_load_external();
 
         cd_offset offset = 1;
-        cd_base* base = cd_base_open(argv[1]);
+        cd_stats* timers = (stats || json) ? cd_stats_create() : NULL;
+        cd_base* base = cd_base_open(argv[1], update || repack, journal);
         if (base != NULL) {
+            base->stats = timers;
+            base->sorted = sorted;
+            base->columns = columns;
+            base->compress = compress;
+            base->checksums = checksums;
+            if (memory) base->tree = cd_tree_create(1, spill);
+            if (cache) base->cache = cd_cache_open(cache);
+            if (ordered) base->schedule = cd_schedule_create();
+            if (depth) {
+                base->uring = cd_uring_create(depth);
+                if (!base->uring) CD_LOG(CD_LOG_WARNING, "[warning] io_uring is not available, using plain stat\n");
+            }
             cd_init_extractors(base);
+            if (jobs) base->pool = cd_pool_create(jobs);
 
-            cd_header((argc == 4) ? argv[3] : CD_DEVICE, base);
-            cd_index((argc >= 3) ? argv[2] : CD_MOUNTPOINT, NULL, &offset, base);
+            const char* device = (argc == 4) ? argv[3] : CD_DEVICE;
+            const char* path = (argc >= 3) ? argv[2] : CD_MOUNTPOINT;
+            uint64_t start = (timers) ? cd_stats_now() : 0;
+            if (repack) {
+                cd_repack(&offset, base);
+            } else if (image) {
+                // Either the image alone, or the mount point and the image
+                if (argc == 3) device = argv[2];
+                if (stream) base->stream = cd_stream_create(device, output);
+                cd_header(device, base);
+                cd_index_image(device, ((argc == 4) && !base->stream) ? path : NULL, NULL, &offset, base);
+            } else if (jobs) {
+                cd_header(device, base);
+                cd_scan_node* root = cd_scan(path, jobs, timers);
+                if (root) {
+                    cd_index_scanned(path, root, NULL, &offset, base);
+                    cd_scan_free(root);
+                }
+            } else {
+                cd_header(device, base);
+                cd_index(path, NULL, &offset, base);
+            }
+            if (timers) cd_stats_add(timers->walk, start, offset - 1, 0, 0);
+            cd_index_wait(base);
 
             cd_free_extractors();
-            cd_base_close(base);
+            start = (timers) ? cd_stats_now() : 0;
+            if (!cd_base_close(base)) status = EXIT_FAILURE;
+            if (timers) cd_stats_add(cd_stats_stage(timers, "close", NULL), start, 1, 0, 0);
+        }
+        if (timers) {
+            fflush(stdout);
+            if (stats) cd_stats_print(timers);
+            if (json) {
+                FILE* file = strcmp(json, "-") ? fopen(json, "w") : stdout;
+                if (file) {
+                    cd_stats_json(timers, file);
+                    if (file != stdout) fclose(file);
+                } else {
+                    CD_LOG(CD_LOG_ERROR, "[error] failed to write statistics: \"%s\"\n", json);
+                }
+            }
+            cd_stats_free(timers);
         }
 
         cd_plugin_unload_external();
         cd_free_plugins();
     } else {
-        printf("[error] please specify database name\n");
+        CD_LOG(CD_LOG_ERROR, "[error] please specify database name\n");
         return EXIT_FAILURE;
     }
-    return EXIT_SUCCESS;
+    return status;
 }
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <string.h>
+
+#include "md5.h"
+
+#define CD_MD5_ROTATE(X, N) (((X) << (N)) | ((X) >> (32 - (N))))
+
+// Per-round shift amounts (RFC 1321)
+static const unsigned char cd_md5_shifts[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+// Integer part of abs(sin(i + 1)) * 2^32
+static const uint32_t cd_md5_sines[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static void cd_md5_block(cd_md5* md5, const unsigned char* block) {
+    uint32_t words[16];
+    uint32_t a = md5->state[0], b = md5->state[1], c = md5->state[2], d = md5->state[3];
+    uint32_t f, g, t;
+    int i;
+    for (i = 0; i < 16; i++) {
+        words[i] = block[i*4] | (block[i*4+1] << 8) | (block[i*4+2] << 16) | ((uint32_t)block[i*4+3] << 24);
+    }
+    for (i = 0; i < 64; i++) {
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) & 15;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) & 15;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7 * i) & 15;
+        }
+        t = d;
+        d = c;
+        c = b;
+        b += CD_MD5_ROTATE(a + f + cd_md5_sines[i] + words[g], cd_md5_shifts[i]);
+        a = t;
+    }
+    md5->state[0] += a;
+    md5->state[1] += b;
+    md5->state[2] += c;
+    md5->state[3] += d;
+}
+
+void cd_md5_init(cd_md5* md5) {
+    md5->state[0] = 0x67452301;
+    md5->state[1] = 0xefcdab89;
+    md5->state[2] = 0x98badcfe;
+    md5->state[3] = 0x10325476;
+    md5->length = 0;
+}
+
+void cd_md5_update(cd_md5* md5, const void* data, size_t length) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    size_t used = md5->length & 63;
+    size_t part;
+    md5->length += length;
+    if (used) {
+        part = (length < 64 - used) ? length : 64 - used;
+        memcpy(&md5->buffer[used], bytes, part);
+        bytes += part;
+        length -= part;
+        if (used + part < 64) return;
+        cd_md5_block(md5, md5->buffer);
+    }
+    for (; length >= 64; bytes += 64, length -= 64) cd_md5_block(md5, bytes);
+    memcpy(md5->buffer, bytes, length);
+}
+
+void cd_md5_final(cd_md5* md5, unsigned char* digest) {
+    int i;
+    unsigned char tail[72];
+    uint64_t bits = md5->length * 8;
+    size_t used = md5->length & 63;
+    size_t pad = (used < 56) ? 56 - used : 120 - used;
+    memset(tail, '\0', sizeof(tail));
+    tail[0] = 0x80;
+    for (i = 0; i < 8; i++) tail[pad+i] = (unsigned char)(bits >> (i * 8));
+    cd_md5_update(md5, tail, pad + 8);
+    for (i = 0; i < 4; i++) {
+        digest[i*4]   = (unsigned char)md5->state[i];
+        digest[i*4+1] = (unsigned char)(md5->state[i] >> 8);
+        digest[i*4+2] = (unsigned char)(md5->state[i] >> 16);
+        digest[i*4+3] = (unsigned char)(md5->state[i] >> 24);
+    }
+}
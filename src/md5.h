@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_MD5_H_
+#define _CD_MD5_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CD_MD5_LEN      16
+
+typedef struct {
+    uint32_t state[4];
+    uint64_t length;        // Bytes hashed so far
+    unsigned char buffer[64];
+} cd_md5;
+
+void cd_md5_init(cd_md5* md5);
+
+void cd_md5_update(cd_md5* md5, const void* data, size_t length);
+
+void cd_md5_final(cd_md5* md5, unsigned char* digest);
+
+#endif /* _CD_MD5_H_ */
@@ -8,6 +8,7 @@
 #include <sys/types.h>
 #include <regex.h>
 
+#include "cdindex.h"
 #include "plugin.h"
 
 cd_plugin_info* cd_plugins;
@@ -43,7 +44,7 @@ cd_plugin_info* cd_find_plugin(const char* file) {
         if (!plugin->__regex) {
             plugin->__regex = (regex_t*)malloc(sizeof(regex_t));
             if (regcomp(plugin->__regex, plugin->regex, REG_EXTENDED|REG_ICASE|REG_NOSUB) != 0) {
-                printf("[error] regcomp failed: %s\n", plugin->regex);
+                CD_LOG(CD_LOG_ERROR, "[error] regcomp failed: %s\n", plugin->regex);
                 free(plugin->__regex);
                 plugin->__regex = NULL;
                 continue;
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cdindex.h"
+#include "pool.h"
+
+#define CD_POOL_JOBS        4       // Queued jobs per thread
+#define CD_POOL_RESULTS     1024    // Initial number of results
+
+struct __cd_pool_job {
+    cd_pool_func func;
+    void* data;
+    int* done;              // Set when the job is complete or NULL
+    cd_pool_job* next;
+};
+
+static void* cd_pool_thread(void* data) {
+    cd_pool_job* job;
+    cd_pool* pool = (cd_pool*)data;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->first && !pool->stop) pthread_cond_wait(&pool->work, &pool->lock);
+        job = pool->first;
+        if (!job) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pool->first = job->next;
+        if (!pool->first) pool->last = NULL;
+        pool->queued--;
+        pthread_cond_signal(&pool->room);
+        pthread_mutex_unlock(&pool->lock);
+        job->func(job->data);
+        if (job->done) {
+            pthread_mutex_lock(&pool->lock);
+            *job->done = 1;
+            pthread_cond_broadcast(&pool->finished);
+            pthread_mutex_unlock(&pool->lock);
+        }
+        free(job);
+    }
+    return NULL;
+}
+
+cd_pool* cd_pool_create(int threads) {
+    int i;
+    cd_pool* pool = (cd_pool*)malloc(sizeof(cd_pool));
+    pool->count = 0;
+    pool->first = NULL;
+    pool->last = NULL;
+    pool->queued = 0;
+    pool->limit = threads * CD_POOL_JOBS;
+    pool->stop = 0;
+    pool->size = CD_POOL_RESULTS;
+    pool->done = 0;
+    pool->results = (cd_pool_result*)malloc(pool->size * sizeof(cd_pool_result));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->room, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    pool->threads = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&pool->threads[pool->count], NULL, cd_pool_thread, pool) == 0) pool->count++;
+    }
+    if (!pool->count) {
+        cd_pool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void cd_pool_submit(cd_pool* pool, cd_pool_func func, void* data, int* done) {
+    cd_pool_job* job = (cd_pool_job*)malloc(sizeof(cd_pool_job));
+    job->func = func;
+    job->data = data;
+    job->done = done;
+    job->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    // Keep the walk from running too far ahead of the workers
+    while (pool->queued >= pool->limit) pthread_cond_wait(&pool->room, &pool->lock);
+    if (pool->last) pool->last->next = job;
+    else pool->first = job;
+    pool->last = job;
+    pool->queued++;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void cd_pool_sync(cd_pool* pool, int* done) {
+    pthread_mutex_lock(&pool->lock);
+    while (!*done) pthread_cond_wait(&pool->finished, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void cd_pool_report(cd_pool* pool, cd_offset id, cd_offset info) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->done == pool->size) {
+        pool->size *= 2;
+        pool->results = (cd_pool_result*)realloc(pool->results, pool->size * sizeof(cd_pool_result));
+    }
+    pool->results[pool->done].id = id;
+    pool->results[pool->done].info = info;
+    pool->done++;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void cd_pool_wait(cd_pool* pool) {
+    int i;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pool->count = 0;
+}
+
+void cd_pool_free(cd_pool* pool) {
+    cd_pool_wait(pool);
+    pthread_cond_destroy(&pool->finished);
+    pthread_cond_destroy(&pool->room);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->results);
+    free(pool->threads);
+    free(pool);
+}
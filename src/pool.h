@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_POOL_H_
+#define _CD_POOL_H_
+
+#include <pthread.h>
+
+#include "data.h"
+
+typedef void (*cd_pool_func)(void*);
+
+typedef struct __cd_pool_job cd_pool_job;
+
+typedef struct {
+    cd_offset id;           // Record to update
+    cd_offset info;         // Offset returned by the extractor
+} cd_pool_result;
+
+typedef struct {
+    pthread_t* threads;
+    int count;
+    cd_pool_job* first;     // Queued jobs
+    cd_pool_job* last;
+    int queued;
+    int limit;              // Maximum number of queued jobs
+    int stop;
+    cd_pool_result* results;
+    cd_offset done;         // Number of results
+    cd_offset size;         // Number of results allocated
+    pthread_mutex_t lock;
+    pthread_cond_t work;    // Signalled when a job is queued
+    pthread_cond_t room;    // Signalled when a job is taken
+    pthread_cond_t finished; // Signalled when a job is complete
+} cd_pool;
+
+cd_pool* cd_pool_create(int threads);
+
+void cd_pool_submit(cd_pool* pool, cd_pool_func func, void* data, int* done);
+
+void cd_pool_sync(cd_pool* pool, int* done);
+
+void cd_pool_report(cd_pool* pool, cd_offset id, cd_offset info);
+
+void cd_pool_wait(cd_pool* pool);
+
+void cd_pool_free(cd_pool* pool);
+
+#endif /* _CD_POOL_H_ */
@@ -4,16 +4,17 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <libraw/libraw.h>
 #include <wand/MagickWand.h>
 
+#include "cdindex.h"
 #include "extract.h"
 #include "image.h"
 
 typedef struct {
     cd_base* base;
-    libraw_data_t* rdata;
-    MagickWand* wand;
+    int genesis;            // Counted in wand_count
     const char* dir;
     int skip_thumbs;
 } cd_rawimage_base;
@@ -27,20 +28,21 @@ float cd_rawimage_get_coordinate(float coord[3], char ref) {
 }
 
 int cd_rawimage_thumbnail_init(cd_rawimage_base* rbase) {
-    if (!rbase->wand) {
+    pthread_mutex_lock(&rbase->base->lock);
+    if (!rbase->genesis) {
         if (!IsMagickWandInstantiated()) MagickWandGenesis();
-        rbase->wand = NewMagickWand();
+        rbase->genesis = 1;
         wand_count++;
         rbase->skip_thumbs = cd_create_data_dir(rbase->dir);
     }
+    pthread_mutex_unlock(&rbase->base->lock);
     return !rbase->skip_thumbs;
 }
 
 void* cd_rawimage_init(cd_base* base) {
     cd_rawimage_base* rbase = (cd_rawimage_base*)malloc(sizeof(cd_rawimage_base));
     rbase->base = base;
-    rbase->rdata = libraw_init(0);
-    rbase->wand = NULL;
+    rbase->genesis = 0;
     size_t baselen = strlen(base->base_name);
     rbase->dir = (char*)malloc(baselen - 3);
     strncpy((char*)rbase->dir, base->base_name, baselen - 4);
@@ -51,74 +53,122 @@ void* cd_rawimage_init(cd_base* base) {
 
 cd_offset cd_rawimage_getdata(const char* file, cd_file_entry* cdentry, void* udata) {
     cd_rawimage_base* rbase = (cd_rawimage_base*)udata;
-    int images_fd = cd_get_image_fd(((cd_rawimage_base*)udata)->base);
-    if (images_fd == -1) return 0;
-    if (libraw_open_file(rbase->rdata, file) == 0) {
-        libraw_adjust_sizes_info_only(rbase->rdata);
+    // LibRaw handles are not reentrant, so each file gets its own
+    libraw_data_t* rdata = libraw_init(0);
+    if (!rdata) return 0;
+    if (libraw_open_file(rdata, file) == 0) {
+        libraw_adjust_sizes_info_only(rdata);
         cd_picture_entry entry;
         memset(&entry, 0x00, sizeof(cd_picture_entry));
         entry.offset = cdentry->id;
-        if ((rbase->rdata->sizes.flip == 5) || (rbase->rdata->sizes.flip == 6)) {
-            entry.width = rbase->rdata->sizes.height;
-            entry.height = rbase->rdata->sizes.width;
+        if ((rdata->sizes.flip == 5) || (rdata->sizes.flip == 6)) {
+            entry.width = rdata->sizes.height;
+            entry.height = rdata->sizes.width;
         } else {
-            entry.width = rbase->rdata->sizes.width;
-            entry.height = rbase->rdata->sizes.height;
+            entry.width = rdata->sizes.width;
+            entry.height = rdata->sizes.height;
         }
-        strncpy(entry.creator, rbase->rdata->idata.model, 64);
-        strncpy(entry.author, rbase->rdata->other.artist, 64);
-        entry.ctime = rbase->rdata->other.timestamp;
-        if (rbase->rdata->other.parsed_gps.gpsparsed) {
-            entry.latitude = cd_rawimage_get_coordinate(rbase->rdata->other.parsed_gps.latitude, rbase->rdata->other.parsed_gps.latref);
-            entry.longitude = cd_rawimage_get_coordinate(rbase->rdata->other.parsed_gps.longtitude, rbase->rdata->other.parsed_gps.longref);
+        strncpy(entry.creator, rdata->idata.model, 64);
+        strncpy(entry.author, rdata->other.artist, 64);
+        entry.ctime = rdata->other.timestamp;
+        if (rdata->other.parsed_gps.gpsparsed) {
+            entry.latitude = cd_rawimage_get_coordinate(rdata->other.parsed_gps.latitude, rdata->other.parsed_gps.latref);
+            entry.longitude = cd_rawimage_get_coordinate(rdata->other.parsed_gps.longtitude, rdata->other.parsed_gps.longref);
         }
-        off_t offset = lseek(images_fd, 0, SEEK_END);
-        write(images_fd, &entry, sizeof(cd_picture_entry));
+        off_t offset = cd_add_picture(rbase->base, &entry);
 #ifdef INCLUDE_THUMBNAILS
-        if (!rbase->skip_thumbs) {
+        if (offset && !rbase->skip_thumbs) {
             /*
              * FIXME: Raw images usually include thumbnails of the needed size, but there is no lib to read them from there.
              *        P.S. libexiv2 can do this, but it's for C++.
              */
-            if (libraw_unpack_thumb(rbase->rdata) == 0) {
-                libraw_processed_image_t* thumb = libraw_dcraw_make_mem_thumb(rbase->rdata, NULL);
+            if (libraw_unpack_thumb(rdata) == 0) {
+                libraw_processed_image_t* thumb = libraw_dcraw_make_mem_thumb(rdata, NULL);
                 if (thumb) {
                     if (cd_rawimage_thumbnail_init(rbase)) {
-                        MagickReadImageBlob(rbase->wand, thumb->data, thumb->data_size);
-                        int twidth = rbase->rdata->thumbnail.twidth;
-                        int theight = rbase->rdata->thumbnail.theight;
+                        MagickWand* wand = NewMagickWand();
+                        MagickReadImageBlob(wand, thumb->data, thumb->data_size);
+                        int twidth = rdata->thumbnail.twidth;
+                        int theight = rdata->thumbnail.theight;
                         if (cd_get_thumbnail_size(&twidth, &theight)) {
-                            MagickResizeImage(rbase->wand, twidth, theight, LanczosFilter, 1);
+                            MagickResizeImage(wand, twidth, theight, LanczosFilter, 1);
                         }
-                        MagickAutoOrientImage(rbase->wand);
-                        MagickStripImage(rbase->wand);
-                        MagickSetImageCompressionQuality(rbase->wand, CD_THUMBNAIL_JPEG_QUALITY);
-                        char* tpath = (char*)malloc(strlen(rbase->dir) + 16);
-                        sprintf(tpath, "%s/%u.jpg", rbase->dir, cdentry->id);
-                        printf("[rawimage] writing thumbnail to %s\n", tpath);
-                        MagickWriteImage(rbase->wand, tpath);
+                        MagickAutoOrientImage(wand);
+                        MagickStripImage(wand);
+                        MagickSetImageCompressionQuality(wand, CD_THUMBNAIL_JPEG_QUALITY);
+                        char* tpath = (char*)malloc(strlen(rbase->dir) + 32);
+                        sprintf(tpath, "%s/%llu.jpg", rbase->dir, (unsigned long long)cdentry->id);
+                        CD_LOG(CD_LOG_FILE, "[rawimage] writing thumbnail to %s\n", tpath);
+                        MagickWriteImage(wand, tpath);
+                        DestroyMagickWand(wand);
                         free(tpath);
                     }
                     libraw_dcraw_clear_mem(thumb);
                 } else {
-                    printf("[warning] failed to extract thumbnail %s\n", file);
+                    CD_LOG(CD_LOG_WARNING, "[warning] failed to extract thumbnail %s\n", file);
                 }
             } else {
-                printf("[warning] failed to unpack %s\n", file);
+                CD_LOG(CD_LOG_WARNING, "[warning] failed to unpack %s\n", file);
             }
         }
 #endif /* INCLUDE_THUMBNAILS */
+        libraw_close(rdata);
         return offset;
     } else {
-        printf("[warning] failed to open %s\n", file);
+        CD_LOG(CD_LOG_WARNING, "[warning] failed to open %s\n", file);
     }
+    libraw_close(rdata);
     return 0;
 }
 
+cd_offset cd_rawimage_copy(cd_offset info, cd_offset previous, cd_file_entry* cdentry, void* udata) {
+    cd_rawimage_base* rbase = (cd_rawimage_base*)udata;
+    off_t offset = cd_read_picture(rbase->base, rbase->base->update->images_fd, info, cdentry->id);
+#ifdef INCLUDE_THUMBNAILS
+    if (offset && !rbase->skip_thumbs && cd_rawimage_thumbnail_init(rbase)) {
+        char from[32], to[32];
+        sprintf(from, "%llu.jpg", (unsigned long long)previous);
+        sprintf(to, "%llu.jpg", (unsigned long long)cdentry->id);
+        cd_relink_thumbnail(rbase->dir, from, to);
+    }
+#endif /* INCLUDE_THUMBNAILS */
+    return offset;
+}
+
+int cd_rawimage_save(cd_offset info, cd_file_entry* cdentry, int fd, const char* thumbnail, void* udata) {
+    cd_rawimage_base* rbase = (cd_rawimage_base*)udata;
+    if (!cd_save_picture(rbase->base, info, fd)) return 0;
+#ifdef INCLUDE_THUMBNAILS
+    char* from = (char*)malloc(strlen(rbase->dir) + 32);
+    sprintf(from, "%s/%llu.jpg", rbase->dir, (unsigned long long)cdentry->id);
+    char* to = (char*)malloc(strlen(thumbnail) + 5);
+    sprintf(to, "%s.jpg", thumbnail);
+    cd_cache_link(from, to);
+    free(to);
+    free(from);
+#endif /* INCLUDE_THUMBNAILS */
+    return 1;
+}
+
+cd_offset cd_rawimage_load(int fd, const char* thumbnail, cd_file_entry* cdentry, void* udata) {
+    cd_rawimage_base* rbase = (cd_rawimage_base*)udata;
+    off_t offset = cd_read_picture(rbase->base, fd, 0, cdentry->id);
+#ifdef INCLUDE_THUMBNAILS
+    if (offset && !rbase->skip_thumbs && cd_rawimage_thumbnail_init(rbase)) {
+        char* from = (char*)malloc(strlen(thumbnail) + 5);
+        sprintf(from, "%s.jpg", thumbnail);
+        char* to = (char*)malloc(strlen(rbase->dir) + 32);
+        sprintf(to, "%s/%llu.jpg", rbase->dir, (unsigned long long)cdentry->id);
+        cd_cache_link(from, to);
+        free(to);
+        free(from);
+    }
+#endif /* INCLUDE_THUMBNAILS */
+    return offset;
+}
+
 void cd_rawimage_finish(void* udata) {
-    libraw_close(((cd_rawimage_base*)udata)->rdata);
-    if (((cd_rawimage_base*)udata)->wand) {
-        DestroyMagickWand(((cd_rawimage_base*)udata)->wand);
+    if (((cd_rawimage_base*)udata)->genesis) {
         wand_count--;
         if (IsMagickWandInstantiated() && (wand_count <= 0)) MagickWandTerminus();
     }
@@ -132,6 +182,9 @@ static cd_extractor_info cd_rawimage = {
     cd_rawimage_init,
     cd_rawimage_getdata,
     cd_rawimage_finish,
+    cd_rawimage_copy,
+    cd_rawimage_save,
+    cd_rawimage_load,
     NULL,
     NULL,
     NULL
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_RECORD_H_
+#define _CD_RECORD_H_
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "data.h"
+#include "block.h"
+
+#define CD_NAMES_EXT        ".cdn"
+#define CD_SLINKS_EXT       ".cdl"
+#define CD_NAMES_SIZE       1024    // Initial size of the interned names cache
+#define CD_NAMES_INTERNED   262144  // Distinct names remembered while writing
+
+#define CD_RECORD_SIZE      sizeof(cd_record)
+
+#define CD_RECORD_OFFSET(ID) \
+    ((off_t)sizeof(cd_iso_header) + (off_t)((ID) - 1) * CD_RECORD_SIZE)
+
+static inline void cd_record_pack(const cd_file_entry* entry, cd_record* record) {
+    record->type = entry->type;
+    record->length = strnlen(entry->name, CD_NAME_MAX);
+    record->mode = entry->mode;
+    record->mtime = entry->mtime;
+    record->uid = entry->uid;
+    record->gid = entry->gid;
+    record->size = entry->size;
+    record->name = entry->heap;
+    record->info = entry->info;
+    record->parent = entry->parent;
+    record->child = entry->child;
+    record->next = entry->next;
+    record->count = entry->count;
+}
+
+// Name is left to the caller
+static inline void cd_record_unpack(const cd_record* record, cd_offset id, cd_file_entry* entry) {
+    entry->id = id;
+    entry->type = record->type;
+    entry->mode = record->mode;
+    entry->mtime = record->mtime;
+    entry->uid = record->uid;
+    entry->gid = record->gid;
+    entry->size = record->size;
+    entry->info = record->info;
+    entry->parent = record->parent;
+    entry->child = record->child;
+    entry->next = record->next;
+    entry->count = record->count;
+    entry->heap = record->name;
+}
+
+// Reads the record and its name from the names heap, see cd_block_open() for compressed ones
+static inline int cd_record_read(int fd, int names_fd, cd_offset id, cd_file_entry* entry) {
+    cd_record record;
+    if (cd_block_pread(fd, &record, CD_RECORD_SIZE, CD_RECORD_OFFSET(id)) != CD_RECORD_SIZE) return 0;
+    cd_record_unpack(&record, id, entry);
+    memset(entry->name, '\0', CD_NAME_MAX);
+    return (!record.length || (cd_block_pread(names_fd, entry->name, record.length, record.name) == record.length));
+}
+
+#endif /* _CD_RECORD_H_ */
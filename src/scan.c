@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cdindex.h"
+#include "scan.h"
+#include "stats.h"
+
+#define CD_DEQUE_SIZE       64      // Initial number of tasks per thread
+#define CD_DIRENT_BUFSIZE   65536   // Buffer for getdents64()
+
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct {
+    cd_scan_node* node;
+    char* path;
+} cd_scan_task;
+
+typedef struct {
+    cd_scan_task* tasks;
+    int head;               // Other threads steal from here
+    int tail;               // Owner pushes and pops here
+    int size;
+    pthread_mutex_t lock;
+} cd_scan_deque;
+
+typedef struct {
+    cd_scan_deque* deques;
+    int threads;
+    int queued;             // Tasks waiting in deques
+    int pending;            // Tasks waiting or running
+    cd_stats* stats;        // Stat timers or NULL
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+} cd_scan_pool;
+
+typedef struct {
+    cd_scan_pool* pool;
+    int index;
+} cd_scan_worker;
+
+static char* cd_scan_path(const char* dir, const char* name) {
+    size_t length = strlen(dir);
+    char* path = (char*)malloc(length + strlen(name) + 2);
+    strcpy(path, dir);
+    if (length && (dir[length-1] != '/')) path[length++] = '/';
+    strcpy(&path[length], name);
+    return path;
+}
+
+static void cd_scan_push(cd_scan_pool* pool, int index, cd_scan_node* node, char* path) {
+    cd_scan_deque* deque = &pool->deques[index];
+    pthread_mutex_lock(&pool->lock);
+    pool->pending++;
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail == deque->size) {
+        if (deque->head > 0) {
+            memmove(deque->tasks, &deque->tasks[deque->head], (deque->tail - deque->head) * sizeof(cd_scan_task));
+            deque->tail -= deque->head;
+            deque->head = 0;
+        } else {
+            deque->size *= 2;
+            deque->tasks = (cd_scan_task*)realloc(deque->tasks, deque->size * sizeof(cd_scan_task));
+        }
+    }
+    deque->tasks[deque->tail].node = node;
+    deque->tasks[deque->tail].path = path;
+    deque->tail++;
+    pthread_mutex_unlock(&deque->lock);
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static int cd_scan_pop(cd_scan_pool* pool, int index, cd_scan_task* task) {
+    int i, victim, found = 0;
+    // Own tasks are taken depth-first, stolen ones breadth-first
+    for (i = 0; (i < pool->threads) && !found; i++) {
+        victim = (index + i) % pool->threads;
+        cd_scan_deque* deque = &pool->deques[victim];
+        pthread_mutex_lock(&deque->lock);
+        if (deque->tail > deque->head) {
+            if (victim == index) *task = deque->tasks[--deque->tail];
+            else *task = deque->tasks[deque->head++];
+            found = 1;
+        }
+        pthread_mutex_unlock(&deque->lock);
+    }
+    if (found) {
+        pthread_mutex_lock(&pool->lock);
+        pool->queued--;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return found;
+}
+
+void cd_scan_statx(const struct statx* stx, struct stat64* stat) {
+    memset(stat, '\0', sizeof(struct stat64));
+    stat->st_mode  = stx->stx_mode;
+    stat->st_mtime = stx->stx_mtime.tv_sec;
+    stat->st_uid   = stx->stx_uid;
+    stat->st_gid   = stx->stx_gid;
+    stat->st_size  = stx->stx_size;
+}
+
+// Set once statx() turns out to be missing, scanner threads share it
+static int cd_scan_nostatx = 0;
+
+int cd_scan_stat(int dirfd, const char* name, int flags, struct stat64* stat) {
+    if (!__atomic_load_n(&cd_scan_nostatx, __ATOMIC_RELAXED)) {
+        struct statx stx;
+        if (statx(dirfd, name, flags|AT_SYMLINK_NOFOLLOW|AT_NO_AUTOMOUNT, CD_STATX_MASK, &stx) == 0) {
+            cd_scan_statx(&stx, stat);
+            return 0;
+        }
+        if (errno != ENOSYS) return -1;
+        __atomic_store_n(&cd_scan_nostatx, 1, __ATOMIC_RELAXED);
+    }
+    return fstatat64(dirfd, name, stat, flags|AT_SYMLINK_NOFOLLOW);
+}
+
+int cd_dir_open(cd_dir* dir, int dirfd, const char* path) {
+    dir->fd = openat(dirfd, path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (dir->fd == -1) return 0;
+    dir->buf = (char*)malloc(CD_DIRENT_BUFSIZE);
+    dir->bytes = 0;
+    dir->pos = 0;
+    return 1;
+}
+
+const char* cd_dir_read(cd_dir* dir, unsigned char* type) {
+    struct linux_dirent64* file;
+    for (;;) {
+        if (dir->pos >= dir->bytes) {
+            dir->bytes = syscall(SYS_getdents64, dir->fd, dir->buf, CD_DIRENT_BUFSIZE);
+            dir->pos = 0;
+            if (dir->bytes <= 0) return NULL;
+        }
+        file = (struct linux_dirent64*)(dir->buf + dir->pos);
+        dir->pos += file->d_reclen;
+        if (!strcmp(file->d_name, ".")) continue;
+        if (!strcmp(file->d_name, "..")) continue;
+        *type = file->d_type;
+        return file->d_name;
+    }
+}
+
+void cd_dir_close(cd_dir* dir) {
+    free(dir->buf);
+    close(dir->fd);
+}
+
+static int cd_scan_timed(cd_scan_pool* pool, int dirfd, const char* name, int flags, struct stat64* stat) {
+    if (!pool->stats) return cd_scan_stat(dirfd, name, flags, stat);
+    uint64_t start = cd_stats_now();
+    int result = cd_scan_stat(dirfd, name, flags, stat);
+    cd_stats_add(pool->stats->stat, start, 1, 0, 1);
+    return result;
+}
+
+static void cd_scan_dir(cd_scan_pool* pool, int index, cd_scan_task* task) {
+    cd_dir dir;
+    if (cd_dir_open(&dir, AT_FDCWD, task->path)) {
+        const char* name;
+        unsigned char type;
+        cd_scan_node* node;
+        cd_scan_node** last = &task->node->child;
+        // Directory stat comes from the handle instead of a name lookup in the parent
+        if (cd_scan_timed(pool, dir.fd, "", AT_EMPTY_PATH, &task->node->stat) == -1) {
+            CD_LOG(CD_LOG_ERROR, "[error] stat failed: \"%s\"\n", task->path);
+        }
+        while ((name = cd_dir_read(&dir, &type))) {
+            if ((type != DT_UNKNOWN) && (type != DT_DIR) && (type != DT_REG) && (type != DT_LNK)) {
+                DEBUG_OUTPUT(DEBUG_INDEX, "skipping \"%s\" (type:%03d)\n", name, type);
+                continue;
+            }
+            node = (cd_scan_node*)malloc(sizeof(cd_scan_node));
+            if (type == DT_DIR) {
+                node->stat.st_mode = S_IFDIR;
+            } else if (cd_scan_timed(pool, dir.fd, name, 0, &node->stat) == -1) {
+                CD_LOG(CD_LOG_ERROR, "[error] stat failed: \"%s\"\n", name);
+                free(node);
+                continue;
+            }
+            if (!S_ISDIR(node->stat.st_mode) &&
+                !S_ISREG(node->stat.st_mode) &&
+                !S_ISLNK(node->stat.st_mode)) {
+                DEBUG_OUTPUT(DEBUG_INDEX, "skipping \"%s\" (type:%03d)\n", name, type);
+                free(node);
+                continue;
+            }
+            node->name = strdup(name);
+            node->link = NULL;
+            node->child = NULL;
+            node->next = NULL;
+            *last = node;
+            last = &node->next;
+            if (S_ISDIR(node->stat.st_mode)) {
+                cd_scan_push(pool, index, node, cd_scan_path(task->path, node->name));
+            }
+        }
+        if (dir.bytes == -1) CD_LOG(CD_LOG_ERROR, "[error] readdir failed: \"%s\"\n", task->path);
+        cd_dir_close(&dir);
+    } else {
+        // Still need the stat, which we did not take from the parent
+        if (cd_scan_timed(pool, AT_FDCWD, task->path, 0, &task->node->stat) == -1) {
+            CD_LOG(CD_LOG_ERROR, "[error] stat failed: \"%s\"\n", task->path);
+            task->node->stat.st_mode = 0;
+        }
+        CD_LOG(CD_LOG_ERROR, "[error] opendir failed: \"%s\"\n", task->path);
+    }
+    free(task->path);
+}
+
+static void* cd_scan_thread(void* data) {
+    cd_scan_task task;
+    cd_scan_pool* pool = ((cd_scan_worker*)data)->pool;
+    int index = ((cd_scan_worker*)data)->index;
+    for (;;) {
+        if (cd_scan_pop(pool, index, &task)) {
+            cd_scan_dir(pool, index, &task);
+            pthread_mutex_lock(&pool->lock);
+            if (--pool->pending == 0) pthread_cond_broadcast(&pool->work);
+            pthread_mutex_unlock(&pool->lock);
+        } else {
+            pthread_mutex_lock(&pool->lock);
+            if (pool->pending == 0) {
+                pthread_mutex_unlock(&pool->lock);
+                break;
+            }
+            if (pool->queued == 0) pthread_cond_wait(&pool->work, &pool->lock);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+    return NULL;
+}
+
+cd_scan_node* cd_scan(const char* path, int threads, cd_stats* stats) {
+    int i;
+    cd_scan_pool pool;
+    cd_scan_node* root = (cd_scan_node*)malloc(sizeof(cd_scan_node));
+    if (stat64(path, &root->stat) == -1) {
+        CD_LOG(CD_LOG_ERROR, "[error] stat failed: \"%s\"\n", path);
+        free(root);
+        return NULL;
+    }
+    root->name = strdup(path);
+    root->link = NULL;
+    root->child = NULL;
+    root->next = NULL;
+    if (threads < 1) threads = 1;
+    pool.threads = threads;
+    pool.queued = 0;
+    pool.pending = 0;
+    pool.stats = stats;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.work, NULL);
+    pool.deques = (cd_scan_deque*)malloc(threads * sizeof(cd_scan_deque));
+    for (i = 0; i < threads; i++) {
+        pool.deques[i].size = CD_DEQUE_SIZE;
+        pool.deques[i].tasks = (cd_scan_task*)malloc(CD_DEQUE_SIZE * sizeof(cd_scan_task));
+        pool.deques[i].head = 0;
+        pool.deques[i].tail = 0;
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+    }
+    cd_scan_push(&pool, 0, root, strdup(path));
+    pthread_t* tids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    cd_scan_worker* workers = (cd_scan_worker*)malloc(threads * sizeof(cd_scan_worker));
+    for (i = 0; i < threads; i++) {
+        workers[i].pool = &pool;
+        workers[i].index = i;
+        pthread_create(&tids[i], NULL, cd_scan_thread, &workers[i]);
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].tasks);
+    }
+    free(pool.deques);
+    free(workers);
+    free(tids);
+    pthread_cond_destroy(&pool.work);
+    pthread_mutex_destroy(&pool.lock);
+    return root;
+}
+
+void cd_scan_free(cd_scan_node* node) {
+    cd_scan_node* next;
+    for (; node; node = next) {
+        next = node->next;
+        cd_scan_free(node->child);
+        free(node->name);
+        free(node->link);
+        free(node);
+    }
+}
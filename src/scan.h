@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_SCAN_H_
+#define _CD_SCAN_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+
+// Only fields stored by cd_create_entry()
+#define CD_STATX_MASK   (STATX_TYPE|STATX_MODE|STATX_MTIME|STATX_UID|STATX_GID|STATX_SIZE)
+
+typedef struct __cd_scan_node cd_scan_node;
+struct __cd_scan_node {
+    char* name;
+    struct stat64 stat;
+    char* link;             // Symlink target, when read from an image
+    cd_scan_node* child;    // First entry (for dirs)
+    cd_scan_node* next;     // Next entry in readdir order
+};
+
+typedef struct {
+    int fd;
+    char* buf;              // getdents64() buffer
+    long bytes;             // Bytes in buffer
+    long pos;               // Position of the next record
+} cd_dir;
+
+int cd_dir_open(cd_dir* dir, int dirfd, const char* path);
+
+const char* cd_dir_read(cd_dir* dir, unsigned char* type);
+
+void cd_dir_close(cd_dir* dir);
+
+void cd_scan_statx(const struct statx* stx, struct stat64* stat);
+
+int cd_scan_stat(int dirfd, const char* name, int flags, struct stat64* stat);
+
+// Stats may be NULL
+cd_scan_node* cd_scan(const char* path, int threads, cd_stats* stats);
+
+void cd_scan_free(cd_scan_node* node);
+
+#endif /* _CD_SCAN_H_ */
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cdindex.h"
+#include "schedule.h"
+
+#define CD_SCHEDULE_SIZE    1024    // Initial number of jobs
+
+cd_size cd_schedule_block(const char* file) {
+    int block = 0;
+    int blocksize;
+    cd_size position = 0;
+    char buf[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+    struct fiemap* map = (struct fiemap*)buf;
+    int fd = open(file, O_RDONLY);
+    if (fd == -1) return 0;
+    memset(buf, '\0', sizeof(buf));
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+    // Only the first extent matters, that is where reading starts
+    if ((ioctl(fd, FS_IOC_FIEMAP, map) == 0) && map->fm_mapped_extents) {
+        position = map->fm_extents[0].fe_physical;
+    } else if ((ioctl(fd, FIBMAP, &block) == 0) && (ioctl(fd, FIGETBSZ, &blocksize) == 0)) {
+        position = (cd_size)block * blocksize;
+    }
+    close(fd);
+    return position;
+}
+
+cd_schedule* cd_schedule_create() {
+    cd_schedule* schedule = (cd_schedule*)malloc(sizeof(cd_schedule));
+    schedule->count = 0;
+    schedule->size = CD_SCHEDULE_SIZE;
+    schedule->jobs = (cd_scheduled*)malloc(schedule->size * sizeof(cd_scheduled));
+    return schedule;
+}
+
+void cd_schedule_add(cd_schedule* schedule, cd_size block, cd_pool_func func, void* data, int* done) {
+    if (schedule->count == schedule->size) {
+        schedule->size *= 2;
+        schedule->jobs = (cd_scheduled*)realloc(schedule->jobs, schedule->size * sizeof(cd_scheduled));
+    }
+    schedule->jobs[schedule->count].block = block;
+    schedule->jobs[schedule->count].order = schedule->count;
+    schedule->jobs[schedule->count].func = func;
+    schedule->jobs[schedule->count].data = data;
+    schedule->jobs[schedule->count].done = done;
+    schedule->count++;
+}
+
+static int cd_schedule_compare(const void* a, const void* b) {
+    const cd_scheduled* first = (const cd_scheduled*)a;
+    const cd_scheduled* second = (const cd_scheduled*)b;
+    if (first->block != second->block) return (first->block < second->block) ? -1 : 1;
+    return (first->order < second->order) ? -1 : (first->order > second->order);
+}
+
+void cd_schedule_run(cd_schedule* schedule, cd_pool* pool) {
+    cd_offset i;
+    DEBUG_OUTPUT(DEBUG_INDEX, "running %llu jobs in block order\n", (unsigned long long)schedule->count);
+    qsort(schedule->jobs, schedule->count, sizeof(cd_scheduled), cd_schedule_compare);
+    for (i = 0; i < schedule->count; i++) {
+        if (pool) {
+            cd_pool_submit(pool, schedule->jobs[i].func, schedule->jobs[i].data, schedule->jobs[i].done);
+        } else {
+            schedule->jobs[i].func(schedule->jobs[i].data);
+            if (schedule->jobs[i].done) *schedule->jobs[i].done = 1;
+        }
+    }
+    schedule->count = 0;
+}
+
+void cd_schedule_free(cd_schedule* schedule) {
+    free(schedule->jobs);
+    free(schedule);
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_SCHEDULE_H_
+#define _CD_SCHEDULE_H_
+
+#include "data.h"
+#include "pool.h"
+
+typedef struct {
+    cd_size block;          // Physical position of the file
+    cd_offset order;        // Keeps walk order for equal positions
+    cd_pool_func func;
+    void* data;
+    int* done;
+} cd_scheduled;
+
+typedef struct {
+    cd_scheduled* jobs;
+    cd_offset count;
+    cd_offset size;
+} cd_schedule;
+
+cd_size cd_schedule_block(const char* file);
+
+cd_schedule* cd_schedule_create();
+
+void cd_schedule_add(cd_schedule* schedule, cd_size block, cd_pool_func func, void* data, int* done);
+
+void cd_schedule_run(cd_schedule* schedule, cd_pool* pool);
+
+void cd_schedule_free(cd_schedule* schedule);
+
+#endif /* _CD_SCHEDULE_H_ */
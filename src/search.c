@@ -18,11 +18,17 @@
 
 #include "search.h"
 #include "find.h"
+#include "record.h"
+#include "catalog.h"
+#include "sorted.h"
+#include "columns.h"
 
 #define CD_BASE_EXT     ".cdi"
 
 #define CD_FMT_BUFSIZE  256
 
+#define CD_VERDICTS_BITS    12  // Verdicts on names cached per catalog, as a power of two
+
 #define OK      1
 #define FAIL    0
 
@@ -33,9 +39,18 @@
 #define SLASH   1
 #define FORMAT  2
 
+// Verdict of the name expressions on the name at the offset in the heap
+typedef struct {
+    cd_offset heap;
+    size_t length;
+    int matches;
+} cd_find_verdict;
+
 typedef struct {
     const char* name;
     const char* filename;
+    cd_find_verdict* verdicts;  // While the catalog is searched, or NULL
+    uint8_t* seen;              // Records reached while the catalog is searched, a bit per record
 } cd_find_file;
 
 typedef struct __cd_find_path cd_find_path;
@@ -48,75 +63,123 @@ int cd_sort_file(const void* f1, const void* f2) {
     return strcasecmp((*(cd_find_file**)f1)->name, (*(cd_find_file**)f2)->name);
 }
 
-cd_offset cd_find_offset(int fd, const char* path) {
+// First file of the directory, and the number of its files if they are packed
+cd_offset cd_find_id(cd_catalog* catalog, cd_sorted* sorted, const char* path, cd_offset* count) {
+    *count = 0;
     if (path) {
         size_t length;
         const char* slash;
         cd_file_entry entry;
         const char* file = path;
-        cd_offset offset = sizeof(cd_iso_header);
+        cd_offset id = 1;
+        cd_offset dir = 0;
         while (file) {
             slash = strchr(file, '/');
             length = (slash) ? slash - file : strlen(file);
-            for (;;) {
-                lseek(fd, offset, SEEK_SET);
-                read(fd, (void*)&entry + sizeof(cd_offset), sizeof(cd_file_entry) - sizeof(cd_offset));
-                if (!strncmp(file, entry.name, length) && !entry.name[length]) {
-                    if ((entry.type == CD_DIR) && entry.child) {
-                        offset = sizeof(cd_iso_header) + (entry.child - 1) * (sizeof(cd_file_entry) - sizeof(cd_offset));
-                        break;
-                    } else {
-                        return 0;
-                    }
-                } else if (entry.next) {
-                    offset = sizeof(cd_iso_header) + (entry.next - 1) * (sizeof(cd_file_entry) - sizeof(cd_offset));
-                } else {
-                    return 0;
-                }
+            if (!cd_sorted_lookup(sorted, catalog, dir, id, *count, file, length, &entry)) return 0;
+            if ((entry.type == CD_DIR) && entry.child) {
+                id = entry.child;
+                dir = entry.id;
+                *count = entry.count;
+            } else {
+                return 0;
             }
             file = (slash && *(slash+1)) ? slash + 1 : NULL;
         }
-        return offset;
+        return id;
     } else {
-        return sizeof(cd_iso_header);
+        return 1;
     }
 }
 
-int cd_find_match(cd_file_entry* entry, cd_find_exp* exps) {
+// True for expressions on names, which need the record to be read
+static inline int cd_find_exp_name(cd_find_exp* exp) {
+    return ((exp->flags & FIND_MASK) == FIND_WILDCARD) || ((exp->flags & FIND_MASK) == FIND_REGEXP);
+}
+
+int cd_find_match_attr(cd_find_exp* exp, cd_type type, cd_size size, cd_time time) {
+    if ((exp->flags & FIND_MASK) == FIND_TYPE) {
+        if (type != exp->type) return false;
+    } else if ((exp->flags & FIND_MASK) == FIND_MTIME) {
+        time_t mtime = time;
+        struct tm* tm = localtime(&mtime);
+        tm->tm_sec = 0;
+        tm->tm_min = 0;
+        tm->tm_hour = 0;
+        mtime = mktime(tm);
+        if ((exp->flags & FIND_FLAGS) == FIND_LESS) {
+            if (mtime < exp->time) return false;
+        } else if ((exp->flags & FIND_FLAGS) == FIND_GREATER) {
+            if (mtime > exp->time) return false;
+        } else if (mtime != exp->time) return false;
+    } else if ((exp->flags & FIND_MASK) == FIND_SIZE) {
+        if ((exp->flags & FIND_FLAGS) == FIND_LESS) {
+            if (size > exp->size) return false;
+        } else if ((exp->flags & FIND_FLAGS) == FIND_GREATER) {
+            if (size < exp->size) return false;
+        } else if (size != exp->size) return false;
+    }
+    return true;
+}
+
+// True if there are expressions on types, sizes or times, which columns can check
+static int cd_find_attr(cd_find_exp* exps) {
     cd_find_exp* exp;
-    int matches = true;
     for (exp = exps; exp; exp = exp->next) {
-        if ((exp->flags & FIND_MASK) == FIND_WILDCARD) {
-            int flags = FNM_PATHNAME;
-            if ((exp->flags & FIND_FLAGS) == FIND_ICASE) flags |= FNM_CASEFOLD;
-            if (fnmatch(exp->wildcard, entry->name, flags)) return false;
-        } else if ((exp->flags & FIND_MASK) == FIND_REGEXP) {
-            if (regexec(exp->regex, entry->name, 0, NULL, 0)) return false;
-        } else if ((exp->flags & FIND_MASK) == FIND_TYPE) {
-            if (entry->type != exp->type) return false;
-        } else if ((exp->flags & FIND_MASK) == FIND_MTIME) {
-            time_t mtime = entry->mtime;
-            struct tm* tm = localtime(&mtime);
-            tm->tm_sec = 0;
-            tm->tm_min = 0;
-            tm->tm_hour = 0;
-            mtime = mktime(tm);
-            if ((exp->flags & FIND_FLAGS) == FIND_LESS) {
-                if (mtime < exp->time) return false;
-            } else if ((exp->flags & FIND_FLAGS) == FIND_GREATER) {
-                if (mtime > exp->time) return false;
-            } else if (mtime != exp->time) return false;
-        } else if ((exp->flags & FIND_MASK) == FIND_SIZE) {
-            if ((exp->flags & FIND_FLAGS) == FIND_LESS) {
-                if (entry->size > exp->size) return false;
-            } else if ((exp->flags & FIND_FLAGS) == FIND_GREATER) {
-                if (entry->size < exp->size) return false;
-            } else if (entry->size != exp->size) return false;
-        }
+        if (!cd_find_exp_name(exp)) return true;
+    }
+    return false;
+}
+
+// True if there are expressions on names, which verdicts are cached for
+static int cd_find_name(cd_find_exp* exps) {
+    cd_find_exp* exp;
+    for (exp = exps; exp; exp = exp->next) {
+        if (cd_find_exp_name(exp)) return true;
+    }
+    return false;
+}
+
+int cd_find_match_name(cd_find_exp* exp, const char* name) {
+    if ((exp->flags & FIND_MASK) == FIND_WILDCARD) {
+        int flags = FNM_PATHNAME;
+        if ((exp->flags & FIND_FLAGS) == FIND_ICASE) flags |= FNM_CASEFOLD;
+        if (fnmatch(exp->wildcard, name, flags)) return false;
+    } else if ((exp->flags & FIND_MASK) == FIND_REGEXP) {
+        if (regexec(exp->regex, name, 0, NULL, 0)) return false;
+    }
+    return true;
+}
+
+// Repeated names share their offset in the heap, so they are matched once
+static int cd_find_match_names(cd_file_entry* entry, cd_find_exp* exps, cd_find_file* file) {
+    cd_find_exp* exp;
+    cd_find_verdict* verdict = NULL;
+    size_t length = strnlen(entry->name, CD_NAME_MAX);
+    int matches = true;
+    if (file->verdicts && entry->heap) {
+        verdict = &file->verdicts[(entry->heap * 0x9E3779B97F4A7C15ull) >> (64 - CD_VERDICTS_BITS)];
+        if ((verdict->heap == entry->heap) && (verdict->length == length)) return verdict->matches;
+    }
+    for (exp = exps; matches && exp; exp = exp->next) {
+        if (cd_find_exp_name(exp) && !cd_find_match_name(exp, entry->name)) matches = false;
+    }
+    if (verdict) {
+        verdict->heap = entry->heap;
+        verdict->length = length;
+        verdict->matches = matches;
     }
     return matches;
 }
 
+int cd_find_match(cd_file_entry* entry, cd_find_exp* exps, cd_find_file* file) {
+    cd_find_exp* exp;
+    for (exp = exps; exp; exp = exp->next) {
+        if (!cd_find_exp_name(exp) && !cd_find_match_attr(exp, entry->type, entry->size, entry->mtime)) return false;
+    }
+    return cd_find_match_names(entry, exps, file);
+}
+
 int cd_get_path(char* buf, int buflen, const char* file, cd_find_path* path, const char* parent) {
     int len = 0;
     if (parent) {
@@ -155,7 +218,7 @@ static inline int isoctal(int c) {
     else return 0;
 }
 
-void cd_find_output(const char* fmt, cd_file_entry* entry, cd_find_path* path, const char* parent, cd_find_file* file) {
+void cd_find_output(cd_catalog* catalog, const char* fmt, cd_file_entry* entry, cd_find_path* path, const char* parent, cd_find_file* file) {
     if (fmt) {
         int i;
         int type = NONE;
@@ -211,18 +274,8 @@ void cd_find_output(const char* fmt, cd_file_entry* entry, cd_find_path* path, c
                 } else if (fmt[i] == 'k') printf("%lu", (entry->size / 1024));
                 else if (fmt[i] == 'l') {
                     if (entry->type == CD_LNK) {
-                        char* lpath = strdup(file->filename);
-                        lpath[strlen(file->filename)-1] = 'l';
-                        int fd = open(lpath, O_RDONLY);
-                        if (fd != -1) {
-                            lseek(fd, entry->info, SEEK_SET);
-                            char lbuf[entry->size+1];
-                            read(fd, lbuf, entry->size);
-                            lbuf[entry->size] = '\0';
-                            printf(lbuf);
-                            close(fd);
-                        }
-                        free(lpath);
+                        const char* link = (const char*)cd_catalog_sidecar_entry(catalog, CD_SLINKS_EXT, entry->info, entry->size);
+                        if (link) printf("%.*s", (int)entry->size, link);
                     }
                 } else if (fmt[i] == 'm') printf("%04o", (entry->mode & 0777));
                 else if (fmt[i] == 'M') {
@@ -280,35 +333,64 @@ void cd_find_output(const char* fmt, cd_file_entry* entry, cd_find_path* path, c
     }
 }
 
-void cd_find_in(int fd, cd_offset start, cd_find_path* path, cd_find_file* file, cd_find_req* req) {
+void cd_find_in(cd_catalog* catalog, cd_offset start, cd_offset count, cd_find_path* path, cd_find_file* file, cd_find_req* req);
+
+// False if the record was reached already, damaged links of files could loop
+static inline int cd_find_visit(cd_catalog* catalog, cd_find_file* file, cd_offset id) {
+    if ((id > catalog->records) || (file->seen[(id - 1) >> 3] & (1 << ((id - 1) & 7)))) {
+        catalog->damaged = 1;
+        return false;
+    }
+    file->seen[(id - 1) >> 3] |= 1 << ((id - 1) & 7);
+    return true;
+}
+
+void cd_find_entry(cd_catalog* catalog, cd_file_entry* entry, cd_find_path* path, cd_find_file* file, cd_find_req* req) {
+    if (cd_find_match(entry, req->exp, file)) {
+        cd_find_output(catalog, req->format, entry, path, req->path, file);
+    }
+    if (((entry->type == CD_DIR) || ((entry->type == CD_ARC) && !req->noarc)) && entry->child) {
+        cd_find_path element;
+        element.entry = entry;
+        element.prev = path;
+        cd_find_in(catalog, entry->child, entry->count, &element, file, req);
+    }
+}
+
+void cd_find_in(cd_catalog* catalog, cd_offset start, cd_offset count, cd_find_path* path, cd_find_file* file, cd_find_req* req) {
+    cd_catalog_iter iter;
+    cd_file_entry entry;
+    const cd_record* record;
+    for (cd_catalog_children(catalog, start, count, &iter); (record = cd_catalog_next(catalog, &iter)) &&
+         cd_find_visit(catalog, file, iter.id) && cd_catalog_unpack(catalog, record, iter.id, &entry);) {
+        cd_find_entry(catalog, &entry, path, file, req);
+    }
+}
+
+// Same as cd_find_in(), but only records of matching types, sizes and times are read, with their names
+void cd_find_columns(cd_catalog* catalog, cd_columns* columns, cd_offset start, cd_find_path* path, cd_find_file* file, cd_find_req* req) {
+    cd_offset id;
+    cd_find_exp* exp;
     cd_file_entry entry;
-    cd_offset offset = start;
-    for (;;) {
-        lseek(fd, offset, SEEK_SET);
-        read(fd, (void*)&entry + sizeof(cd_offset), sizeof(cd_file_entry) - sizeof(cd_offset));
-        if (cd_find_match(&entry, req->exp)) {
-            cd_find_output(req->format, &entry, path, req->path, file);
+    for (id = start; id && cd_find_visit(catalog, file, id); id = columns->next[id-1]) {
+        int matches = true;
+        int loaded = false;
+        for (exp = req->exp; matches && exp; exp = exp->next) {
+            if (!cd_find_exp_name(exp) && !cd_find_match_attr(exp, columns->type[id-1], columns->size[id-1], columns->mtime[id-1])) matches = false;
         }
-        if (entry.type == CD_DIR) {
-            if (entry.child) {
-                cd_find_path element;
-                element.entry = &entry;
-                element.prev = path;
-                cd_find_in(fd, sizeof(cd_iso_header) + (entry.child - 1) * (sizeof(cd_file_entry) - sizeof(cd_offset)),
-                    &element, file, req);
-            }
-        } else if (entry.type == CD_ARC) {
-            if (!req->noarc && entry.child) {
-                cd_find_path element;
-                element.entry = &entry;
-                element.prev = path;
-                cd_find_in(fd, sizeof(cd_iso_header) + (entry.child - 1) * (sizeof(cd_file_entry) - sizeof(cd_offset)),
-                    &element, file, req);
-            }
+        if (matches) {
+            if (!cd_catalog_entry(catalog, id, &entry)) break;
+            loaded = true;
+            if (cd_find_match_names(&entry, req->exp, file)) cd_find_output(catalog, req->format, &entry, path, req->path, file);
+        }
+        if (((columns->type[id-1] == CD_DIR) || ((columns->type[id-1] == CD_ARC) && !req->noarc)) && columns->child[id-1]) {
+            // Names of directories are needed for paths
+            if (!loaded && !cd_catalog_entry(catalog, id, &entry)) break;
+            cd_find_path element;
+            element.entry = &entry;
+            element.prev = path;
+            cd_find_columns(catalog, columns, columns->child[id-1], &element, file, req);
         }
-        if (entry.next) {
-            offset = sizeof(cd_iso_header) + (entry.next - 1) * (sizeof(cd_file_entry) - sizeof(cd_offset));
-        } else break;
     }
 }
 
@@ -330,6 +412,8 @@ int cd_search(const char* dir, cd_find_req* req) {
                     cd_find_file* file = (cd_find_file*)malloc(sizeof(cd_find_file));
                     file->name = name;
                     file->filename = strdup(f->d_name);
+                    file->verdicts = NULL;
+                    file->seen = NULL;
                     if (files) files = (cd_find_file**)realloc(files, sizeof(cd_find_file*) * (flen + 1));
                     else files = (cd_find_file**)malloc(sizeof(cd_find_file*));
                     files[flen] = file;
@@ -343,25 +427,49 @@ int cd_search(const char* dir, cd_find_req* req) {
         int i;
         if (strcmp(dir, "./")) chdir(dir);
         for (i = 0; i < flen; i++) {
-            int fd = open(files[i]->filename, O_RDONLY);
-            if (fd != -1) {
-                cd_index_mark mark;
-                read(fd, &mark, sizeof(cd_index_mark));
-                if (memcmp(mark.mark, CD_INDEX_MARK, CD_INDEX_MARK_LEN) != 0) {
+            cd_catalog* catalog = cd_catalog_open(files[i]->filename);
+            if (catalog) {
+                if (catalog->damaged) {
+                    printf("cdfind: warning: block 0 of cd index `%s' is damaged -- run `cdverify \"%s\"'\n", files[i]->filename, files[i]->filename);
+                } else if (memcmp(catalog->header.mark.mark, CD_INDEX_MARK, CD_INDEX_MARK_LEN) != 0) {
                     printf("cdfind: warning: invalid cd index `%s'\n", files[i]->filename);
-                } else if (mark.version != CD_INDEX_VERSION) {
-                    if (mark.version < CD_INDEX_VERSION) {
+                } else if (catalog->header.mark.version != CD_INDEX_VERSION) {
+                    if (catalog->header.mark.version < CD_INDEX_VERSION) {
                         printf("cdfind: warning: outdated cd index `%s' -- run `cdupgrade \"%s\"'\n", files[i]->filename, files[i]->filename);
                     } else {
                         printf("cdfind: warning: cd index version is not supported -- update cdfind\n");
                     }
+                } else if (catalog->names_fd != -1) {
+                    int verified = (req->verify) ? cd_catalog_verify(catalog) : 1;
+                    if (!verified) printf("cdfind: warning: no checksums of cd index `%s'\n", files[i]->filename);
+                    if (verified == -1) {
+                        printf("cdfind: warning: checksums do not match cd index `%s' -- run `cdverify \"%s\"'\n", files[i]->filename, files[i]->filename);
+                    } else {
+                        cd_sorted* sorted = (req->path) ? cd_sorted_open(catalog) : NULL;
+                        cd_offset count;
+                        cd_offset id = cd_find_id(catalog, sorted, req->path, &count);
+                        if (id) {
+                            if (cd_find_name(req->exp)) files[i]->verdicts = (cd_find_verdict*)calloc(1 << CD_VERDICTS_BITS, sizeof(cd_find_verdict));
+                            files[i]->seen = (uint8_t*)calloc(catalog->records / 8 + 1, 1);
+                            cd_columns* columns = (cd_find_attr(req->exp)) ? cd_columns_open(catalog) : NULL;
+                            if (columns) {
+                                cd_find_columns(catalog, columns, id, NULL, files[i], req);
+                                cd_columns_close(columns);
+                            } else {
+                                cd_find_in(catalog, id, count, NULL, files[i], req);
+                            }
+                            free(files[i]->seen);
+                            files[i]->seen = NULL;
+                            free(files[i]->verdicts);
+                            files[i]->verdicts = NULL;
+                        } // skip silently
+                        if (sorted) cd_sorted_close(sorted);
+                        if (catalog->damaged) printf("cdfind: warning: cd index `%s' is damaged -- run `cdverify \"%s\"'\n", files[i]->filename, files[i]->filename);
+                    }
                 } else {
-                    cd_offset offset = cd_find_offset(fd, req->path);
-                    if (offset) {
-                        cd_find_in(fd, offset, NULL, files[i], req);
-                    } // skip silently
-                    close(fd);
+                    printf("cdfind: warning: could not open names of cd index `%s'\n", files[i]->filename);
                 }
+                cd_catalog_close(catalog);
             } else {
                 printf("cdfind: warning: could not open cd index `%s'\n", files[i]->filename);
             }
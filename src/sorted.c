@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cdindex.h"
+#include "sorted.h"
+
+typedef struct {
+    const cd_record* records;
+    const char* names;
+} cd_sorted_maps;
+
+static int cd_sorted_compare_ids(const void* a, const void* b, void* data) {
+    const cd_sorted_maps* maps = (const cd_sorted_maps*)data;
+    const cd_record* first = &maps->records[*(const cd_offset*)a - 1];
+    const cd_record* second = &maps->records[*(const cd_offset*)b - 1];
+    return cd_sorted_compare(maps->names + first->name, first->length, maps->names + second->name, second->length);
+}
+
+int cd_sorted_build(const char* base_name, const char* heap_name) {
+    struct stat base_stat, names_stat;
+    cd_sorted_header header;
+    cd_sorted_maps maps;
+    cd_offset i, id, count, dirs = 0;
+    int result = 0;
+    int fd = open(base_name, O_RDONLY);
+    int names_fd = open(heap_name, O_RDONLY);
+    char* sorted_name = strdup(base_name);
+    sorted_name[strlen(base_name)-1] = 's';
+    FILE* file = fopen(sorted_name, "w");
+    if ((fd == -1) || (names_fd == -1) || !file || fstat(fd, &base_stat) || fstat(names_fd, &names_stat)) {
+        CD_LOG(CD_LOG_ERROR, "[error] failed to create sorted index: \"%s\"\n", sorted_name);
+        if (file) fclose(file);
+        unlink(sorted_name);
+        if (names_fd != -1) close(names_fd);
+        if (fd != -1) close(fd);
+        free(sorted_name);
+        return 0;
+    }
+    memcpy(&header.mark.mark, CD_SORTED_MARK, CD_INDEX_MARK_LEN);
+    header.mark.version = CD_SORTED_VERSION;
+    header.records = (base_stat.st_size - sizeof(cd_iso_header)) / CD_RECORD_SIZE;
+    header.names = names_stat.st_size;
+    // Records are mapped whole, with the header, so that the map stays aligned
+    char* base = (header.records) ? mmap(NULL, base_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    maps.names = (header.names) ? mmap(NULL, header.names, PROT_READ, MAP_PRIVATE, names_fd, 0) : NULL;
+    maps.records = (const cd_record*)(base + sizeof(cd_iso_header));
+    cd_offset* lists = (cd_offset*)calloc(header.records + 1, sizeof(cd_offset));
+    cd_offset* ids = (cd_offset*)malloc((header.records + 1) * sizeof(cd_offset));
+    if ((base != MAP_FAILED) && (maps.names != MAP_FAILED) && lists && ids &&
+        (fwrite(&header, sizeof(cd_sorted_header), 1, file) == 1) &&
+        (fwrite(lists, sizeof(cd_offset), header.records + 1, file) == header.records + 1)) {
+        off_t offset = CD_SORTED_SLOT(header.records + 1);
+        result = 1;
+        // Slot 0 is the root, its files are linked from the first record
+        for (i = 0; result && (i <= header.records); i++) {
+            if (i && !maps.records[i-1].child) continue;
+            count = 0;
+            for (id = (i) ? maps.records[i-1].child : 1; id && (id <= header.records) && (count < header.records); id = maps.records[id-1].next) {
+                if (maps.records[id-1].length && (maps.records[id-1].name + maps.records[id-1].length > header.names)) break;
+                ids[++count] = id;
+            }
+            if (!count) continue;
+            qsort_r(&ids[1], count, sizeof(cd_offset), cd_sorted_compare_ids, &maps);
+            ids[0] = count;
+            if (fwrite(ids, sizeof(cd_offset), count + 1, file) != count + 1) result = 0;
+            lists[i] = offset;
+            offset += (count + 1) * sizeof(cd_offset);
+            dirs++;
+        }
+        if (result && (fseeko(file, sizeof(cd_sorted_header), SEEK_SET) ||
+            (fwrite(lists, sizeof(cd_offset), header.records + 1, file) != header.records + 1))) result = 0;
+    }
+    if (fclose(file)) result = 0;
+    if (result) {
+        CD_LOG(CD_LOG_INFO, "[sorted] indexed names of %llu directories\n", (unsigned long long)dirs);
+    } else {
+        CD_LOG(CD_LOG_ERROR, "[error] failed to write sorted index: \"%s\"\n", sorted_name);
+        unlink(sorted_name);
+    }
+    free(ids);
+    free(lists);
+    if (maps.names && (maps.names != MAP_FAILED)) munmap((void*)maps.names, header.names);
+    if (base && (base != MAP_FAILED)) munmap(base, base_stat.st_size);
+    close(names_fd);
+    close(fd);
+    free(sorted_name);
+    return result;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_SORTED_H_
+#define _CD_SORTED_H_
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "data.h"
+#include "record.h"
+#include "catalog.h"
+
+#define CD_SORTED_EXT       ".cds"
+#define CD_SORTED_MARK      "CDS"
+#define CD_SORTED_VERSION   0x01
+
+// Followed by offsets of the lists for the root and then for each record,
+// 0 if there are no files, and by the lists: count and IDs sorted by name
+typedef struct {
+    cd_index_mark mark;
+    cd_offset records;      // Records of the index it was built for
+    cd_offset names;        // Size of the names heap it was built for
+} packed(cd_sorted_header);
+
+#define CD_SORTED_SLOT(ID) \
+    ((off_t)sizeof(cd_sorted_header) + (off_t)(ID) * sizeof(cd_offset))
+
+// Same order for the builder and lookups
+static inline int cd_sorted_compare(const char* name1, size_t length1, const char* name2, size_t length2) {
+    int result = memcmp(name1, name2, (length1 < length2) ? length1 : length2);
+    if (result) return result;
+    return (length1 < length2) ? -1 : (length1 > length2);
+}
+
+typedef struct {
+    const char* map;
+    size_t length;
+} cd_sorted;
+
+// Maps the sorted index next to the index, or returns NULL if there is none or it is stale
+static inline cd_sorted* cd_sorted_open(cd_catalog* catalog) {
+    size_t length;
+    const char* map = cd_catalog_map(catalog, CD_SORTED_EXT, &length);
+    if (!map) return NULL;
+    const cd_sorted_header* header = (const cd_sorted_header*)map;
+    if ((length < (size_t)CD_SORTED_SLOT(catalog->records + 1)) ||
+        memcmp(&header->mark.mark, CD_SORTED_MARK, CD_INDEX_MARK_LEN) || (header->mark.version != CD_SORTED_VERSION) ||
+        (header->records != catalog->records) || (header->names != catalog->names_length)) {
+        cd_catalog_unmap(map, length);
+        return NULL;
+    }
+    cd_sorted* sorted = (cd_sorted*)malloc(sizeof(cd_sorted));
+    sorted->map = map;
+    sorted->length = length;
+    return sorted;
+}
+
+static inline void cd_sorted_close(cd_sorted* sorted) {
+    cd_catalog_unmap(sorted->map, sorted->length);
+    free(sorted);
+}
+
+// Finds the file in the directory (0 for the root) by binary search, or with cd_catalog_lookup() without sorted index
+static inline int cd_sorted_lookup(cd_sorted* sorted, cd_catalog* catalog, cd_offset dir, cd_offset first, cd_offset count,
+                                   const char* name, size_t length, cd_file_entry* entry) {
+    cd_offset list, size, id;
+    cd_offset low = 0, high;
+    cd_record buffer;
+    char file[CD_NAME_MAX];
+    int result;
+    if (!sorted) return cd_catalog_lookup(catalog, first, count, name, length, entry);
+    if (dir > catalog->records) return 0;
+    memcpy(&list, sorted->map + CD_SORTED_SLOT(dir), sizeof(cd_offset));
+    if (!list || (list > sorted->length - sizeof(cd_offset))) return 0;
+    memcpy(&size, sorted->map + list, sizeof(cd_offset));
+    if (size > (sorted->length - list) / sizeof(cd_offset) - 1) return 0;
+    if (length > CD_NAME_MAX) length = CD_NAME_MAX;
+    for (high = size; low < high;) {
+        cd_offset middle = low + (high - low) / 2;
+        memcpy(&id, sorted->map + list + (middle + 1) * sizeof(cd_offset), sizeof(cd_offset));
+        const cd_record* record = cd_catalog_record(catalog, id, &buffer);
+        const char* other = (record) ? cd_catalog_name(catalog, record, file) : NULL;
+        if (!other) return 0;
+        result = cd_sorted_compare(name, length, other, record->length);
+        if (!result) return cd_catalog_entry(catalog, id, entry);
+        if (result < 0) high = middle;
+        else low = middle + 1;
+    }
+    return 0;
+}
+
+// Writes the sorted index for the index and its names heap, which must be complete
+int cd_sorted_build(const char* base_name, const char* heap_name);
+
+#endif /* _CD_SORTED_H_ */
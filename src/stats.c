@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "stats.h"
+
+#define CD_STATS_IO     "/proc/thread-self/io"
+
+static cd_stage* cd_stats_append(cd_stats* stats, const char* kind, const char* name) {
+    cd_stage* stage = (cd_stage*)calloc(1, sizeof(cd_stage));
+    stage->kind = strdup(kind);
+    stage->name = (name) ? strdup(name) : NULL;
+    if (stats->last) stats->last->next = stage;
+    else stats->first = stage;
+    stats->last = stage;
+    return stage;
+}
+
+cd_stats* cd_stats_create() {
+    cd_stats* stats = (cd_stats*)malloc(sizeof(cd_stats));
+    stats->first = NULL;
+    stats->last = NULL;
+    stats->walk = cd_stats_append(stats, "walk", NULL);
+    stats->stat = cd_stats_append(stats, "stat", NULL);
+    stats->symlink = cd_stats_append(stats, "symlink", NULL);
+    stats->record = cd_stats_append(stats, "record", NULL);
+    stats->start = cd_stats_now();
+    pthread_mutex_init(&stats->lock, NULL);
+    return stats;
+}
+
+cd_stage* cd_stats_stage(cd_stats* stats, const char* kind, const char* name) {
+    cd_stage* stage;
+    pthread_mutex_lock(&stats->lock);
+    for (stage = stats->first; stage; stage = stage->next) {
+        if (strcmp(stage->kind, kind)) continue;
+        if ((!stage->name && !name) || (stage->name && name && !strcmp(stage->name, name))) break;
+    }
+    if (!stage) stage = cd_stats_append(stats, kind, name);
+    pthread_mutex_unlock(&stats->lock);
+    return stage;
+}
+
+uint64_t cd_stats_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void cd_stats_io_read(cd_stats_io* io) {
+    char buf[512];
+    char* line;
+    memset(io, '\0', sizeof(cd_stats_io));
+    int fd = open(CD_STATS_IO, O_RDONLY);
+    if (fd == -1) return;
+    ssize_t bytes = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (bytes <= 0) return;
+    buf[bytes] = '\0';
+    for (line = buf; line; line = strchr(line, '\n')) {
+        if (*line == '\n') line++;
+        sscanf(line, "rchar: %llu", (unsigned long long*)&io->rchar);
+        sscanf(line, "wchar: %llu", (unsigned long long*)&io->wchar);
+        sscanf(line, "syscr: %llu", (unsigned long long*)&io->syscr);
+        sscanf(line, "syscw: %llu", (unsigned long long*)&io->syscw);
+    }
+    // Counters do not include this read yet
+    io->rchar += bytes;
+    io->syscr++;
+}
+
+void cd_stats_add(cd_stage* stage, uint64_t start, uint64_t count, uint64_t bytes, uint64_t syscalls) {
+    __atomic_add_fetch(&stage->count, count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stage->nsec, cd_stats_now() - start, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stage->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stage->syscalls, syscalls, __ATOMIC_RELAXED);
+}
+
+void cd_stats_add_io(cd_stage* stage, uint64_t start, cd_stats_io* io) {
+    cd_stats_io now;
+    cd_stats_io_read(&now);
+    uint64_t syscalls = (now.syscr - io->syscr) + (now.syscw - io->syscw);
+    // The first read of the counters is a read call itself
+    if (syscalls) syscalls--;
+    cd_stats_add(stage, start, 1, now.rchar - io->rchar, syscalls);
+}
+
+void cd_stats_print(cd_stats* stats) {
+    cd_stage* stage;
+    printf("[stats] total %.3f s\n", (cd_stats_now() - stats->start) / 1e9);
+    printf("[stats] %-10s %-12s %10s %12s %14s %10s\n", "stage", "name", "count", "time, s", "bytes", "syscalls");
+    for (stage = stats->first; stage; stage = stage->next) {
+        if (!stage->count) continue;
+        printf("[stats] %-10s %-12s %10llu %12.3f %14llu %10llu\n", stage->kind, (stage->name) ? stage->name : "",
+               (unsigned long long)stage->count, stage->nsec / 1e9,
+               (unsigned long long)stage->bytes, (unsigned long long)stage->syscalls);
+    }
+}
+
+static void cd_stats_string(FILE* file, const char* string) {
+    if (!string) {
+        fputs("null", file);
+        return;
+    }
+    fputc('"', file);
+    for (; *string; string++) {
+        if ((*string == '"') || (*string == '\\')) fputc('\\', file);
+        if ((unsigned char)*string >= 0x20) fputc(*string, file);
+    }
+    fputc('"', file);
+}
+
+void cd_stats_json(cd_stats* stats, FILE* file) {
+    cd_stage* stage;
+    fprintf(file, "{\"total_ns\":%llu,\"stages\":[", (unsigned long long)(cd_stats_now() - stats->start));
+    for (stage = stats->first; stage; stage = stage->next) {
+        fputs("{\"stage\":", file);
+        cd_stats_string(file, stage->kind);
+        fputs(",\"name\":", file);
+        cd_stats_string(file, stage->name);
+        fprintf(file, ",\"count\":%llu,\"ns\":%llu,\"bytes\":%llu,\"syscalls\":%llu}%s",
+                (unsigned long long)stage->count, (unsigned long long)stage->nsec,
+                (unsigned long long)stage->bytes, (unsigned long long)stage->syscalls,
+                (stage->next) ? "," : "");
+    }
+    fputs("]}\n", file);
+}
+
+void cd_stats_free(cd_stats* stats) {
+    cd_stage* next;
+    for (; stats->first; stats->first = next) {
+        next = stats->first->next;
+        free(stats->first->kind);
+        free(stats->first->name);
+        free(stats->first);
+    }
+    pthread_mutex_destroy(&stats->lock);
+    free(stats);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_STATS_H_
+#define _CD_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+typedef struct {
+    uint64_t rchar;         // Bytes read, page cache hits included
+    uint64_t wchar;         // Bytes written
+    uint64_t syscr;         // Read calls
+    uint64_t syscw;         // Write calls
+} cd_stats_io;
+
+typedef struct __cd_stage cd_stage;
+struct __cd_stage {
+    char* kind;             // Walk, stat, extractor, plugin...
+    char* name;             // Extractor or plugin name, or NULL
+    uint64_t count;         // Files, records or calls
+    uint64_t nsec;          // Time spent, summed over threads
+    uint64_t bytes;         // Bytes read or written
+    uint64_t syscalls;
+    cd_stage* next;
+};
+
+typedef struct {
+    cd_stage* first;
+    cd_stage* last;
+    cd_stage* walk;
+    cd_stage* stat;
+    cd_stage* symlink;
+    cd_stage* record;
+    uint64_t start;         // When indexing started
+    pthread_mutex_t lock;   // Guards the list of stages
+} cd_stats;
+
+cd_stats* cd_stats_create();
+
+cd_stage* cd_stats_stage(cd_stats* stats, const char* kind, const char* name);
+
+uint64_t cd_stats_now();
+
+void cd_stats_io_read(cd_stats_io* io);
+
+void cd_stats_add(cd_stage* stage, uint64_t start, uint64_t count, uint64_t bytes, uint64_t syscalls);
+
+void cd_stats_add_io(cd_stage* stage, uint64_t start, cd_stats_io* io);
+
+void cd_stats_print(cd_stats* stats);
+
+void cd_stats_json(cd_stats* stats, FILE* file);
+
+void cd_stats_free(cd_stats* stats);
+
+#endif /* _CD_STATS_H_ */
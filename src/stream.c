@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cdindex.h"
+#include "md5.h"
+#include "stream.h"
+
+#define CD_STREAM_SIZE      1024    // Initial number of files
+#define CD_MD5_EXT          ".md5"
+
+typedef struct {
+    cd_streamed* file;
+    int fd;
+    char* path;
+} cd_stream_active;
+
+typedef struct {
+    cd_stream_func func;
+    void* data;
+    char* path;
+} cd_stream_job;
+
+cd_stream* cd_stream_create(const char* device, const char* output) {
+    const char* dir = getenv("TMPDIR");
+    int fd = open(device, O_RDONLY|O_LARGEFILE);
+    if (fd == -1) {
+        CD_LOG(CD_LOG_ERROR, "[error] failed to open: \"%s\"\n", device);
+        return NULL;
+    }
+    cd_stream* stream = (cd_stream*)malloc(sizeof(cd_stream));
+    stream->fd = fd;
+    stream->device = strdup(device);
+    stream->output = (output) ? strdup(output) : NULL;
+    stream->dir = strdup((dir && *dir) ? dir : P_tmpdir);
+    stream->count = 0;
+    stream->size = CD_STREAM_SIZE;
+    stream->files = (cd_streamed*)malloc(stream->size * sizeof(cd_streamed));
+    return stream;
+}
+
+static char* cd_stream_suffix(const char* name) {
+    const char* suffix = strrchr(name, '.');
+    if (!suffix || (suffix == name) || (strlen(suffix) > CD_STREAM_SUFFIX)) return strdup("");
+    return strdup(suffix);
+}
+
+static int cd_stream_temp(cd_stream* stream, const char* suffix, char** path) {
+    *path = (char*)malloc(strlen(stream->dir) + strlen(suffix) + 18);
+    sprintf(*path, "%s/.cdindex.XXXXXX%s", stream->dir, suffix);
+    int fd = mkstemps(*path, strlen(suffix));
+    if (fd == -1) {
+        CD_LOG(CD_LOG_WARNING, "[warning] failed to create temporary file in %s\n", stream->dir);
+        free(*path);
+        *path = NULL;
+    }
+    return fd;
+}
+
+void cd_stream_add(cd_stream* stream, off_t offset, cd_size size, const char* name, cd_stream_func func, void* data) {
+    if (stream->count == stream->size) {
+        stream->size *= 2;
+        stream->files = (cd_streamed*)realloc(stream->files, stream->size * sizeof(cd_streamed));
+    }
+    stream->files[stream->count].offset = offset;
+    stream->files[stream->count].size = size;
+    stream->files[stream->count].order = stream->count;
+    stream->files[stream->count].suffix = cd_stream_suffix(name);
+    stream->files[stream->count].func = func;
+    stream->files[stream->count].data = data;
+    stream->count++;
+}
+
+char* cd_stream_copy(cd_stream* stream, off_t offset, cd_size size, const char* name) {
+    char* path;
+    ssize_t bytes = 0;
+    cd_size done;
+    char* suffix = cd_stream_suffix(name);
+    int fd = cd_stream_temp(stream, suffix, &path);
+    free(suffix);
+    if (fd == -1) return NULL;
+    char* buf = (char*)malloc(CD_STREAM_CHUNK);
+    for (done = 0; done < size; done += bytes) {
+        bytes = pread(stream->fd, buf, (size - done > CD_STREAM_CHUNK) ? CD_STREAM_CHUNK : size - done, offset + done);
+        if ((bytes <= 0) || (write(fd, buf, bytes) != bytes)) break;
+    }
+    free(buf);
+    close(fd);
+    if (done < size) {
+        CD_LOG(CD_LOG_ERROR, "[error] failed to read %llu bytes at %llu: \"%s\"\n",
+               (unsigned long long)size, (unsigned long long)offset, stream->device);
+        unlink(path);
+        free(path);
+        return NULL;
+    }
+    return path;
+}
+
+static int cd_stream_compare(const void* a, const void* b) {
+    const cd_streamed* first = (const cd_streamed*)a;
+    const cd_streamed* second = (const cd_streamed*)b;
+    if (first->offset != second->offset) return (first->offset < second->offset) ? -1 : 1;
+    return (first->order < second->order) ? -1 : (first->order > second->order);
+}
+
+static void cd_stream_job_run(void* data) {
+    cd_stream_job* job = (cd_stream_job*)data;
+    job->func(job->data, job->path);
+    unlink(job->path);
+    free(job->path);
+    free(job);
+}
+
+static void cd_stream_done(cd_stream_active* active, cd_pool* pool) {
+    if (active->fd == -1) {
+        if (active->path) {
+            unlink(active->path);
+            free(active->path);
+        }
+        active->file->func(active->file->data, NULL);
+        return;
+    }
+    close(active->fd);
+    cd_stream_job* job = (cd_stream_job*)malloc(sizeof(cd_stream_job));
+    job->func = active->file->func;
+    job->data = active->file->data;
+    job->path = active->path;
+    // Workers extract while the device keeps reading
+    if (pool) cd_pool_submit(pool, cd_stream_job_run, job, NULL);
+    else cd_stream_job_run(job);
+}
+
+static void cd_stream_checksum(cd_stream* stream, cd_md5* md5) {
+    int i;
+    unsigned char digest[CD_MD5_LEN];
+    char hex[CD_MD5_LEN * 2 + 1];
+    cd_md5_final(md5, digest);
+    for (i = 0; i < CD_MD5_LEN; i++) sprintf(&hex[i*2], "%02x", digest[i]);
+    CD_LOG(CD_LOG_INFO, "[stream] md5 %s\n", hex);
+    if (stream->output) {
+        // Same format as md5sum, so the copy can be checked with md5sum -c
+        char* path = (char*)malloc(strlen(stream->output) + strlen(CD_MD5_EXT) + 1);
+        sprintf(path, "%s" CD_MD5_EXT, stream->output);
+        FILE* file = fopen(path, "w");
+        if (file) {
+            const char* name = strrchr(stream->output, '/');
+            fprintf(file, "%s  %s\n", hex, (name) ? name + 1 : stream->output);
+            fclose(file);
+        } else {
+            CD_LOG(CD_LOG_WARNING, "[warning] failed to write checksum: \"%s\"\n", path);
+        }
+        free(path);
+    }
+}
+
+void cd_stream_run(cd_stream* stream, cd_pool* pool) {
+    cd_offset i, next = 0, count = 0;
+    ssize_t bytes;
+    off_t position = 0, end, from, to;
+    int ofd = -1;
+    cd_md5 md5;
+    cd_stream_active* active = (cd_stream_active*)malloc((stream->count + 1) * sizeof(cd_stream_active));
+    char* buf = (char*)malloc(CD_STREAM_CHUNK);
+    qsort(stream->files, stream->count, sizeof(cd_streamed), cd_stream_compare);
+    if (stream->output) {
+        ofd = open(stream->output, O_WRONLY|O_CREAT|O_TRUNC|O_LARGEFILE, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+        if (ofd == -1) CD_LOG(CD_LOG_ERROR, "[error] failed to create image: \"%s\"\n", stream->output);
+    }
+    cd_md5_init(&md5);
+    CD_LOG(CD_LOG_INFO, "[stream] reading \"%s\" for %llu files...\n", stream->device, (unsigned long long)stream->count);
+    for (;;) {
+        bytes = pread(stream->fd, buf, CD_STREAM_CHUNK, position);
+        if ((bytes == -1) && (errno == EINTR)) continue;
+        if (bytes == -1) CD_LOG(CD_LOG_ERROR, "[error] read failed at %llu: \"%s\"\n", (unsigned long long)position, stream->device);
+        if (bytes <= 0) break;
+        if ((ofd != -1) && (write(ofd, buf, bytes) != bytes)) {
+            CD_LOG(CD_LOG_ERROR, "[error] failed to write image: \"%s\"\n", stream->output);
+            close(ofd);
+            ofd = -1;
+        }
+        cd_md5_update(&md5, buf, bytes);
+        end = position + bytes;
+        // Files starting in this chunk
+        for (; (next < stream->count) && (stream->files[next].offset < end); next++, count++) {
+            active[count].file = &stream->files[next];
+            active[count].fd = cd_stream_temp(stream, stream->files[next].suffix, &active[count].path);
+        }
+        for (i = 0; i < count;) {
+            from = (active[i].file->offset > position) ? active[i].file->offset : position;
+            to = active[i].file->offset + active[i].file->size;
+            if (to > end) to = end;
+            if ((active[i].fd != -1) && (to > from) &&
+                (write(active[i].fd, &buf[from - position], to - from) != to - from)) {
+                CD_LOG(CD_LOG_ERROR, "[error] failed to write temporary file: \"%s\"\n", active[i].path);
+                close(active[i].fd);
+                active[i].fd = -1;
+            }
+            if (active[i].file->offset + (off_t)active[i].file->size <= end) {
+                cd_stream_done(&active[i], pool);
+                active[i] = active[--count];
+            } else {
+                i++;
+            }
+        }
+        position = end;
+    }
+    // Files that did not fit on what was read
+    for (i = 0; i < count; i++) {
+        if (active[i].fd != -1) close(active[i].fd);
+        active[i].fd = -1;
+        cd_stream_done(&active[i], pool);
+    }
+    for (; next < stream->count; next++) stream->files[next].func(stream->files[next].data, NULL);
+    CD_LOG(CD_LOG_INFO, "[stream] read %llu bytes\n", (unsigned long long)position);
+    if (ofd != -1) {
+        close(ofd);
+        cd_stream_checksum(stream, &md5);
+    } else if (!stream->output) {
+        cd_stream_checksum(stream, &md5);
+    }
+    for (i = 0; i < stream->count; i++) free(stream->files[i].suffix);
+    stream->count = 0;
+    free(buf);
+    free(active);
+}
+
+void cd_stream_free(cd_stream* stream) {
+    cd_offset i;
+    for (i = 0; i < stream->count; i++) free(stream->files[i].suffix);
+    free(stream->files);
+    close(stream->fd);
+    free((void*)stream->device);
+    free((void*)stream->output);
+    free((void*)stream->dir);
+    free(stream);
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_STREAM_H_
+#define _CD_STREAM_H_
+
+#include <sys/types.h>
+
+#include "data.h"
+#include "pool.h"
+
+#define CD_STREAM_CHUNK     1048576 // Bytes read from the device at once
+#define CD_STREAM_SUFFIX    16      // Longest extension kept on temporary files
+
+// Gets NULL if the data could not be read
+typedef void (*cd_stream_func)(void* data, const char* file);
+
+typedef struct {
+    off_t offset;           // Position of the data on the device
+    cd_size size;
+    cd_offset order;        // Keeps walk order for equal positions
+    char* suffix;           // Extension of the original name, for extractors that check it
+    cd_stream_func func;
+    void* data;
+} cd_streamed;
+
+typedef struct {
+    int fd;                 // Device or image
+    const char* device;
+    const char* output;     // Copy of the image or NULL
+    const char* dir;        // Where file contents are put for extractors
+    cd_streamed* files;
+    cd_offset count;
+    cd_offset size;
+} cd_stream;
+
+cd_stream* cd_stream_create(const char* device, const char* output);
+
+void cd_stream_add(cd_stream* stream, off_t offset, cd_size size, const char* name, cd_stream_func func, void* data);
+
+char* cd_stream_copy(cd_stream* stream, off_t offset, cd_size size, const char* name);
+
+void cd_stream_run(cd_stream* stream, cd_pool* pool);
+
+void cd_stream_free(cd_stream* stream);
+
+#endif /* _CD_STREAM_H_ */
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cdindex.h"
+#include "tree.h"
+
+#define CD_TREE_CHUNK       65536   // Records to allocate at once
+#define CD_TREE_BUFFER      4096    // Records to read or write at once
+
+#define CD_TREE_RECORD(TREE, ID) \
+    ((TREE)->records + ((ID) - (TREE)->first) * CD_ENTRY_SIZE)
+
+cd_tree* cd_tree_create(cd_offset first, const char* spill) {
+    cd_tree* tree = (cd_tree*)malloc(sizeof(cd_tree));
+    tree->records = NULL;
+    tree->first = first;
+    tree->count = 0;
+    tree->size = 0;
+    tree->spill_fd = -1;
+    tree->failed = 0;
+    if (spill) {
+        char* tpath = (char*)malloc(strlen(spill) + 16);
+        sprintf(tpath, "%s/cdindex.XXXXXX", spill);
+        tree->spill_fd = mkstemp(tpath);
+        if (tree->spill_fd != -1) {
+            unlink(tpath);
+        } else {
+            CD_LOG(CD_LOG_WARNING, "[warning] failed to create temporary file in %s\n", spill);
+        }
+        free(tpath);
+    }
+    return tree;
+}
+
+void cd_tree_free(cd_tree* tree) {
+    if (tree->spill_fd != -1) {
+        if (tree->records) munmap(tree->records, tree->size * CD_ENTRY_SIZE);
+        close(tree->spill_fd);
+    } else {
+        free(tree->records);
+    }
+    free(tree);
+}
+
+static int cd_tree_grow(cd_tree* tree, cd_offset count) {
+    cd_offset size = ((count / CD_TREE_CHUNK) + 1) * CD_TREE_CHUNK;
+    char* records;
+    if (tree->spill_fd != -1) {
+        if (ftruncate(tree->spill_fd, size * CD_ENTRY_SIZE) == -1) return 0;
+        if (tree->records) {
+            records = mremap(tree->records, tree->size * CD_ENTRY_SIZE, size * CD_ENTRY_SIZE, MREMAP_MAYMOVE);
+        } else {
+            records = mmap(NULL, size * CD_ENTRY_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, tree->spill_fd, 0);
+        }
+        if (records == MAP_FAILED) return 0;
+    } else {
+        records = (char*)realloc(tree->records, size * CD_ENTRY_SIZE);
+        if (!records) return 0;
+        memset(records + tree->size * CD_ENTRY_SIZE, '\0', (size - tree->size) * CD_ENTRY_SIZE);
+    }
+    tree->records = records;
+    tree->size = size;
+    return 1;
+}
+
+cd_tree* cd_tree_read(int fd, off_t offset) {
+    struct stat64 st;
+    if ((fstat64(fd, &st) == -1) || (st.st_size < offset)) return NULL;
+    cd_tree* tree = cd_tree_create(1, NULL);
+    cd_offset count = (st.st_size - offset) / CD_ENTRY_SIZE;
+    if (count && !cd_tree_grow(tree, count)) {
+        cd_tree_free(tree);
+        return NULL;
+    }
+    if (pread(fd, tree->records, count * CD_ENTRY_SIZE, offset) != count * CD_ENTRY_SIZE) {
+        cd_tree_free(tree);
+        return NULL;
+    }
+    tree->count = count;
+    return tree;
+}
+
+cd_tree* cd_tree_import(int fd, off_t offset, int names_fd) {
+    struct stat64 st;
+    struct stat64 nst;
+    cd_offset id, count, i = 0, chunk = 0;
+    cd_file_entry entry;
+    if ((fstat64(fd, &st) == -1) || (st.st_size < offset)) return NULL;
+    if ((names_fd == -1) || (fstat64(names_fd, &nst) == -1)) return NULL;
+    count = (st.st_size - offset) / CD_RECORD_SIZE;
+    cd_tree* tree = cd_tree_create(1, NULL);
+    if (count && !cd_tree_grow(tree, count)) {
+        cd_tree_free(tree);
+        return NULL;
+    }
+    // Names are read where records point, so the heap is mapped instead
+    char* names = (nst.st_size) ? mmap(NULL, nst.st_size, PROT_READ, MAP_PRIVATE, names_fd, 0) : NULL;
+    if (names == MAP_FAILED) {
+        cd_tree_free(tree);
+        return NULL;
+    }
+    cd_record* records = (cd_record*)malloc(CD_TREE_BUFFER * CD_RECORD_SIZE);
+    for (id = 1; id <= count; id++, i++) {
+        if (i == chunk) {
+            chunk = (count - id + 1 > CD_TREE_BUFFER) ? CD_TREE_BUFFER : count - id + 1;
+            if (pread(fd, records, chunk * CD_RECORD_SIZE, offset + (id - 1) * CD_RECORD_SIZE) != chunk * CD_RECORD_SIZE) break;
+            i = 0;
+        }
+        if (records[i].length && (records[i].name + records[i].length > (cd_offset)nst.st_size)) break;
+        cd_record_unpack(&records[i], id, &entry);
+        memset(entry.name, '\0', CD_NAME_MAX);
+        memcpy(entry.name, names + records[i].name, records[i].length);
+        entry.heap = 0;
+        memcpy(CD_TREE_RECORD(tree, id), (void*)&entry + sizeof(cd_offset), CD_ENTRY_SIZE);
+    }
+    free(records);
+    if (names) munmap(names, nst.st_size);
+    if (id <= count) {
+        cd_tree_free(tree);
+        return NULL;
+    }
+    tree->count = count;
+    return tree;
+}
+
+void cd_tree_save(cd_tree* tree, cd_file_entry* entry) {
+    cd_offset index = entry->id - tree->first;
+    if (index >= tree->size) {
+        if (!cd_tree_grow(tree, index + 1)) {
+            CD_LOG(CD_LOG_ERROR, "[error] out of memory: \"%s\" (%llu)\n", entry->name, (unsigned long long)entry->id);
+            tree->failed = 1;
+            return;
+        }
+    }
+    DEBUG_OUTPUT(DEBUG_BASEIO, "storing record #%llu\n", (unsigned long long)entry->id);
+    memcpy(CD_TREE_RECORD(tree, entry->id), (void*)entry + sizeof(cd_offset), CD_ENTRY_SIZE);
+    if (index >= tree->count) tree->count = index + 1;
+}
+
+int cd_tree_load(cd_tree* tree, cd_offset id, cd_file_entry* entry) {
+    if ((id >= tree->first) && (id - tree->first < tree->count)) {
+        memcpy((void*)entry + sizeof(cd_offset), CD_TREE_RECORD(tree, id), CD_ENTRY_SIZE);
+        entry->id = id;
+        return 1;
+    }
+    return 0;
+}
+
+static int cd_tree_write(int fd, const char* data, size_t length, off_t offset) {
+    ssize_t bytes;
+    while (length > 0) {
+        bytes = pwrite(fd, data, length, offset);
+        if (bytes <= 0) return 0;
+        data += bytes;
+        offset += bytes;
+        length -= bytes;
+    }
+    return 1;
+}
+
+int cd_tree_flush(cd_tree* tree, int fd, off_t offset, int names_fd, cd_hash* interned) {
+    cd_offset id, count = 0;
+    size_t length = 0;
+    cd_file_entry entry;
+    int result = 1;
+    off_t heap = lseek(names_fd, 0, SEEK_END);
+    if (heap == -1) return 0;
+    cd_record* records = (cd_record*)malloc(CD_TREE_BUFFER * CD_RECORD_SIZE);
+    char* names = (char*)malloc(CD_TREE_BUFFER * CD_NAME_MAX);
+    for (id = tree->first; id < tree->first + tree->count; id++) {
+        cd_tree_load(tree, id, &entry);
+        size_t size = strnlen(entry.name, CD_NAME_MAX);
+        entry.heap = (interned && size) ? cd_hash_get(interned, entry.name, size) : 0;
+        if (!entry.heap) {
+            entry.heap = heap + length;
+            memcpy(names + length, entry.name, size);
+            length += size;
+            if (interned && size && (interned->count < CD_NAMES_INTERNED)) cd_hash_set(interned, entry.name, size, entry.heap);
+        }
+        cd_record_pack(&entry, &records[count]);
+        if ((++count < CD_TREE_BUFFER) && (id + 1 < tree->first + tree->count)) continue;
+        if (!cd_tree_write(fd, (const char*)records, count * CD_RECORD_SIZE, offset) ||
+            !cd_tree_write(names_fd, names, length, heap)) {
+            CD_LOG(CD_LOG_ERROR, "[error] failed to write %llu records\n", (unsigned long long)(tree->first + tree->count - id + count - 1));
+            result = 0;
+            break;
+        }
+        offset += count * CD_RECORD_SIZE;
+        heap += length;
+        count = 0;
+        length = 0;
+    }
+    free(names);
+    free(records);
+    return result && !tree->failed;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_TREE_H_
+#define _CD_TREE_H_
+
+#include <sys/types.h>
+
+#include "data.h"
+#include "record.h"
+#include "hash.h"
+
+#define CD_ENTRY_SIZE       (sizeof(cd_file_entry) - sizeof(cd_offset))
+
+typedef struct {
+    char* records;          // Entries without id, names included
+    cd_offset first;        // ID of the first record
+    cd_offset count;        // Number of records stored
+    cd_offset size;         // Number of records allocated
+    int spill_fd;           // Temporary file backing records or -1
+    int failed;             // Some record could not be stored
+} cd_tree;
+
+cd_tree* cd_tree_create(cd_offset first, const char* spill);
+
+void cd_tree_free(cd_tree* tree);
+
+// Reads entries stored as is, like in the cache
+cd_tree* cd_tree_read(int fd, off_t offset);
+
+// Reads index records with their names, entries are not in the names heap of the new index
+cd_tree* cd_tree_import(int fd, off_t offset, int names_fd);
+
+void cd_tree_save(cd_tree* tree, cd_file_entry* entry);
+
+int cd_tree_load(cd_tree* tree, cd_offset id, cd_file_entry* entry);
+
+// Writes index records, names are appended to the names heap unless interned has them;
+// returns 0 if they could not be written or some of them were not stored
+int cd_tree_flush(cd_tree* tree, int fd, off_t offset, int names_fd, cd_hash* interned);
+
+#endif /* _CD_TREE_H_ */
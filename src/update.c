@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cdindex.h"
+#include "update.h"
+
+#define CD_DIRS_SIZE    1024    // Initial size of directory IDs map
+
+static char* cd_previous_name(const char* path) {
+    char* name = (char*)malloc(strlen(path) + strlen(CD_PREVIOUS_EXT) + 1);
+    strcpy(name, path);
+    strcat(name, CD_PREVIOUS_EXT);
+    return name;
+}
+
+static void cd_remove_dir(const char* path) {
+    struct dirent* file;
+    DIR* dir = opendir(path);
+    if (!dir) return;
+    while ((file = readdir(dir))) {
+        if (strcmp(file->d_name, ".") && strcmp(file->d_name, "..")) unlinkat(dirfd(dir), file->d_name, 0);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+int cd_open_previous(const char* path) {
+    int fd = -1;
+    char* previous = cd_previous_name(path);
+    // Keep the previous file under another name, as the new one replaces it
+    if (rename(path, previous) == 0) fd = open(previous, O_RDONLY);
+    free(previous);
+    return fd;
+}
+
+void cd_close_previous(int fd, const char* path) {
+    char* previous = cd_previous_name(path);
+    if (fd != -1) close(fd);
+    unlink(previous);
+    free(previous);
+}
+
+int cd_relink_thumbnail(const char* dir, const char* from, const char* to) {
+    char* fpath = (char*)malloc(strlen(dir) + strlen(CD_PREVIOUS_EXT) + strlen(from) + 2);
+    sprintf(fpath, "%s" CD_PREVIOUS_EXT "/%s", dir, from);
+    char* tpath = (char*)malloc(strlen(dir) + strlen(to) + 2);
+    sprintf(tpath, "%s/%s", dir, to);
+    int result = rename(fpath, tpath);
+    free(tpath);
+    free(fpath);
+    return (result == 0);
+}
+
+static void cd_update_key(char* key, cd_offset parent, const char* name, size_t length) {
+    memcpy(key, &parent, sizeof(cd_offset));
+    memcpy(key + sizeof(cd_offset), name, length);
+}
+
+cd_update* cd_update_open(const char* base_name, const char* slinks_name, const char* images_name, const char* heap_name) {
+    cd_offset id;
+    size_t length;
+    cd_iso_header header;
+    cd_file_entry previous;
+    char key[sizeof(cd_offset) + CD_NAME_MAX];
+    int fd = cd_open_previous(base_name);
+    if (fd == -1) {
+        CD_LOG(CD_LOG_WARNING, "[warning] no previous index, indexing everything: \"%s\"\n", base_name);
+        return NULL;
+    }
+    if ((read(fd, &header, sizeof(cd_iso_header)) != sizeof(cd_iso_header)) ||
+        memcmp(&header.mark.mark, CD_INDEX_MARK, CD_INDEX_MARK_LEN) || (header.mark.version != CD_INDEX_VERSION)) {
+        CD_LOG(CD_LOG_WARNING, "[warning] unsupported previous index, indexing everything: \"%s\"\n", base_name);
+        cd_close_previous(fd, base_name);
+        return NULL;
+    }
+    cd_update* update = (cd_update*)malloc(sizeof(cd_update));
+    int heap_fd = cd_open_previous(heap_name);
+    update->tree = cd_tree_import(fd, sizeof(cd_iso_header), heap_fd);
+    close(fd);
+    // Names are in the tree now, the file is kept until the new index is complete
+    if (heap_fd != -1) close(heap_fd);
+    if (!update->tree) {
+        CD_LOG(CD_LOG_WARNING, "[warning] failed to read previous index, indexing everything: \"%s\"\n", base_name);
+        cd_close_previous(-1, base_name);
+        cd_close_previous(-1, heap_name);
+        free(update);
+        return NULL;
+    }
+    memcpy(&update->header, &header, sizeof(cd_iso_header));
+    update->base_name = strdup(base_name);
+    update->heap_name = strdup(heap_name);
+    update->slinks_name = strdup(slinks_name);
+    update->slinks_fd = cd_open_previous(slinks_name);
+    update->images_name = strdup(images_name);
+    update->images_fd = cd_open_previous(images_name);
+    update->dir = strndup(base_name, strlen(base_name) - 4);
+    char* dir = cd_previous_name(update->dir);
+    cd_remove_dir(dir);
+    rename(update->dir, dir);
+    free(dir);
+    update->names = cd_hash_create(update->tree->count);
+    update->dirs = cd_hash_create(CD_DIRS_SIZE);
+    for (id = 1; id <= update->tree->count; id++) {
+        if (!cd_tree_load(update->tree, id, &previous)) continue;
+        length = strnlen(previous.name, CD_NAME_MAX);
+        cd_update_key(key, previous.parent, previous.name, length);
+        cd_hash_set(update->names, key, sizeof(cd_offset) + length, id);
+    }
+    CD_LOG(CD_LOG_INFO, "[update] loaded %llu previous records\n", (unsigned long long)update->tree->count);
+    return update;
+}
+
+void cd_update_close(cd_update* update) {
+    cd_close_previous(-1, update->base_name);
+    cd_close_previous(-1, update->heap_name);
+    cd_close_previous(update->slinks_fd, update->slinks_name);
+    cd_close_previous(update->images_fd, update->images_name);
+    // Thumbnails that were reused are moved already
+    char* dir = cd_previous_name(update->dir);
+    cd_remove_dir(dir);
+    free(dir);
+    cd_hash_free(update->names);
+    cd_hash_free(update->dirs);
+    cd_tree_free(update->tree);
+    free((void*)update->base_name);
+    free((void*)update->heap_name);
+    free((void*)update->slinks_name);
+    free((void*)update->images_name);
+    free((void*)update->dir);
+    free(update);
+}
+
+int cd_update_lookup(cd_update* update, cd_offset parent, const char* name, cd_file_entry* previous) {
+    char key[sizeof(cd_offset) + CD_NAME_MAX];
+    size_t length = strnlen(name, CD_NAME_MAX);
+    cd_update_key(key, parent, name, length);
+    cd_offset id = cd_hash_get(update->names, key, sizeof(cd_offset) + length);
+    return (id && cd_tree_load(update->tree, id, previous));
+}
+
+int cd_update_find(cd_update* update, cd_file_entry* parent, cd_file_entry* entry, cd_file_entry* previous) {
+    cd_offset id = 0;
+    if (parent) {
+        id = cd_hash_get(update->dirs, &parent->id, sizeof(cd_offset));
+        if (!id) return 0;
+    }
+    if (!cd_update_lookup(update, id, entry->name, previous)) return 0;
+    // Archives are regular files too, anything else must be of the same type
+    if (((entry->type == CD_DIR) != (previous->type == CD_DIR)) ||
+        ((entry->type == CD_LNK) != (previous->type == CD_LNK))) return 0;
+    if (entry->type == CD_DIR) cd_hash_set(update->dirs, &entry->id, sizeof(cd_offset), previous->id);
+    return 1;
+}
+
+cd_offset cd_update_count(cd_update* update, cd_offset id) {
+    cd_file_entry previous;
+    cd_offset count = 0;
+    if (!cd_tree_load(update->tree, id, &previous)) return 0;
+    for (id = previous.child; id; id = previous.next) {
+        if (!cd_tree_load(update->tree, id, &previous)) break;
+        count += 1 + cd_update_count(update, id);
+    }
+    return count;
+}
+
+int cd_update_list_open(cd_update* update, cd_file_entry* dir, cd_update_list* list) {
+    cd_file_entry previous;
+    cd_offset id = cd_hash_get(update->dirs, &dir->id, sizeof(cd_offset));
+    if (!id || !cd_tree_load(update->tree, id, &previous)) return 0;
+    // Names are added to or removed from a directory only with its mtime
+    if (previous.mtime != dir->mtime) return 0;
+    list->next = previous.child;
+    return 1;
+}
+
+const char* cd_update_list_read(cd_update* update, cd_update_list* list) {
+    cd_file_entry previous;
+    if (!list->next || !cd_tree_load(update->tree, list->next, &previous)) return NULL;
+    memcpy(list->name, previous.name, CD_NAME_MAX);
+    list->name[CD_NAME_MAX] = '\0';
+    list->next = previous.next;
+    return list->name;
+}
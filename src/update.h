@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_UPDATE_H_
+#define _CD_UPDATE_H_
+
+#include "data.h"
+#include "tree.h"
+#include "hash.h"
+
+#define CD_PREVIOUS_EXT     ".old"
+
+typedef struct {
+    const char* base_name;  // Previous index, renamed
+    const char* dir;        // Previous thumbnails directory, renamed
+    const char* slinks_name;
+    const char* images_name;
+    const char* heap_name;  // Previous names heap, renamed
+    int slinks_fd;
+    int images_fd;
+    cd_iso_header header;   // Of the previous index
+    cd_tree* tree;          // Previous records
+    cd_hash* names;         // Previous parent ID and name -> ID
+    cd_hash* dirs;          // Directory ID -> previous ID
+} cd_update;
+
+typedef struct {
+    cd_offset next;         // Next previous record to list
+    char name[CD_NAME_MAX+1];
+} cd_update_list;
+
+cd_update* cd_update_open(const char* base_name, const char* slinks_name, const char* images_name, const char* heap_name);
+
+void cd_update_close(cd_update* update);
+
+int cd_update_lookup(cd_update* update, cd_offset parent, const char* name, cd_file_entry* previous);
+
+int cd_update_find(cd_update* update, cd_file_entry* parent, cd_file_entry* entry, cd_file_entry* previous);
+
+cd_offset cd_update_count(cd_update* update, cd_offset id);
+
+int cd_update_list_open(cd_update* update, cd_file_entry* dir, cd_update_list* list);
+
+const char* cd_update_list_read(cd_update* update, cd_update_list* list);
+
+int cd_open_previous(const char* path);
+
+void cd_close_previous(int fd, const char* path);
+
+int cd_relink_thumbnail(const char* dir, const char* from, const char* to);
+
+#endif /* _CD_UPDATE_H_ */
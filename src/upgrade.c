@@ -3,6 +3,7 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -11,7 +12,14 @@
 #include <stdio.h>
 #include <regex.h>
 
+#include "base.h"
 #include "data.h"
+#include "catalog.h"
+#include "audio.h"
+#include "image.h"
+#include "video.h"
+
+#define CD_BASE_EXT     ".cdi"
 
 typedef struct {
     cd_index_mark mark;
@@ -26,7 +34,7 @@ typedef struct {
 } packed(cd_iso_header_v1); // was 433
 
 typedef struct  {
-    cd_offset id;
+    uint32_t id;
     cd_type type;
     char name[CD_NAME_MAX];
     cd_mode mode;
@@ -34,41 +42,132 @@ typedef struct  {
     cd_uid uid;
     cd_gid gid;
     uint32_t size;          // v2: cd_size change to uint64_t
+    uint32_t info;
+    uint32_t parent;
+    uint32_t child;
+    uint32_t next;
+} packed(cd_file_entry_v1); // was 286 + 4 of id
+
+typedef struct  {
+    uint32_t id;
+    cd_type type;
+    char name[CD_NAME_MAX];
+    cd_mode mode;
+    cd_time mtime;
+    cd_uid uid;
+    cd_gid gid;
+    cd_size size;
+    uint32_t info;          // v3: cd_offset change to uint64_t
+    uint32_t parent;
+    uint32_t child;
+    uint32_t next;
+} packed(cd_file_entry_v2); // was 290 + 4 of id
+
+typedef struct  {
+    cd_offset id;
+    cd_type type;
+    char name[CD_NAME_MAX]; // v4: moved to the names heap
+    cd_mode mode;
+    cd_time mtime;
+    cd_uid uid;
+    cd_gid gid;
+    cd_size size;
     cd_offset info;
     cd_offset parent;
     cd_offset child;
     cd_offset next;
-} packed(cd_file_entry_v1); // was 286 + 4 of id
+} packed(cd_file_entry_v3); // was 306 + 8 of id
+
+typedef struct {
+    cd_type type;
+    cd_byte length;
+    cd_mode mode;
+    cd_time mtime;
+    cd_uid uid;
+    cd_gid gid;
+    cd_size size;
+    cd_offset name;
+    cd_offset info;
+    cd_offset parent;
+    cd_offset child;
+    cd_offset next;         // v5: followed by the number of files stored one after another
+} packed(cd_record_v4);     // was 60
+
+// Sidecars of v2 indexes are v1, with 32-bit IDs and offsets
+
+typedef struct {
+    uint32_t offset;        // v2: cd_offset change to uint64_t
+    char data[sizeof(cd_picture_entry) - sizeof(cd_offset)];
+} packed(cd_picture_entry_v1);
+
+typedef struct {
+    uint32_t offset;        // v2: cd_offset change to uint64_t
+    char data[sizeof(cd_audio_entry) - sizeof(cd_offset)];
+} packed(cd_audio_entry_v1);
+
+typedef struct {
+    uint32_t offset;        // v2: cd_offset change to uint64_t
+    char video[offsetof(cd_video_entry, audio) - offsetof(cd_video_entry, seconds)];
+    uint32_t audio;         // v2: cd_offset change to uint64_t
+    char data[sizeof(cd_video_entry) - offsetof(cd_video_entry, vstreams)];
+} packed(cd_video_entry_v1);
+
+typedef struct {
+    uint32_t offset;        // v2: cd_offset change to uint64_t
+    char data[sizeof(cd_stream_entry) - sizeof(cd_offset)];
+} packed(cd_stream_entry_v1);
+
+typedef struct {
+    const char* ext;
+    const char* mark;
+    size_t mark_len;        // Followed by the version
+    size_t size;            // Size of v1 entry
+    size_t new_size;        // Size of v2 entry
+    cd_byte version;        // Of v2 sidecar
+    int fd;                 // Backup of v1 sidecar or -1
+} cd_sidecar_v1;
+
+#define CD_SIDECAR_PICTURES 0
+#define CD_SIDECAR_MUSIC    1
+#define CD_SIDECAR_VIDEOS   2
+#define CD_SIDECAR_STREAMS  3
+#define CD_SIDECARS         4
 
 cd_byte cd_get_index_version(const char* path) {
     cd_byte ver = 0x00;
-    int fd = open(path, O_RDONLY);
-    if (fd != -1) {
-        cd_index_mark mark;
-        if ((read(fd, (void*)&mark, sizeof(cd_index_mark)) == sizeof(cd_index_mark)) &&
-            (memcmp(mark.mark, CD_INDEX_MARK, CD_INDEX_MARK_LEN) == 0)) {
-            ver = mark.version;
+    cd_catalog* catalog = cd_catalog_open(path);
+    if (catalog) {
+        if (catalog->damaged) {
+            printf("[error] block 0 of %s is damaged\n", path);
+        } else if (memcmp(catalog->header.mark.mark, CD_INDEX_MARK, CD_INDEX_MARK_LEN) == 0) {
+            ver = catalog->header.mark.version;
         } else {
             printf("[error] %s is not cd index\n", path);
         }
-        close(fd);
+        cd_catalog_close(catalog);
     } else {
         printf("[error] could not open %s\n", path);
     }
     return ver;
 }
 
+// Copies bytes of the previous index, which are converted anyway
+static int cd_upgrade_read(cd_catalog* catalog, off_t offset, void* buf, size_t size) {
+    const void* data = cd_catalog_data(catalog, offset, size, buf);
+    if (data && (data != buf)) memcpy(buf, data, size);
+    return (data != NULL);
+}
+
 int cd_upgrade_v1_to_v2(const char* v1, const char* v2) {
     int ret = EXIT_SUCCESS;
-    int fd1 = open(v1, O_RDONLY);
-    if (fd1 != -1) {
-        struct stat stat1, stat2;
-        fstat(fd1, &stat1);
+    cd_catalog* catalog = cd_catalog_open(v1);
+    if (catalog) {
+        struct stat stat2;
         int fd2 = open(v2, O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
         if (fd2 != -1) {
             cd_size datasize = 0;
             cd_iso_header header2;
-            cd_file_entry entry2;
+            cd_file_entry_v2 entry2;
             cd_iso_header_v1 header1;
             cd_file_entry_v1 entry1;
             regex_t* iregex = (regex_t*)malloc(sizeof(regex_t));
@@ -80,18 +179,18 @@ int cd_upgrade_v1_to_v2(const char* v1, const char* v2) {
             char buf[CD_NAME_MAX+1];
             buf[CD_NAME_MAX] = '\0';
             int invsizes = 0, files = 0, images = 0, rimages = 0, videos = 0;
-            ssize_t bytes = read(fd1, (void*)&header1, sizeof(cd_iso_header_v1));
+            off_t bytes = (cd_upgrade_read(catalog, 0, &header1, sizeof(cd_iso_header_v1))) ? sizeof(cd_iso_header_v1) : 0;
             memcpy(&header2, &header1, (void*)&header1.size - (void*)&header1);
             header2.mark.version = 0x02;
             header2.size = (cd_size)header1.size * 2048;
             memcpy(&header2.publisher, &header1.publisher, sizeof(cd_iso_header_v1) - ((void*)&header1.publisher - (void*)&header1));
             write(fd2, &header2, sizeof(cd_iso_header));
-            while ((bytes < stat1.st_size) && ((stat1.st_size - bytes) >= (sizeof(cd_file_entry_v1) - sizeof(cd_offset)))) {
-                bytes += read(fd1, (void*)&entry1 + sizeof(cd_offset), sizeof(cd_file_entry_v1) - sizeof(cd_offset));
+            while (bytes && cd_upgrade_read(catalog, bytes, (void*)&entry1 + sizeof(uint32_t), sizeof(cd_file_entry_v1) - sizeof(uint32_t))) {
+                bytes += sizeof(cd_file_entry_v1) - sizeof(uint32_t);
                 memcpy(&entry2, &entry1, (void*)&entry1.size - (void*)&entry1);
                 entry2.size = entry1.size;
                 memcpy(&entry2.info, &entry1.info, sizeof(cd_file_entry_v1) - ((void*)&entry1.info - (void*)&entry1));
-                write(fd2, (void*)&entry2 + sizeof(cd_offset), sizeof(cd_file_entry) - sizeof(cd_offset));
+                write(fd2, (void*)&entry2 + sizeof(uint32_t), sizeof(cd_file_entry_v2) - sizeof(uint32_t));
                 if (entry1.size == 0xffffffff) {
                     printf("[warning] invalid size of large file %.*s\n", CD_NAME_MAX, entry1.name);
                     invsizes++;
@@ -113,17 +212,284 @@ int cd_upgrade_v1_to_v2(const char* v1, const char* v2) {
             free(riregex);
             free(vregex);
             close(fd2);
-            if (bytes != stat1.st_size) printf("[warning] %ld bytes read and file size is %ld\n", bytes, stat1.st_size);
-            printf("[info] file size: %ld => %ld, ISO size: %lu (%u), data size: ~%lu (files: %d)\n", stat1.st_size, stat2.st_size, header2.size, header1.size, datasize, files);
+            if (bytes != catalog->length) printf("[warning] %ld bytes read and file size is %ld\n", bytes, (long)catalog->length);
+            printf("[info] file size: %ld => %ld, ISO size: %lu (%u), data size: ~%lu (files: %d)\n", (long)catalog->length, stat2.st_size, header2.size, header1.size, datasize, files);
             printf("[info] invalid sizes: %d, images: %d (raw: +%d), videos: %d\n", invsizes, images, rimages, videos);
         } else {
             printf("[error] could not create %s\n", v2);
             ret = EXIT_FAILURE;
         }
+        cd_catalog_close(catalog);
+    } else {
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
+
+static cd_offset cd_sidecar_offset(cd_sidecar_v1* sidecar, uint32_t offset) {
+    size_t mark = sidecar->mark_len + 1;
+    return mark + (cd_offset)((offset - mark) / sidecar->size) * sidecar->new_size;
+}
+
+// Whether the offset is an entry of this sidecar, which belongs to the record
+static int cd_sidecar_owns(cd_sidecar_v1* sidecar, uint32_t offset, uint32_t id) {
+    uint32_t owner;
+    size_t mark = sidecar->mark_len + 1;
+    if ((sidecar->fd == -1) || (offset < mark) || ((offset - mark) % sidecar->size)) return 0;
+    return (pread(sidecar->fd, &owner, sizeof(uint32_t), offset) == sizeof(uint32_t)) && (owner == id);
+}
+
+int cd_upgrade_sidecar_v1(cd_sidecar_v1* sidecars, int index, const char* base) {
+    int ret = EXIT_SUCCESS;
+    char mark[8];
+    cd_size count = 0;
+    cd_sidecar_v1* sidecar = &sidecars[index];
+    char* path = (char*)malloc(strlen(base) + strlen(sidecar->ext) + 1);
+    strcpy(path, base);
+    strcpy(&path[strlen(base)-4], sidecar->ext);
+    int fd1 = open(path, O_RDONLY);
+    if (fd1 == -1) {
+        free(path);
+        return ret;
+    }
+    char* bck = (char*)malloc(strlen(path) + 2);
+    sprintf(bck, "%s~", path);
+    if ((read(fd1, mark, sidecar->mark_len + 1) != sidecar->mark_len + 1) ||
+        (memcmp(mark, sidecar->mark, sidecar->mark_len) != 0)) {
+        printf("[warning] %s is not a sidecar, skipping\n", path);
         close(fd1);
+    } else if (mark[sidecar->mark_len] != 0x01) {
+        printf("[warning] %s is version %d, skipping\n", path, mark[sidecar->mark_len]);
+        close(fd1);
+    } else if (rename(path, bck) != 0) {
+        printf("[error] could not backup %s\n", path);
+        close(fd1);
+        ret = EXIT_FAILURE;
+    } else {
+        FILE* in = fopen(bck, "r");
+        FILE* out = fopen(path, "w");
+        if (in && out) {
+            char entry1[sidecar->size];
+            char entry2[sidecar->new_size];
+            mark[sidecar->mark_len] = sidecar->version;
+            fwrite(mark, sidecar->mark_len + 1, 1, out);
+            fseek(in, sidecar->mark_len + 1, SEEK_SET);
+            while (fread(entry1, sidecar->size, 1, in) == 1) {
+                cd_offset offset = *(uint32_t*)entry1;
+                if (index == CD_SIDECAR_VIDEOS) {
+                    cd_video_entry_v1* video1 = (cd_video_entry_v1*)entry1;
+                    cd_video_entry* video2 = (cd_video_entry*)entry2;
+                    video2->offset = offset;
+                    memcpy(&video2->seconds, video1->video, sizeof(video1->video));
+                    // Streams grow too, so their offsets move
+                    video2->audio = (video1->audio) ? cd_sidecar_offset(&sidecars[CD_SIDECAR_STREAMS], video1->audio) : 0;
+                    memcpy(&video2->vstreams, video1->data, sizeof(video1->data));
+                } else {
+                    memcpy(entry2, &offset, sizeof(cd_offset));
+                    memcpy(entry2 + sizeof(cd_offset), entry1 + sizeof(uint32_t), sidecar->size - sizeof(uint32_t));
+                }
+                if (fwrite(entry2, sidecar->new_size, 1, out) != 1) break;
+                count++;
+            }
+            if (ferror(in) || ferror(out)) {
+                printf("[error] failed to convert %s\n", path);
+                ret = EXIT_FAILURE;
+            }
+            printf("[info] %s: %llu entries, backup is %s\n", path, (unsigned long long)count, bck);
+            // Kept open to check which sidecar records point to
+            sidecar->fd = fd1;
+        } else {
+            printf("[error] could not create %s\n", path);
+            close(fd1);
+            ret = EXIT_FAILURE;
+        }
+        if (out) fclose(out);
+        if (in) fclose(in);
+    }
+    free(bck);
+    free(path);
+    return ret;
+}
+
+// Sidecars are named after path, the final index
+int cd_upgrade_v2_to_v3(const char* v2, const char* v3, const char* path) {
+    int i, ret = EXIT_SUCCESS;
+    uint32_t id;
+    cd_size lost = 0, moved = 0;
+    cd_iso_header header;
+    cd_file_entry_v2 entry2;
+    cd_file_entry_v3 entry3;
+    cd_sidecar_v1 sidecars[CD_SIDECARS] = {
+        { CD_PICTURE_EXT, CD_PICTURE_MARK, CD_PICTURE_MARK_LEN,
+          sizeof(cd_picture_entry_v1), sizeof(cd_picture_entry), CD_PICTURE_VERSION, -1 },
+        { CD_MUSIC_EXT, CD_MUSIC_MARK, CD_MUSIC_MARK_LEN,
+          sizeof(cd_audio_entry_v1), sizeof(cd_audio_entry), CD_MUSIC_VERSION, -1 },
+        { CD_VIDEO_EXT, CD_VIDEO_MARK, CD_VIDEO_MARK_LEN,
+          sizeof(cd_video_entry_v1), sizeof(cd_video_entry), CD_VIDEO_VERSION, -1 },
+        { CD_ASTREAMS_EXT, CD_STREAMS_MARK, CD_STREAMS_MARK_LEN,
+          sizeof(cd_stream_entry_v1), sizeof(cd_stream_entry), CD_STREAMS_VERSION, -1 }
+    };
+    cd_catalog* catalog = cd_catalog_open(v2);
+    if (!catalog) {
+        printf("[error] could not open %s\n", v2);
+        return EXIT_FAILURE;
+    }
+    FILE* out = fopen(v3, "w");
+    if (!out) {
+        printf("[error] could not create %s\n", v3);
+        cd_catalog_close(catalog);
+        return EXIT_FAILURE;
+    }
+    if ((strlen(path) > 4) && !strcmp(&path[strlen(path)-4], CD_BASE_EXT)) {
+        for (i = 0; i < CD_SIDECARS; i++) {
+            if (cd_upgrade_sidecar_v1(sidecars, i, path) != EXIT_SUCCESS) ret = EXIT_FAILURE;
+        }
+    }
+    if (cd_upgrade_read(catalog, 0, &header, sizeof(cd_iso_header))) {
+        header.mark.version = 0x03;
+        fwrite(&header, sizeof(cd_iso_header), 1, out);
+        for (id = 1; cd_upgrade_read(catalog, sizeof(cd_iso_header) + (off_t)(id - 1) * (sizeof(cd_file_entry_v2) - sizeof(uint32_t)),
+                                     (void*)&entry2 + sizeof(uint32_t), sizeof(cd_file_entry_v2) - sizeof(uint32_t)); id++) {
+            memcpy(&entry3.type, &entry2.type, (void*)&entry2.info - (void*)&entry2.type);
+            entry3.info = entry2.info;
+            entry3.parent = entry2.parent;
+            entry3.child = entry2.child;
+            entry3.next = entry2.next;
+            // Symlinks are not changed, other sidecars have larger entries now
+            if (entry2.info && (entry2.type != CD_LNK)) {
+                for (i = 0; (i < CD_SIDECAR_STREAMS) && !cd_sidecar_owns(&sidecars[i], entry2.info, id); i++);
+                if (i < CD_SIDECAR_STREAMS) {
+                    entry3.info = cd_sidecar_offset(&sidecars[i], entry2.info);
+                    moved++;
+                } else {
+                    printf("[warning] lost data of %.*s\n", CD_NAME_MAX, entry2.name);
+                    entry3.info = 0;
+                    lost++;
+                }
+            }
+            if (fwrite((void*)&entry3 + sizeof(cd_offset), sizeof(cd_file_entry_v3) - sizeof(cd_offset), 1, out) != 1) break;
+        }
+        if (ferror(out)) {
+            printf("[error] failed to convert %s\n", v2);
+            ret = EXIT_FAILURE;
+        }
+        printf("[info] records: %u, with data: %llu, lost data: %llu\n", id - 1, (unsigned long long)moved, (unsigned long long)lost);
+    } else {
+        printf("[error] could not read %s\n", v2);
+        ret = EXIT_FAILURE;
+    }
+    for (i = 0; i < CD_SIDECARS; i++) {
+        if (sidecars[i].fd != -1) close(sidecars[i].fd);
+    }
+    fclose(out);
+    cd_catalog_close(catalog);
+    return ret;
+}
+
+// Names go to the names heap of path, the final index
+int cd_upgrade_v3_to_v4(const char* v3, const char* v4, const char* path) {
+    int ret = EXIT_SUCCESS;
+    cd_offset id;
+    cd_offset heap = sizeof(cd_index_mark);
+    cd_iso_header header;
+    cd_index_mark mark;
+    cd_file_entry_v3 entry3;
+    cd_record_v4 record;
+    struct stat stat4;
+    if ((strlen(path) < 4) || strcmp(&path[strlen(path)-4], CD_BASE_EXT)) {
+        printf("[error] %s does not end with %s\n", path, CD_BASE_EXT);
+        return EXIT_FAILURE;
+    }
+    char* npath = strdup(path);
+    strcpy(&npath[strlen(path)-4], CD_NAMES_EXT);
+    cd_catalog* catalog = cd_catalog_open(v3);
+    if (!catalog) {
+        printf("[error] could not open %s\n", v3);
+        free(npath);
+        return EXIT_FAILURE;
+    }
+    FILE* out = fopen(v4, "w");
+    FILE* names = fopen(npath, "w");
+    if (!out || !names) {
+        printf("[error] could not create %s\n", (out) ? npath : v4);
+        if (names) fclose(names);
+        if (out) fclose(out);
+        cd_catalog_close(catalog);
+        free(npath);
+        return EXIT_FAILURE;
+    }
+    if (cd_upgrade_read(catalog, 0, &header, sizeof(cd_iso_header))) {
+        header.mark.version = 0x04;
+        fwrite(&header, sizeof(cd_iso_header), 1, out);
+        memcpy(&mark.mark, CD_NAMES_MARK, CD_INDEX_MARK_LEN);
+        mark.version = CD_NAMES_VERSION;
+        fwrite(&mark, sizeof(cd_index_mark), 1, names);
+        for (id = 1; cd_upgrade_read(catalog, sizeof(cd_iso_header) + (off_t)(id - 1) * (sizeof(cd_file_entry_v3) - sizeof(cd_offset)),
+                                     (void*)&entry3 + sizeof(cd_offset), sizeof(cd_file_entry_v3) - sizeof(cd_offset)); id++) {
+            record.type = entry3.type;
+            record.length = strnlen(entry3.name, CD_NAME_MAX);
+            memcpy(&record.mode, &entry3.mode, (void*)&entry3.info - (void*)&entry3.mode);
+            record.name = heap;
+            memcpy(&record.info, &entry3.info, sizeof(cd_file_entry_v3) - offsetof(cd_file_entry_v3, info));
+            if ((fwrite(entry3.name, 1, record.length, names) != record.length) ||
+                (fwrite(&record, sizeof(cd_record_v4), 1, out) != 1)) break;
+            heap += record.length;
+        }
+        if (ferror(out) || ferror(names)) {
+            printf("[error] failed to convert %s\n", v3);
+            ret = EXIT_FAILURE;
+        }
+        fflush(out);
+        fflush(names);
+        fstat(fileno(out), &stat4);
+        printf("[info] records: %llu, file size: %llu => %llu + %llu of names\n", (unsigned long long)id - 1,
+               (unsigned long long)catalog->length, (unsigned long long)stat4.st_size, (unsigned long long)heap);
+    } else {
+        printf("[error] could not read %s\n", v3);
+        ret = EXIT_FAILURE;
+    }
+    fclose(names);
+    fclose(out);
+    cd_catalog_close(catalog);
+    free(npath);
+    return ret;
+}
+
+int cd_upgrade_v4_to_v5(const char* v4, const char* v5) {
+    int ret = EXIT_SUCCESS;
+    cd_offset id;
+    cd_iso_header header;
+    cd_record record;
+    cd_catalog* catalog = cd_catalog_open(v4);
+    if (!catalog) {
+        printf("[error] could not open %s\n", v4);
+        return EXIT_FAILURE;
+    }
+    FILE* out = fopen(v5, "w");
+    if (!out) {
+        printf("[error] could not create %s\n", v5);
+        cd_catalog_close(catalog);
+        return EXIT_FAILURE;
+    }
+    if (cd_upgrade_read(catalog, 0, &header, sizeof(cd_iso_header))) {
+        header.mark.version = 0x05;
+        fwrite(&header, sizeof(cd_iso_header), 1, out);
+        // Files stay linked by next only, cdindex -p stores them one after another
+        record.count = 0;
+        for (id = 1; cd_upgrade_read(catalog, sizeof(cd_iso_header) + (off_t)(id - 1) * sizeof(cd_record_v4), &record, sizeof(cd_record_v4)); id++) {
+            if (fwrite(&record, CD_RECORD_SIZE, 1, out) != 1) break;
+        }
+        if (ferror(out)) {
+            printf("[error] failed to convert %s\n", v4);
+            ret = EXIT_FAILURE;
+        }
+        printf("[info] records: %llu\n", (unsigned long long)id - 1);
     } else {
+        printf("[error] could not read %s\n", v4);
         ret = EXIT_FAILURE;
     }
+    fclose(out);
+    cd_catalog_close(catalog);
     return ret;
 }
 
@@ -132,13 +498,35 @@ int cd_upgrade(const char* path) {
     cd_byte cdiver = cd_get_index_version(path);
     if (cdiver == 0x00) {
         ret = EXIT_FAILURE;
-    } else if (cdiver == 0x01) { // Upgrade to v2
+    } else if (cdiver < CD_INDEX_VERSION) {
         char* bck = strdup(path);
         bck[strlen(bck)-1] = '~';
         if (rename(path, bck) == 0) {
-            ret = cd_upgrade_v1_to_v2(bck, path);
+            // Each step but the last one writes a temporary file, like "base.cdi.v3"
+            char* from = bck;
+            char* to = NULL;
+            for (; (cdiver < CD_INDEX_VERSION) && (ret == EXIT_SUCCESS); cdiver++) {
+                if (cdiver + 1 < CD_INDEX_VERSION) {
+                    to = (char*)malloc(strlen(path) + 4);
+                    sprintf(to, "%s.v%d", path, cdiver + 1);
+                } else {
+                    to = strdup(path);
+                }
+                if (cdiver == 0x01) ret = cd_upgrade_v1_to_v2(from, to);
+                else if (cdiver == 0x02) ret = cd_upgrade_v2_to_v3(from, to, path);
+                else if (cdiver == 0x03) ret = cd_upgrade_v3_to_v4(from, to, path);
+                else ret = cd_upgrade_v4_to_v5(from, to);
+                if (from != bck) {
+                    unlink(from);
+                    free(from);
+                }
+                from = to;
+            }
+            if ((from != bck) && strcmp(from, path)) unlink(from);
+            if (from != bck) free(from);
         } else {
             printf("[error] could not backup %s\n", path);
+            ret = EXIT_FAILURE;
         }
         free(bck);
     } else if (cdiver == CD_INDEX_VERSION) {
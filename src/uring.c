@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cdindex.h"
+#include "scan.h"
+#include "uring.h"
+
+#define CD_URING_POINTER(RING, OFFSET) \
+    ((unsigned int*)((char*)(RING) + (OFFSET)))
+
+cd_uring* cd_uring_create(unsigned int entries) {
+    struct io_uring_params params;
+    cd_uring* ring = (cd_uring*)malloc(sizeof(cd_uring));
+    memset(&params, '\0', sizeof(struct io_uring_params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd == -1) {
+        free(ring);
+        return NULL;
+    }
+    ring->entries = params.sq_entries;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_size);
+            close(ring->fd);
+            free(ring);
+            return NULL;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_size);
+        munmap(ring->sq_ring, ring->sq_size);
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+    ring->sq_head  = CD_URING_POINTER(ring->sq_ring, params.sq_off.head);
+    ring->sq_tail  = CD_URING_POINTER(ring->sq_ring, params.sq_off.tail);
+    ring->sq_mask  = CD_URING_POINTER(ring->sq_ring, params.sq_off.ring_mask);
+    ring->sq_array = CD_URING_POINTER(ring->sq_ring, params.sq_off.array);
+    ring->cq_head  = CD_URING_POINTER(ring->cq_ring, params.cq_off.head);
+    ring->cq_tail  = CD_URING_POINTER(ring->cq_ring, params.cq_off.tail);
+    ring->cq_mask  = CD_URING_POINTER(ring->cq_ring, params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ring + params.cq_off.cqes);
+    return ring;
+}
+
+void cd_uring_free(cd_uring* ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_size);
+    munmap(ring->sq_ring, ring->sq_size);
+    close(ring->fd);
+    free(ring);
+}
+
+// Takes completions that arrived so far, returns their number
+static unsigned int cd_uring_reap(cd_uring* ring, struct statx* stx, struct stat64* stats, int* results) {
+    unsigned int reaped = 0;
+    struct io_uring_cqe* cqe;
+    unsigned int head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &ring->cqes[head & *ring->cq_mask];
+        results[cqe->user_data] = cqe->res;
+        if (cqe->res == 0) cd_scan_statx(&stx[cqe->user_data], &stats[cqe->user_data]);
+        head++;
+        reaped++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+// Waits for requests the kernel took before the ring failed, returns 0 if they could not be waited for
+static int cd_uring_drain(cd_uring* ring, unsigned int first, unsigned int done, struct statx* stx, struct stat64* stats, int* results) {
+    // Withdraw requests the kernel did not take yet
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+    while ((done += cd_uring_reap(ring, stx, stats, results)) < head - first) {
+        if ((syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1) && (errno != EINTR)) return 0;
+    }
+    return 1;
+}
+
+int cd_uring_stat(cd_uring* ring, int dirfd, const char** names, struct stat64* stats, int* results, unsigned int count) {
+    int lost = 0;
+    unsigned int i, batch, done, first, tail, index;
+    struct io_uring_sqe* sqe;
+    struct statx* stx = (struct statx*)malloc(ring->entries * sizeof(struct statx));
+    for (i = 0; (i < count) && !lost; i += batch) {
+        batch = (count - i > ring->entries) ? ring->entries : count - i;
+        first = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        tail = *ring->sq_tail;
+        for (index = 0; index < batch; index++, tail++) {
+            sqe = &ring->sqes[tail & *ring->sq_mask];
+            memset(sqe, '\0', sizeof(struct io_uring_sqe));
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dirfd;
+            sqe->addr = (unsigned long)names[i+index];
+            sqe->len = CD_STATX_MASK;
+            sqe->off = (unsigned long)&stx[index];
+            sqe->statx_flags = AT_SYMLINK_NOFOLLOW|AT_NO_AUTOMOUNT;
+            sqe->user_data = index;
+            ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+            // Entries which get no completion are stat'ed synchronously
+            results[i+index] = 1;
+        }
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+        for (done = 0; done < batch;) {
+            // The kernel stops submitting at a request which fails, like STATX on kernels without it,
+            // and then does not wait, so requests after it are submitted again on the next enter
+            unsigned int pending = tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+            if (syscall(__NR_io_uring_enter, ring->fd, pending, batch - done, IORING_ENTER_GETEVENTS, NULL, 0) == -1) {
+                if (errno == EINTR) continue;
+                // Requests still in flight would complete into the next batch, so wait for them and give up the ring
+                lost = 1;
+                if (!cd_uring_drain(ring, first, done, stx, &stats[i], &results[i])) stx = NULL; // The kernel may still write it
+                break;
+            }
+            done += cd_uring_reap(ring, stx, &stats[i], &results[i]);
+        }
+        for (index = 0; index < batch; index++) {
+            // Kernels without IORING_OP_STATX fail every request
+            if (results[i+index] != 0) results[i+index] = cd_scan_stat(dirfd, names[i+index], 0, &stats[i+index]);
+        }
+    }
+    // Lost the ring, so get the rest synchronously
+    for (; i < count; i++) results[i] = cd_scan_stat(dirfd, names[i], 0, &stats[i]);
+    free(stx);
+    return !lost;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#ifndef _CD_URING_H_
+#define _CD_URING_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    int fd;
+    unsigned int entries;
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    void* cq_ring;
+    size_t sq_size;
+    size_t cq_size;
+    size_t sqes_size;
+} cd_uring;
+
+cd_uring* cd_uring_create(unsigned int entries);
+
+void cd_uring_free(cd_uring* ring);
+
+// Stats names relative to dirfd, returns 0 if the ring failed and must be freed
+int cd_uring_stat(cd_uring* ring, int dirfd, const char** names, struct stat64* stats, int* results, unsigned int count);
+
+#endif /* _CD_URING_H_ */
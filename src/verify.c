@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2007 Andriy Lesyuk; All rights reserved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "data.h"
+#include "record.h"
+#include "catalog.h"
+#include "check.h"
+
+#define CD_DEFDIR       "/var/lib/cdindex"
+#define CD_BASE_EXT     ".cdi"
+
+#define CD_VERIFY_CHUNK 16      // Blocks of a mapped file checked by one job
+#define CD_VERIFY_BATCH 64      // Catalogs opened at once
+#define CD_VERIFY_ERROR 128
+
+/* options:
+ *  -j N    - check blocks using N threads, one per CPU by default
+ *  -q      - print only catalogs which failed
+ *
+ * Arguments are catalogs (.cdi files) or directories with them, the
+ * default directory if there are none. Blocks of all files of catalogs
+ * are checked against checksums written by cdindex -k, then each file
+ * of the index must be linked once, from the root or from its directory.
+ */
+
+// File of a catalog, mapped or read through blocks if it is compressed
+typedef struct {
+    char ext[CD_CHECK_EXT_LEN + 1];
+    const cd_dword* sums;
+    cd_offset size;
+    cd_dword block;
+    int fd;
+    const char* map;
+    size_t length;          // Of the map, size in checksums may differ
+    int mapped;             // Sidecar mapped here, not by the catalog
+} cd_verify_file;
+
+typedef struct {
+    cd_verify_file* file;
+    cd_offset first;
+    cd_offset count;
+    cd_offset failed;       // Block which did not match, plus one
+} cd_verify_job;
+
+typedef struct {
+    const char* path;
+    cd_catalog* catalog;
+    const char* map;        // Checksums or NULL
+    size_t length;
+    cd_verify_file* files;
+    cd_dword count;
+    size_t first;           // Its jobs in the queue
+    size_t jobs;
+    char error[CD_VERIFY_ERROR];    // Empty if the catalog is intact
+} cd_verify_catalog;
+
+typedef struct {
+    cd_verify_job* jobs;
+    size_t count;
+    size_t size;
+    size_t next;            // Taken by threads one by one
+} cd_verify_queue;
+
+static void cd_verify_add(cd_verify_queue* queue, cd_verify_file* file, cd_offset first, cd_offset count) {
+    if (queue->count == queue->size) {
+        queue->size = (queue->size) ? queue->size * 2 : 256;
+        queue->jobs = (cd_verify_job*)realloc(queue->jobs, queue->size * sizeof(cd_verify_job));
+    }
+    queue->jobs[queue->count].file = file;
+    queue->jobs[queue->count].first = first;
+    queue->jobs[queue->count].count = count;
+    queue->jobs[queue->count].failed = 0;
+    queue->count++;
+}
+
+// Finds files of the catalog and queues their blocks
+static void cd_verify_open(cd_verify_catalog* verify, cd_verify_queue* queue) {
+    cd_dword i;
+    cd_offset block, blocks;
+    verify->first = queue->count;
+    verify->catalog = cd_catalog_open(verify->path);
+    if (!verify->catalog) {
+        strcpy(verify->error, "could not open cd index");
+        return;
+    }
+    cd_catalog* catalog = verify->catalog;
+    // Header could not be uncompressed, so the mark is not known
+    if (catalog->damaged) {
+        snprintf(verify->error, CD_VERIFY_ERROR, "block 0 of %s is damaged", CD_CHECK_INDEX_EXT);
+        return;
+    }
+    if (memcmp(catalog->header.mark.mark, CD_INDEX_MARK, CD_INDEX_MARK_LEN) || (catalog->header.mark.version != CD_INDEX_VERSION)) {
+        strcpy(verify->error, "not a cd index of this version -- see cdupgrade");
+        return;
+    }
+    verify->map = cd_catalog_map(catalog, CD_CHECK_EXT, &verify->length);
+    if (!verify->map) return;
+    if (!cd_check_valid(verify->map, verify->length)) {
+        strcpy(verify->error, "checksums are damaged");
+        return;
+    }
+    const cd_check_header* header = (const cd_check_header*)verify->map;
+    const cd_check_file* files = (const cd_check_file*)(verify->map + sizeof(cd_check_header));
+    verify->files = (cd_verify_file*)calloc(header->files, sizeof(cd_verify_file));
+    for (i = 0; i < header->files; i++) {
+        cd_verify_file* file = &verify->files[verify->count++];
+        size_t length = 0;
+        memcpy(file->ext, files[i].ext, CD_CHECK_EXT_LEN);
+        file->sums = cd_check_sums(verify->map, header) + files[i].first;
+        file->size = files[i].size;
+        file->block = header->block;
+        file->fd = -1;
+        if (!strncmp(file->ext, CD_CHECK_INDEX_EXT, CD_CHECK_EXT_LEN)) {
+            file->fd = catalog->fd;
+            file->map = catalog->map;
+            length = catalog->length;
+        } else if (!strncmp(file->ext, CD_NAMES_EXT, CD_CHECK_EXT_LEN) && (catalog->names_fd != -1)) {
+            file->fd = catalog->names_fd;
+            file->map = catalog->names;
+            length = catalog->names_length;
+        } else {
+            struct stat st;
+            char* path = cd_catalog_sidecar(catalog, file->ext);
+            int found = !stat(path, &st);
+            free(path);
+            if (!found) {
+                snprintf(verify->error, CD_VERIFY_ERROR, "%s is missing", file->ext);
+                return;
+            }
+            file->map = cd_catalog_map(catalog, file->ext, &length);
+            file->mapped = (file->map != NULL);
+            if (!file->map) length = 0;
+            file->length = length;
+        }
+        if ((length != file->size) || (!file->map && (file->fd == -1) && length)) {
+            snprintf(verify->error, CD_VERIFY_ERROR, "size of %s does not match", file->ext);
+            return;
+        }
+        blocks = CD_CHECK_BLOCKS(file->size, file->block);
+        if (!blocks) continue;
+        // Compressed blocks are uncompressed by the one thread which reads them
+        if (!file->map) {
+            cd_verify_add(queue, file, 0, blocks);
+            continue;
+        }
+        for (block = 0; block < blocks; block += CD_VERIFY_CHUNK) {
+            cd_verify_add(queue, file, block, (blocks - block < CD_VERIFY_CHUNK) ? blocks - block : CD_VERIFY_CHUNK);
+        }
+    }
+}
+
+static void cd_verify_run(cd_verify_job* job) {
+    cd_offset i;
+    cd_verify_file* file = job->file;
+    char* buffer = (file->map) ? NULL : (char*)malloc(file->block);
+    for (i = job->first; i < job->first + job->count; i++) {
+        const char* data = NULL;
+        size_t offset = i * file->block;
+        size_t size = (file->size - offset < file->block) ? file->size - offset : file->block;
+        if (file->map) data = file->map + offset;
+        else if (cd_block_pread(file->fd, buffer, size, offset) == (ssize_t)size) data = buffer;
+        if (!data || (cd_crc32c(0, data, size) != file->sums[i])) {
+            job->failed = i + 1;
+            break;
+        }
+    }
+    free(buffer);
+}
+
+static void* cd_verify_worker(void* data) {
+    size_t i;
+    cd_verify_queue* queue = (cd_verify_queue*)data;
+    while ((i = __sync_fetch_and_add(&queue->next, 1)) < queue->count) cd_verify_run(&queue->jobs[i]);
+    return NULL;
+}
+
+// Each file must be linked once and its name must be in the heap
+static int cd_verify_links(cd_catalog* catalog, char* error) {
+    cd_offset dir, id;
+    cd_record buffer;
+    const cd_record* record = NULL;
+    char name[CD_NAME_MAX];
+    uint8_t* seen = (uint8_t*)calloc(catalog->records / 8 + 1, 1);
+    // The root is linked from the first record
+    for (dir = 0; !*error && (dir <= catalog->records); dir++) {
+        if (!dir) {
+            id = (catalog->records) ? 1 : 0;
+        } else if ((record = cd_catalog_record(catalog, dir, &buffer))) {
+            id = record->child;
+        } else {
+            snprintf(error, CD_VERIFY_ERROR, "record #%llu cannot be read", (unsigned long long)dir);
+            break;
+        }
+        for (; id; id = record->next) {
+            if (id > catalog->records) {
+                snprintf(error, CD_VERIFY_ERROR, "link to record #%llu, which does not exist", (unsigned long long)id);
+            } else if (seen[(id - 1) >> 3] & (1 << ((id - 1) & 7))) {
+                snprintf(error, CD_VERIFY_ERROR, "record #%llu is linked twice", (unsigned long long)id);
+            } else if (!(record = cd_catalog_record(catalog, id, &buffer))) {
+                snprintf(error, CD_VERIFY_ERROR, "record #%llu cannot be read", (unsigned long long)id);
+            } else if (!cd_catalog_name(catalog, record, name)) {
+                snprintf(error, CD_VERIFY_ERROR, "name of record #%llu is out of the names heap", (unsigned long long)id);
+            }
+            if (*error) break;
+            seen[(id - 1) >> 3] |= 1 << ((id - 1) & 7);
+        }
+    }
+    free(seen);
+    return !*error;
+}
+
+// Prints the result, returns false if the catalog failed
+static int cd_verify_report(cd_verify_catalog* verify, cd_verify_queue* queue, int quiet) {
+    size_t i;
+    for (i = verify->first; !*verify->error && (i < verify->first + verify->jobs); i++) {
+        cd_verify_job* job = &queue->jobs[i];
+        if (job->failed) {
+            snprintf(verify->error, CD_VERIFY_ERROR, "block %llu of %s is damaged", (unsigned long long)job->failed - 1, job->file->ext);
+        }
+    }
+    if (!*verify->error && (verify->catalog->names_fd == -1)) strcpy(verify->error, "could not open names");
+    int failed = (*verify->error || !cd_verify_links(verify->catalog, verify->error));
+    if (failed) printf("%s: FAILED, %s\n", verify->path, verify->error);
+    else if (!quiet) printf("%s: OK%s\n", verify->path, (verify->map) ? "" : ", no checksums");
+    return !failed;
+}
+
+static void cd_verify_close(cd_verify_catalog* verify) {
+    cd_dword i;
+    for (i = 0; i < verify->count; i++) {
+        if (verify->files[i].mapped) cd_catalog_unmap(verify->files[i].map, verify->files[i].length);
+    }
+    free(verify->files);
+    if (verify->map) cd_catalog_unmap(verify->map, verify->length);
+    if (verify->catalog) cd_catalog_close(verify->catalog);
+}
+
+static int cd_verify_compare(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Adds the catalog or catalogs of the directory, sorted by name
+static int cd_verify_find(const char* path, char*** paths, size_t* count) {
+    struct stat st;
+    struct dirent* f;
+    if (stat(path, &st)) {
+        printf("cdverify: %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        *paths = (char**)realloc(*paths, (*count + 1) * sizeof(char*));
+        (*paths)[(*count)++] = strdup(path);
+        return 1;
+    }
+    DIR* d = opendir(path);
+    if (!d) {
+        printf("cdverify: %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    size_t first = *count;
+    while ((f = readdir(d))) {
+        size_t length = strlen(f->d_name);
+        if ((length > 4) && !strcasecmp(f->d_name + length - 4, CD_BASE_EXT)) {
+            *paths = (char**)realloc(*paths, (*count + 1) * sizeof(char*));
+            if (asprintf(&(*paths)[*count], "%s/%s", path, f->d_name) != -1) (*count)++;
+        }
+    }
+    closedir(d);
+    qsort(*paths + first, *count - first, sizeof(char*), cd_verify_compare);
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    int opt, i;
+    int quiet = 0;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char** paths = NULL;
+    size_t count = 0;
+    size_t first, j;
+    int result = 1;
+    while ((opt = getopt(argc, argv, "j:q")) != -1) {
+        if (opt == 'j') {
+            threads = atoi(optarg);
+            if (threads < 1) {
+                printf("cdverify: invalid number of threads: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+        } else if (opt == 'q') {
+            quiet = 1;
+        } else {
+            return EXIT_FAILURE;
+        }
+    }
+    if (threads < 1) threads = 1;
+    if (optind == argc) result = cd_verify_find(CD_DEFDIR, &paths, &count);
+    for (i = optind; i < argc; i++) result &= cd_verify_find(argv[i], &paths, &count);
+    pthread_t* workers = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    cd_verify_catalog* batch = (cd_verify_catalog*)malloc(CD_VERIFY_BATCH * sizeof(cd_verify_catalog));
+    cd_verify_queue queue = { NULL, 0, 0, 0 };
+    for (first = 0; first < count; first += CD_VERIFY_BATCH) {
+        size_t size = (count - first < CD_VERIFY_BATCH) ? count - first : CD_VERIFY_BATCH;
+        long started = 0;
+        queue.count = 0;
+        queue.next = 0;
+        memset(batch, '\0', size * sizeof(cd_verify_catalog));
+        for (j = 0; j < size; j++) {
+            batch[j].path = paths[first + j];
+            cd_verify_open(&batch[j], &queue);
+            batch[j].jobs = queue.count - batch[j].first;
+        }
+        // This thread takes jobs too
+        while ((started < threads - 1) && (started < (long)queue.count - 1) &&
+               !pthread_create(&workers[started], NULL, cd_verify_worker, &queue)) started++;
+        cd_verify_worker(&queue);
+        while (started) pthread_join(workers[--started], NULL);
+        for (j = 0; j < size; j++) {
+            if (!cd_verify_report(&batch[j], &queue, quiet)) result = 0;
+            cd_verify_close(&batch[j]);
+        }
+    }
+    free(queue.jobs);
+    free(batch);
+    free(workers);
+    for (j = 0; j < count; j++) free(paths[j]);
+    free(paths);
+    return (result) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -10,6 +10,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <libavformat/avformat.h>
 #include <libffmpegthumbnailer/videothumbnailerc.h>
 
@@ -27,7 +28,11 @@ typedef struct {
     const char* vapath;
     int vfd;
     int vafd;
+    int vprev_fd;           // Previous databases or -1
+    int vaprev_fd;
     int skip_thumbs;
+    cd_base* base;
+    pthread_mutex_t lock;   // Guards files and thumbnail directory
 } cd_video_base;
 
 typedef struct {
@@ -90,12 +95,52 @@ static inline void cd_get_offset_and_range(int* start, int* range) {
 }
 
 int cd_video_thumbnail_init(cd_video_base* vbase) {
+    pthread_mutex_lock(&vbase->lock);
     if (vbase->skip_thumbs == -1) {
         vbase->skip_thumbs = cd_create_data_dir(vbase->dir);
     }
+    pthread_mutex_unlock(&vbase->lock);
     return !vbase->skip_thumbs;
 }
 
+int cd_video_open(cd_video_base* vbase) {
+    if (vbase->vfd == -1) {
+        vbase->vfd = cd_sidecar_open(vbase->base, vbase->vpath);
+        if (vbase->vfd == -1) return 0;
+        if (lseek(vbase->vfd, 0, SEEK_END) == 0) {
+            cd_video_mark vmark;
+            memcpy(&vmark.mark, CD_VIDEO_MARK, CD_VIDEO_MARK_LEN);
+            vmark.version = CD_VIDEO_VERSION;
+            write(vbase->vfd, &vmark, sizeof(cd_video_mark));
+        }
+        vbase->vafd = cd_sidecar_open(vbase->base, vbase->vapath);
+        if (vbase->vafd == -1) return 0;
+        if (lseek(vbase->vafd, 0, SEEK_END) == 0) {
+            cd_streams_mark vamark;
+            memcpy(&vamark.mark, CD_STREAMS_MARK, CD_STREAMS_MARK_LEN);
+            vamark.version = CD_STREAMS_VERSION;
+            write(vbase->vafd, &vamark, sizeof(cd_streams_mark));
+        }
+    }
+    return (vbase->vafd != -1);
+}
+
+off_t cd_video_add(cd_video_base* vbase, cd_video_entry* entry, cd_stream_entry* sentries) {
+    off_t offset = 0;
+    // Streams of one video must stay contiguous in the streams database
+    pthread_mutex_lock(&vbase->lock);
+    if (cd_video_open(vbase)) {
+        if (entry->astreams) {
+            entry->audio = lseek(vbase->vafd, 0, SEEK_END);
+            write(vbase->vafd, sentries, entry->astreams * sizeof(cd_stream_entry));
+        }
+        offset = lseek(vbase->vfd, 0, SEEK_END);
+        write(vbase->vfd, entry, sizeof(cd_video_entry));
+    }
+    pthread_mutex_unlock(&vbase->lock);
+    return offset;
+}
+
 cd_bool cd_video_get_interlaced(AVFormatContext* format, int vindex) {
     int interlaced = 0;
     AVCodec* decoder = avcodec_find_decoder(format->streams[vindex]->codecpar->codec_id);
@@ -130,7 +175,7 @@ cd_bool cd_video_get_interlaced(AVFormatContext* format, int vindex) {
     return interlaced;
 }
 
-int cd_video_generate_thumbnails(const char* file, int duration, int id, const char* dir) {
+int cd_video_generate_thumbnails(const char* file, int duration, cd_offset id, const char* dir) {
     int i, tid = 0;
     char stime[24];
     const char* ext = strrchr(file, '.');
@@ -146,9 +191,9 @@ int cd_video_generate_thumbnails(const char* file, int duration, int id, const c
         seek = (augment > 1) ? start + (rand() % augment) + augment * i : 0;
         sprintf(stime, "%d:%02d:%02d", (int)floor(seek / 3600), (int)floor((seek % 3600) / 60), seek % 60);
         thumbnailer->seek_time = stime;
-        char* tpath = (char*)malloc(strlen(dir) + 16);
-        sprintf(tpath, "%s/%u-%d.jpg", dir, id, ++tid);
-        printf("[video] writing frame at %s to %s\n", stime, tpath);
+        char* tpath = (char*)malloc(strlen(dir) + 32);
+        sprintf(tpath, "%s/%llu-%d.jpg", dir, (unsigned long long)id, ++tid);
+        CD_LOG(CD_LOG_FILE, "[video] writing frame at %s to %s\n", stime, tpath);
         video_thumbnailer_generate_thumbnail_to_file(thumbnailer, file, tpath);
         free(tpath);
         if (augment <= 1) break;
@@ -172,31 +217,23 @@ void* cd_video_init(cd_base* base) {
     strncpy((char*)vbase->vapath, base->base_name, baselen - 4);
     ((char*)vbase->vapath)[baselen-4] = '\0';
     strcat((char*)vbase->vapath, CD_ASTREAMS_EXT);
+    vbase->vafd = -1;
+    vbase->vprev_fd = (base->update) ? cd_open_previous(vbase->vpath) : -1;
+    vbase->vaprev_fd = (base->update) ? cd_open_previous(vbase->vapath) : -1;
     vbase->skip_thumbs = -1;
+    vbase->base = base;
+    pthread_mutex_init(&vbase->lock, NULL);
+    av_register_all();
     return vbase;
 }
 
 cd_offset cd_video_getdata(const char* file, cd_file_entry* cdentry, void* udata) {
-    if (((cd_video_base*)udata)->vfd == -1) {
-        ((cd_video_base*)udata)->vfd = open(((cd_video_base*)udata)->vpath, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-        if (((cd_video_base*)udata)->vfd == -1) return 0;
-        cd_video_mark vmark;
-        memcpy(&vmark.mark, CD_VIDEO_MARK, CD_VIDEO_MARK_LEN);
-        vmark.version = CD_VIDEO_VERSION;
-        write(((cd_video_base*)udata)->vfd, &vmark, sizeof(cd_video_mark));
-        ((cd_video_base*)udata)->vafd = open(((cd_video_base*)udata)->vapath, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-        if (((cd_video_base*)udata)->vafd == -1) return 0;
-        cd_streams_mark vamark;
-        memcpy(&vamark.mark, CD_STREAMS_MARK, CD_STREAMS_MARK_LEN);
-        vamark.version = CD_STREAMS_VERSION;
-        write(((cd_video_base*)udata)->vafd, &vamark, sizeof(cd_streams_mark));
-    }
     AVFormatContext* format = NULL;
-    av_register_all();
     if (avformat_open_input(&format, file, NULL, NULL) == 0) {
         avformat_find_stream_info(format, NULL);
-        off_t aoffset;
+        off_t offset;
         cd_video_entry entry;
+        cd_stream_entry sentries[format->nb_streams + 1];
         memset(&entry, 0x00, sizeof(cd_video_entry));
         entry.seconds = (format->duration != AV_NOPTS_VALUE) ? format->duration / AV_TIME_BASE : 0;
         int i, vindex = -1;
@@ -227,32 +264,29 @@ cd_offset cd_video_getdata(const char* file, cd_file_entry* cdentry, void* udata
                 }
                 entry.vstreams++;
             } else if (format->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
-                cd_stream_entry sentry;
-                memset(&sentry, 0x00, sizeof(cd_stream_entry));
+                cd_stream_entry* sentry = &sentries[entry.astreams];
+                memset(sentry, 0x00, sizeof(cd_stream_entry));
                 if (format->streams[i]->codecpar->codec_id != AV_CODEC_ID_NONE) {
                     const char* codec = avcodec_get_name(format->streams[i]->codecpar->codec_id);
-                    if (codec) strncpy(sentry.codec, codec, 18);
-                    cd_get_codec_tag(sentry.codec_tag, format->streams[i]->codecpar->codec_tag);
+                    if (codec) strncpy(sentry->codec, codec, 18);
+                    cd_get_codec_tag(sentry->codec_tag, format->streams[i]->codecpar->codec_tag);
                 }
-                if (format->streams[i]->codecpar->sample_rate) sentry.freq = format->streams[i]->codecpar->sample_rate;
-                sentry.channels = format->streams[i]->codecpar->channels;
-                sentry.bitrate = format->streams[i]->codecpar->bit_rate / 1000;
+                if (format->streams[i]->codecpar->sample_rate) sentry->freq = format->streams[i]->codecpar->sample_rate;
+                sentry->channels = format->streams[i]->codecpar->channels;
+                sentry->bitrate = format->streams[i]->codecpar->bit_rate / 1000;
                 AVDictionaryEntry* lang = av_dict_get(format->streams[i]->metadata, "language", NULL, 0);
-                if (lang) strncpy(sentry.lang, lang->value, 3);
-                if (format->streams[i]->disposition & AV_DISPOSITION_ORIGINAL) sentry.translation = TRANSLATION_ORIGINAL;
-                else if (format->streams[i]->disposition & AV_DISPOSITION_DUB) sentry.translation = TRANSLATION_DUBBED;
+                if (lang) strncpy(sentry->lang, lang->value, 3);
+                if (format->streams[i]->disposition & AV_DISPOSITION_ORIGINAL) sentry->translation = TRANSLATION_ORIGINAL;
+                else if (format->streams[i]->disposition & AV_DISPOSITION_DUB) sentry->translation = TRANSLATION_DUBBED;
                 entry.astreams++;
-                aoffset = lseek(((cd_video_base*)udata)->vafd, 0, SEEK_END);
-                write(((cd_video_base*)udata)->vafd, &sentry, sizeof(cd_stream_entry));
-                if (entry.audio == 0) entry.audio = aoffset;
             } else if (format->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_SUBTITLE) {
                 entry.subtitles++;
             }
         }
         if (vindex != -1) entry.video.interlaced = cd_video_get_interlaced(format, vindex);
-        off_t offset = lseek(((cd_video_base*)udata)->vfd, 0, SEEK_END);
-        write(((cd_video_base*)udata)->vfd, &entry, sizeof(cd_video_entry));
+        offset = cd_video_add((cd_video_base*)udata, &entry, sentries);
         avformat_close_input(&format);
+        if (!offset) return 0;
 #ifdef INCLUDE_THUMBNAILS
         if ((entry.seconds > 0) && (vindex != -1) && cd_video_thumbnail_init((cd_video_base*)udata)) {
             cd_video_generate_thumbnails(file, entry.seconds, cdentry->id, ((cd_video_base*)udata)->dir);
@@ -260,17 +294,93 @@ cd_offset cd_video_getdata(const char* file, cd_file_entry* cdentry, void* udata
 #endif /* INCLUDE_THUMBNAILS */
         return offset;
     } else {
-        printf("[warning] failed to open %s\n", file);
+        CD_LOG(CD_LOG_WARNING, "[warning] failed to open %s\n", file);
     }
     return 0;
 }
 
+cd_offset cd_video_copy(cd_offset info, cd_offset previous, cd_file_entry* cdentry, void* udata) {
+    int i;
+    cd_video_entry entry;
+    cd_video_base* vbase = (cd_video_base*)udata;
+    if ((vbase->vprev_fd == -1) || (pread(vbase->vprev_fd, &entry, sizeof(cd_video_entry), info) != sizeof(cd_video_entry))) return 0;
+    cd_stream_entry sentries[entry.astreams + 1];
+    if (entry.astreams && ((vbase->vaprev_fd == -1) ||
+        (pread(vbase->vaprev_fd, sentries, entry.astreams * sizeof(cd_stream_entry), entry.audio) != entry.astreams * sizeof(cd_stream_entry)))) {
+        entry.astreams = 0;
+        entry.audio = 0;
+    }
+    off_t offset = cd_video_add(vbase, &entry, sentries);
+#ifdef INCLUDE_THUMBNAILS
+    if (offset && (entry.seconds > 0) && cd_video_thumbnail_init(vbase)) {
+        char from[32], to[32];
+        for (i = 1; i <= CD_THUMBNAILS; i++) {
+            sprintf(from, "%llu-%d.jpg", (unsigned long long)previous, i);
+            sprintf(to, "%llu-%d.jpg", (unsigned long long)cdentry->id, i);
+            if (!cd_relink_thumbnail(vbase->dir, from, to)) break;
+        }
+    }
+#endif /* INCLUDE_THUMBNAILS */
+    return offset;
+}
+
+int cd_video_save(cd_offset info, cd_file_entry* cdentry, int fd, const char* thumbnail, void* udata) {
+    int i;
+    cd_video_entry entry;
+    cd_video_base* vbase = (cd_video_base*)udata;
+    if (pread(vbase->vfd, &entry, sizeof(cd_video_entry), info) != sizeof(cd_video_entry)) return 0;
+    cd_stream_entry sentries[entry.astreams + 1];
+    if (entry.astreams && (pread(vbase->vafd, sentries, entry.astreams * sizeof(cd_stream_entry), entry.audio) != entry.astreams * sizeof(cd_stream_entry))) return 0;
+    // Streams are stored right after the video
+    if ((write(fd, &entry, sizeof(cd_video_entry)) != sizeof(cd_video_entry)) ||
+        (write(fd, sentries, entry.astreams * sizeof(cd_stream_entry)) != entry.astreams * sizeof(cd_stream_entry))) return 0;
+#ifdef INCLUDE_THUMBNAILS
+    char* from = (char*)malloc(strlen(vbase->dir) + 32);
+    char* to = (char*)malloc(strlen(thumbnail) + 8);
+    for (i = 1; i <= CD_THUMBNAILS; i++) {
+        sprintf(from, "%s/%llu-%d.jpg", vbase->dir, (unsigned long long)cdentry->id, i);
+        sprintf(to, "%s-%d.jpg", thumbnail, i);
+        if (!cd_cache_link(from, to)) break;
+    }
+    free(to);
+    free(from);
+#endif /* INCLUDE_THUMBNAILS */
+    return 1;
+}
+
+cd_offset cd_video_load(int fd, const char* thumbnail, cd_file_entry* cdentry, void* udata) {
+    int i;
+    cd_video_entry entry;
+    cd_video_base* vbase = (cd_video_base*)udata;
+    if (read(fd, &entry, sizeof(cd_video_entry)) != sizeof(cd_video_entry)) return 0;
+    cd_stream_entry sentries[entry.astreams + 1];
+    if (read(fd, sentries, entry.astreams * sizeof(cd_stream_entry)) != entry.astreams * sizeof(cd_stream_entry)) return 0;
+    off_t offset = cd_video_add(vbase, &entry, sentries);
+#ifdef INCLUDE_THUMBNAILS
+    if (offset && (entry.seconds > 0) && cd_video_thumbnail_init(vbase)) {
+        char* from = (char*)malloc(strlen(thumbnail) + 8);
+        char* to = (char*)malloc(strlen(vbase->dir) + 32);
+        for (i = 1; i <= CD_THUMBNAILS; i++) {
+            sprintf(from, "%s-%d.jpg", thumbnail, i);
+            sprintf(to, "%s/%llu-%d.jpg", vbase->dir, (unsigned long long)cdentry->id, i);
+            if (!cd_cache_link(from, to)) break;
+        }
+        free(to);
+        free(from);
+    }
+#endif /* INCLUDE_THUMBNAILS */
+    return offset;
+}
+
 void cd_video_finish(void* udata) {
     if (((cd_video_base*)udata)->vfd != -1) close(((cd_video_base*)udata)->vfd);
+    if (((cd_video_base*)udata)->vprev_fd != -1) cd_close_previous(((cd_video_base*)udata)->vprev_fd, ((cd_video_base*)udata)->vpath);
+    if (((cd_video_base*)udata)->vaprev_fd != -1) cd_close_previous(((cd_video_base*)udata)->vaprev_fd, ((cd_video_base*)udata)->vapath);
     free((void*)((cd_video_base*)udata)->vpath);
     if (((cd_video_base*)udata)->vafd != -1) close(((cd_video_base*)udata)->vafd);
     free((void*)((cd_video_base*)udata)->vapath);
     free((void*)((cd_video_base*)udata)->dir);
+    pthread_mutex_destroy(&((cd_video_base*)udata)->lock);
     free(udata);
 }
 
@@ -280,6 +390,9 @@ static cd_extractor_info cd_video = {
     cd_video_init,
     cd_video_getdata,
     cd_video_finish,
+    cd_video_copy,
+    cd_video_save,
+    cd_video_load,
     NULL,
     NULL,
     NULL
@@ -10,11 +10,11 @@
 
 #define CD_VIDEO_MARK       "CDV"
 #define CD_VIDEO_MARK_LEN   3
-#define CD_VIDEO_VERSION    0x01
+#define CD_VIDEO_VERSION    0x02
 
 #define CD_STREAMS_MARK     "CDVA"
 #define CD_STREAMS_MARK_LEN 4
-#define CD_STREAMS_VERSION  0x01
+#define CD_STREAMS_VERSION  0x02
 
 enum translations {
     TRANSLATION_UNKNOWN   = 0x00,
@@ -34,7 +34,7 @@ static const cd_search_item cd_translation_map[] = {
 
 typedef struct {
     char mark[3];           // "CDV"
-    cd_byte version;        // 0x01
+    cd_byte version;        // 0x02
 } packed(cd_video_mark);
 
 typedef struct {
@@ -62,7 +62,7 @@ typedef struct {
 
 typedef struct {
     char mark[4];           // "CDVA"
-    cd_byte version;        // 0x01
+    cd_byte version;        // 0x02
 } packed(cd_streams_mark);
 
 typedef struct {